@@ -0,0 +1,206 @@
+//! A small timing harness shared by the benchmarks, modelled on Criterion's command line.
+//!
+//!     cargo bench -- --save-baseline main    # record a baseline
+//!     cargo bench -- --baseline main         # compare against it
+//!     cargo bench -- memory/                 # run benchmarks whose name contains a filter
+//!
+//! Baselines are stored under `target/bench-baselines/<name>/<bench target>.txt`.
+
+#![allow(dead_code)]
+
+use std::collections::HashMap;
+use std::fs;
+use std::hint::black_box;
+use std::io::{BufRead, BufReader};
+use std::path::PathBuf;
+use std::time::{Duration, Instant};
+
+use operating_system_simulator::io::{Disk, generator::{self, WorkloadConfig}, loader};
+
+const PROGRAM_FILE_PATH: &str = "data/program_file.txt";
+const GENERATOR_SEED: u64 = 0x05_5EED;
+const WARM_UP_TIME: Duration = Duration::from_millis(200);
+const SAMPLE_COUNT: usize = 30;
+const SAMPLE_TIME: Duration = Duration::from_millis(10);
+
+pub struct Bencher {
+    target: String,
+    filter: Option<String>,
+    save_baseline: Option<String>,
+    baseline: HashMap<String, f64>,
+    results: Vec<(String, f64)>,
+}
+
+impl Bencher {
+    /// Reads the filter and baseline options passed after `cargo bench --`.
+    pub fn from_args(target: &str) -> Bencher {
+        let mut filter = None;
+        let mut save_baseline = None;
+        let mut baseline = HashMap::new();
+
+        let mut args = std::env::args().skip(1);
+        while let Some(arg) = args.next() {
+            match arg.as_str() {
+                "--save-baseline" => save_baseline = args.next(),
+                "--baseline" => baseline = args.next().map(|name| read_baseline(&name, target)).unwrap_or_default(),
+                "--bench" => {}
+                _ if arg.starts_with("--") => {}
+                _ => filter = Some(arg),
+            }
+        }
+
+        Bencher {
+            target: target.to_string(),
+            filter,
+            save_baseline,
+            baseline,
+            results: Vec::new(),
+        }
+    }
+
+    /// Times `routine` and reports the median time per call.
+    pub fn bench<T>(&mut self, name: &str, mut routine: impl FnMut() -> T) {
+        if !self.is_selected(name) {
+            return;
+        }
+
+        let iterations = calibrate(|| { black_box(routine()); });
+        let mut samples: Vec<f64> = (0..SAMPLE_COUNT)
+            .map(|_| {
+                let start = Instant::now();
+                for _ in 0..iterations {
+                    black_box(routine());
+                }
+                start.elapsed().as_nanos() as f64 / iterations as f64
+            })
+            .collect();
+
+        self.report(name, median(&mut samples));
+    }
+
+    /// Like `bench`, but runs `setup` before every call and leaves it out of the measurement.
+    pub fn bench_with_setup<S, T>(&mut self, name: &str, mut setup: impl FnMut() -> S, mut routine: impl FnMut(S) -> T) {
+        if !self.is_selected(name) {
+            return;
+        }
+
+        let iterations = calibrate(|| { black_box(routine(setup())); });
+        let mut samples: Vec<f64> = (0..SAMPLE_COUNT)
+            .map(|_| {
+                let mut elapsed = Duration::ZERO;
+                for _ in 0..iterations {
+                    let input = setup();
+                    let start = Instant::now();
+                    black_box(routine(input));
+                    elapsed += start.elapsed();
+                }
+                elapsed.as_nanos() as f64 / iterations as f64
+            })
+            .collect();
+
+        self.report(name, median(&mut samples));
+    }
+
+    /// Writes the baseline, if one was requested.
+    pub fn finish(self) {
+        let Some(name) = self.save_baseline else { return };
+
+        let path = baseline_path(&name, &self.target);
+        let contents: String = self.results.iter().map(|(bench, nanos)| format!("{} {}\n", bench, nanos)).collect();
+
+        let result = fs::create_dir_all(path.parent().unwrap()).and_then(|_| fs::write(&path, contents));
+        if let Err(err) = result {
+            println!("Failed to save baseline to {}: {}", path.display(), err);
+        }
+    }
+
+    fn is_selected(&self, name: &str) -> bool {
+        self.filter.as_ref().map_or(true, |filter| name.contains(filter.as_str()))
+    }
+
+    fn report(&mut self, name: &str, nanos: f64) {
+        let change = match self.baseline.get(name) {
+            Some(&previous) => format!("{:+.2}%", 100.0 * (nanos - previous) / previous),
+            None => String::new(),
+        };
+
+        println!("{:<48} {:>14} {:>10}", name, format_time(nanos), change);
+        self.results.push((name.to_string(), nanos));
+    }
+}
+
+/// Picks an iteration count that fills one sample, warming up along the way.
+fn calibrate(mut routine: impl FnMut()) -> u64 {
+    let start = Instant::now();
+    let mut iterations = 0u64;
+
+    while start.elapsed() < WARM_UP_TIME {
+        routine();
+        iterations += 1;
+    }
+
+    let per_iteration = WARM_UP_TIME.as_nanos() as f64 / iterations as f64;
+    ((SAMPLE_TIME.as_nanos() as f64 / per_iteration) as u64).max(1)
+}
+
+fn median(samples: &mut [f64]) -> f64 {
+    samples.sort_by(|a, b| a.partial_cmp(b).unwrap());
+    samples[samples.len() / 2]
+}
+
+fn format_time(nanos: f64) -> String {
+    match nanos {
+        n if n < 1e3 => format!("{:.1} ns", n),
+        n if n < 1e6 => format!("{:.2} us", n / 1e3),
+        n if n < 1e9 => format!("{:.2} ms", n / 1e6),
+        n => format!("{:.2} s", n / 1e9),
+    }
+}
+
+fn baseline_path(name: &str, target: &str) -> PathBuf {
+    let target_dir = std::env::var("CARGO_TARGET_DIR").unwrap_or_else(|_| "target".to_string());
+    PathBuf::from(target_dir).join("bench-baselines").join(name).join(format!("{}.txt", target))
+}
+
+fn read_baseline(name: &str, target: &str) -> HashMap<String, f64> {
+    let Ok(file) = fs::File::open(baseline_path(name, target)) else {
+        println!("No baseline named {} for {}", name, target);
+        return HashMap::new();
+    };
+
+    BufReader::new(file).lines()
+        .map_while(Result::ok)
+        .filter_map(|line| {
+            let (bench, nanos) = line.rsplit_once(' ')?;
+            Some((bench.to_string(), nanos.parse().ok()?))
+        })
+        .collect()
+}
+
+pub fn shipped_program_file() -> String {
+    fs::read_to_string(PROGRAM_FILE_PATH).unwrap()
+}
+
+/// Builds a reproducible job file of `job_count` jobs that reuse the shipped programs as templates.
+pub fn generated_program_file(job_count: usize) -> String {
+    let (disk, program_ids) = load_disk(&shipped_program_file());
+    let config = WorkloadConfig {
+        seed: GENERATOR_SEED,
+        job_count,
+        templates: generator::templates_from(&disk, &program_ids),
+        ..WorkloadConfig::default()
+    };
+
+    let mut program_file = Vec::new();
+    generator::generate(&config, &mut program_file).unwrap();
+
+    String::from_utf8(program_file).unwrap()
+}
+
+/// Loads a job file into a disk sized to fit it.
+pub fn load_disk(program_file: &str) -> (Disk, Vec<u32>) {
+    let mut disk = Disk::with_capacity(program_file.lines().count());
+    let program_ids = loader::load_programs_from(program_file.as_bytes(), &mut disk).unwrap();
+
+    (disk, program_ids)
+}
@@ -0,0 +1,78 @@
+mod common;
+
+use std::sync::Arc;
+use std::thread;
+
+use operating_system_simulator::io::Disk;
+use operating_system_simulator::kernel::{CPU, LockstepCPU, LongTermScheduler, Memory, ProcessControlBlock, lockstep_cpu};
+use operating_system_simulator::kernel::affinity::{self, HostTopology};
+
+use common::Bencher;
+
+/// Passes over the shipped programs each thread makes per call, so thread start up stays small.
+const PASSES_PER_THREAD: usize = 50;
+
+fn admit_all(disk: &Disk, program_ids: Vec<u32>) -> (Memory, Vec<Arc<ProcessControlBlock>>) {
+    let memory = Memory::new();
+    let mut lts = LongTermScheduler::new();
+    lts.enqueue_programs(disk, &memory, program_ids);
+    let pcbs = lts.batch_step(disk, &memory);
+
+    (memory, pcbs)
+}
+
+/// Runs a thread per simulated CPU, each executing its own copy of the shipped programs, and
+/// returns the instructions executed. Thread i is pinned to `host_cores[i]` if listed.
+fn execute_on_threads(processes: &[(Memory, Vec<Arc<ProcessControlBlock>>)], host_cores: &[usize]) -> u64 {
+    thread::scope(|scope| {
+        let workers: Vec<_> = processes.iter().enumerate()
+            .map(|(cpu_idx, (memory, pcbs))| scope.spawn(move || {
+                affinity::pin_cpu_thread(cpu_idx, host_cores);
+
+                let mut cpu = CPU::new();
+                let mut instructions = 0;
+                for _ in 0..PASSES_PER_THREAD {
+                    for pcb in pcbs {
+                        cpu.execute(pcb, memory).unwrap();
+                        instructions += cpu.get_stats().cycles;
+                    }
+                }
+                instructions
+            }))
+            .collect();
+
+        workers.into_iter().map(|worker| worker.join().unwrap()).sum()
+    })
+}
+
+fn main() {
+    let mut bencher = Bencher::from_args("cpu");
+    let (disk, program_ids) = common::load_disk(&common::shipped_program_file());
+
+    let (memory, pcbs) = admit_all(&disk, program_ids.clone());
+
+    let mut cpu = CPU::new();
+    bencher.bench("cpu/execute/scalar", || {
+        for pcb in &pcbs {
+            cpu.execute(pcb, &memory).unwrap();
+        }
+    });
+
+    let batches = lockstep_cpu::group_by_instructions(&pcbs, &memory);
+    let mut lockstep_cpu = LockstepCPU::new();
+    bencher.bench("cpu/execute/lockstep", || {
+        for batch in &batches {
+            lockstep_cpu.execute(batch, &memory);
+        }
+    });
+
+    // A thread per host core this process may use, laid out the way `--pin auto` lays out CPUs.
+    let host_cores = HostTopology::detect().layout();
+    let processes: Vec<_> = host_cores.iter().map(|_| admit_all(&disk, program_ids.clone())).collect();
+    println!("{} threads, {} instructions per call", host_cores.len(), execute_on_threads(&processes, &[]));
+
+    bencher.bench("cpu/execute/threads_unpinned", || execute_on_threads(&processes, &[]));
+    bencher.bench("cpu/execute/threads_pinned", || execute_on_threads(&processes, &host_cores));
+
+    bencher.finish();
+}
@@ -0,0 +1,38 @@
+mod common;
+
+use operating_system_simulator::io::Disk;
+
+use common::Bencher;
+
+const GENERATED_JOB_COUNT: usize = 10_000;
+
+fn main() {
+    let mut bencher = Bencher::from_args("disk");
+
+    let workloads = [
+        ("shipped", common::load_disk(&common::shipped_program_file())),
+        ("generated_10k", common::load_disk(&common::generated_program_file(GENERATED_JOB_COUNT))),
+    ];
+
+    for (workload, (source, program_ids)) in &workloads {
+        let programs: Vec<_> = program_ids.iter()
+            .map(|&id| (source.get_info_for(id), source.read_data_for(source.get_info_for(id))))
+            .collect();
+
+        bencher.bench_with_setup(&format!("disk/write_program/{}", workload),
+                                 || Disk::with_capacity(source.get_capacity()),
+                                 |mut disk| {
+                                     for (info, data) in &programs {
+                                         disk.write_program(info.id, info.priority, info.instruction_buffer_size, info.in_buffer_size,
+                                                            info.out_buffer_size, info.temp_buffer_size, data);
+                                     }
+                                     disk
+                                 });
+
+        bencher.bench(&format!("disk/read_data_for/{}", workload), || {
+            program_ids.iter().map(|&id| source.read_data_for(source.get_info_for(id)).len()).sum::<usize>()
+        });
+    }
+
+    bencher.finish();
+}
@@ -0,0 +1,43 @@
+mod common;
+
+use operating_system_simulator::io::{Disk, loader};
+
+use common::Bencher;
+
+const GENERATED_JOB_COUNT: usize = 10_000;
+const LARGE_JOB_COUNT: usize = 100_000;
+
+fn main() {
+    let mut bencher = Bencher::from_args("loader");
+
+    let workloads = [
+        ("shipped", common::shipped_program_file()),
+        ("generated_10k", common::generated_program_file(GENERATED_JOB_COUNT)),
+    ];
+
+    for (workload, program_file) in &workloads {
+        let capacity = program_file.lines().count();
+
+        bencher.bench_with_setup(&format!("loader/load_programs_from/{}", workload),
+                                 || Disk::with_capacity(capacity),
+                                 |mut disk| loader::load_programs_from(program_file.as_bytes(), &mut disk).unwrap());
+    }
+
+    let program_file = common::generated_program_file(LARGE_JOB_COUNT);
+    let capacity = program_file.lines().count();
+    let max_thread_count = std::thread::available_parallelism().map_or(1, |count| count.get());
+
+    let mut thread_count = 1;
+    loop {
+        bencher.bench_with_setup(&format!("loader/load_programs_from_str/generated_100k/threads_{}", thread_count),
+                                 || Disk::with_capacity(capacity),
+                                 |mut disk| loader::load_programs_from_str(&program_file, &mut disk, thread_count).unwrap());
+
+        if thread_count >= max_thread_count {
+            break;
+        }
+        thread_count = (thread_count * 2).min(max_thread_count);
+    }
+
+    bencher.finish();
+}
@@ -0,0 +1,95 @@
+mod common;
+
+use std::thread;
+
+use operating_system_simulator::kernel::{Memory, MemoryConfig};
+
+use common::Bencher;
+
+const CONTENDED_MEMORY_SIZE: usize = 8192;
+const CONTENDING_CPUS: usize = 8;
+const ACCESSES_PER_CPU: usize = 10_000;
+
+/// Runs one thread per CPU, each writing then reading words of its local bank. CPUs share banks
+/// when there are fewer banks than CPUs.
+fn contend(memory: &Memory) {
+    thread::scope(|scope| {
+        for cpu in 0..CONTENDING_CPUS {
+            scope.spawn(move || {
+                let bank_start = (cpu % memory.get_bank_count()) * memory.get_bank_size();
+
+                for access in 0..ACCESSES_PER_CPU {
+                    let address = bank_start + (cpu + access * CONTENDING_CPUS) % memory.get_bank_size();
+                    memory.write_to(address, access as u32);
+                    memory.read_from(address);
+                }
+            });
+        }
+    });
+}
+
+fn main() {
+    let mut bencher = Bencher::from_args("memory");
+    let (disk, program_ids) = common::load_disk(&common::shipped_program_file());
+    let memory = Memory::new();
+
+    bencher.bench("memory/read_from", || memory.read_from(512));
+    bencher.bench("memory/write_to", || memory.write_to(512, 1));
+
+    for size in [16, 256, 1024] {
+        bencher.bench(&format!("memory/read_block_from/{}", size), || memory.read_block_from(0, size));
+        bencher.bench(&format!("memory/read_block/{}", size), || memory.read_block(0, size)[size - 1]);
+
+        let mut buffer = vec![0; size];
+        bencher.bench(&format!("memory/read_block_into/{}", size), || memory.read_block_into(0, &mut buffer));
+
+        let block = vec![1; size];
+        bencher.bench(&format!("memory/write_block_to/{}", size), || memory.write_block_to(0, &block));
+    }
+
+    bencher.bench_with_setup("memory/create_process/shipped",
+                             Memory::new,
+                             |memory| {
+                                 for &id in &program_ids {
+                                     let info = disk.get_info_for(id);
+                                     let data = disk.read_data_for(info);
+
+                                     if memory.get_remaining_memory() < data.len() {
+                                         break;
+                                     }
+                                     memory.create_process(info, data);
+                                 }
+                                 memory
+                             });
+
+    bencher.bench("memory/core_dump", || memory.core_dump());
+
+    // Every other shipped process finishes, leaving holes all the way up the used region.
+    bencher.bench_with_setup("memory/compact/shipped_half_freed",
+                             || {
+                                 let memory = Memory::new();
+                                 let mut admitted = Vec::new();
+                                 for &id in &program_ids {
+                                     let info = disk.get_info_for(id);
+                                     let data = disk.read_data_for(info);
+
+                                     if memory.get_remaining_memory() < data.len() {
+                                         break;
+                                     }
+                                     memory.create_process(info, data);
+                                     admitted.push(id);
+                                 }
+                                 for &id in admitted.iter().step_by(2) {
+                                     memory.free_process(id);
+                                 }
+                                 memory
+                             },
+                             |memory| memory.compact());
+
+    for bank_count in [1, 2, 4, 8] {
+        let memory = Memory::with_config(MemoryConfig { size: CONTENDED_MEMORY_SIZE, bank_count, demand_paging: false });
+        bencher.bench(&format!("memory/contention/{}_cpus/{}_banks", CONTENDING_CPUS, bank_count), || contend(&memory));
+    }
+
+    bencher.finish();
+}
@@ -0,0 +1,115 @@
+mod common;
+
+use std::collections::VecDeque;
+use std::sync::Arc;
+
+use operating_system_simulator::io::Disk;
+use operating_system_simulator::kernel::paging::{Access, PAGE_FAULT, PAGE_SIZE};
+use operating_system_simulator::kernel::{CPU, LongTermScheduler, Memory, MemoryConfig, PageReplacement, Pager, ProcessControlBlock};
+
+use common::Bencher;
+
+const GENERATED_JOB_COUNT: usize = 1_000;
+/// Memory sizes, in frames, the cost of one eviction is compared across.
+const EVICTION_FRAME_COUNTS: [usize; 3] = [64, 1024, 16384];
+
+struct PagingRun {
+    page_faults: u64,
+    evictions: u64,
+    write_backs: u64,
+}
+
+/// Runs every job on one CPU with demand paging, round robin between faults. Admission reserves
+/// only a few frames per job, so the resident jobs together touch more pages than memory holds.
+fn run_paged(disk: &mut Disk, program_ids: Vec<u32>, replacement: PageReplacement) -> PagingRun {
+    let memory = Memory::with_demand_paging();
+    let mut lts = LongTermScheduler::new();
+    let mut cpu = CPU::new();
+    let mut pager = Pager::new(replacement.create_policy());
+    let mut ready = VecDeque::new();
+    let mut page_faults = 0;
+
+    lts.enqueue_programs(disk, &memory, program_ids);
+
+    loop {
+        ready.extend(lts.batch_step(disk, &memory));
+        let Some(pcb) = ready.pop_front() else { break };
+
+        match cpu.execute(&pcb, &memory) {
+            Err(PAGE_FAULT) => {
+                page_faults += 1;
+                pager.handle_page_fault(disk, &memory, &pcb).unwrap();
+                ready.push_back(pcb);
+            }
+            result => {
+                result.unwrap();
+                memory.free_process(pcb.id);
+            }
+        }
+    }
+
+    PagingRun { page_faults, evictions: pager.get_evictions(), write_backs: pager.get_write_backs() }
+}
+
+/// Fills `frame_count` frames with one page processes and leaves one more process out, then
+/// returns a routine that faults in the process left out. Its page takes the frame of the page
+/// evicted, whose process is the next one faulted in.
+fn evict_in_rotation(frame_count: usize, replacement: PageReplacement) -> impl FnMut() -> usize {
+    let mut disk = Disk::with_capacity((frame_count + 1) * PAGE_SIZE);
+    let memory = Memory::with_config(MemoryConfig { size: frame_count * PAGE_SIZE, demand_paging: true, ..MemoryConfig::default() });
+    let mut pager = Pager::new(replacement.create_policy());
+
+    let pcbs: Vec<Arc<ProcessControlBlock>> = (1..=frame_count as u32 + 1).map(|id| {
+        disk.write_program(id, 1, PAGE_SIZE, 0, 0, 0, &[id; PAGE_SIZE]);
+        memory.create_process(disk.get_info_for(id), disk.read_data_for(disk.get_info_for(id)))
+    }).collect();
+    let mut frame_owners: Vec<usize> = (0..frame_count).collect();
+    for (idx, pcb) in pcbs.iter().enumerate().take(frame_count) {
+        frame_owners[pcb.page_table.as_ref().unwrap().get_frame_for(0).unwrap()] = idx;
+    }
+    let mut next = frame_count;
+
+    move || {
+        let page_table = pcbs[next].page_table.as_ref().unwrap();
+        page_table.translate(0, Access::Read).unwrap_err();
+        pager.handle_page_fault(&mut disk, &memory, &pcbs[next]).unwrap();
+
+        let frame = page_table.get_frame_for(0).unwrap();
+        next = std::mem::replace(&mut frame_owners[frame], next);
+        frame
+    }
+}
+
+fn main() {
+    let mut bencher = Bencher::from_args("paging");
+    let program_file = common::generated_program_file(GENERATED_JOB_COUNT);
+
+    let policies = [
+        ("fifo", PageReplacement::Fifo),
+        ("lru", PageReplacement::Lru),
+        ("clock", PageReplacement::Clock),
+    ];
+
+    for (policy_name, replacement) in policies {
+        let (mut disk, program_ids) = common::load_disk(&program_file);
+        let job_count = program_ids.len();
+        let run = run_paged(&mut disk, program_ids, replacement);
+        println!("paging/fault_rate/{}: {:.2} faults per job, {} evictions, {} written back",
+                 policy_name, run.page_faults as f64 / job_count as f64, run.evictions, run.write_backs);
+
+        bencher.bench_with_setup(&format!("paging/run_generated_1k/{}", policy_name),
+                                 || common::load_disk(&program_file),
+                                 |(mut disk, program_ids)| run_paged(&mut disk, program_ids, replacement).page_faults);
+    }
+
+    // FIFO follows the memory's load order and Clock its hand, so neither should slow down as
+    // memory grows. LRU ages every resident page on each eviction, so it grows with the frames.
+    for (policy_name, replacement) in policies {
+        for frame_count in EVICTION_FRAME_COUNTS {
+            let mut evict = evict_in_rotation(frame_count, replacement);
+            bencher.bench(&format!("paging/evict/{}/{}_frames", policy_name, frame_count), || evict());
+        }
+    }
+
+    bencher.finish();
+}
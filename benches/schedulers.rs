@@ -0,0 +1,225 @@
+mod common;
+
+use std::cmp::Reverse;
+use std::collections::BinaryHeap;
+use std::sync::{Arc, mpsc};
+
+use operating_system_simulator::io::ProgramInfo;
+use operating_system_simulator::kernel::long_term_scheduler::DEFAULT_STARVATION_WINDOW;
+use operating_system_simulator::kernel::{AdmissionPolicy, Clock, FifoQueue, IdleStrategy, LongTermScheduler, Memory, MemoryConfig, PriorityQueue, ProcessControlBlock, SchedulerQueue, ShortTermScheduler, TimingWheel};
+
+use common::Bencher;
+
+const GENERATED_JOB_COUNT: usize = 10_000;
+const QUEUE_LENGTH: u32 = 10_000;
+const EVENT_COUNT: u64 = 1_000_000;
+/// Events in flight during the hold model, about one per simulated CPU.
+const PENDING_EVENTS: u64 = 1024;
+/// Words of memory for admission bursts, enough to admit the generated workload whole.
+const BURST_MEMORY_SIZE: usize = 1 << 22;
+const BURST_CPU_COUNT: usize = 4;
+const HALT: u32 = 0x92000000;
+
+/// Pseudo random gaps between events, mostly shorter than a quantum with the odd long one.
+fn event_gaps() -> impl Iterator<Item = u64> {
+    let mut state = 0x9E37_79B9_7F4A_7C15u64;
+    std::iter::repeat_with(move || {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        if state % 16 == 0 { state % 10_000 } else { state % 64 }
+    })
+}
+
+/// The hold model: pops the earliest event and schedules its successor a gap later, the way each
+/// CPU burst in the discrete event engine queues the next.
+fn hold_timing_wheel() -> u64 {
+    let mut wheel = TimingWheel::new();
+    let mut gaps = event_gaps();
+    for cpu in 0..PENDING_EVENTS {
+        wheel.schedule(gaps.next().unwrap(), cpu);
+    }
+
+    for _ in 0..EVENT_COUNT {
+        let (at, cpu) = wheel.pop().unwrap();
+        wheel.schedule(at + gaps.next().unwrap(), cpu);
+    }
+
+    wheel.now()
+}
+
+fn hold_binary_heap() -> u64 {
+    let mut heap = BinaryHeap::new();
+    let mut gaps = event_gaps();
+    for cpu in 0..PENDING_EVENTS {
+        heap.push(Reverse((gaps.next().unwrap(), cpu, cpu)));
+    }
+
+    let mut now = 0;
+    for seq in PENDING_EVENTS..PENDING_EVENTS + EVENT_COUNT {
+        let Reverse((at, _, cpu)) = heap.pop().unwrap();
+        heap.push(Reverse((at + gaps.next().unwrap(), seq, cpu)));
+        now = at;
+    }
+
+    now
+}
+
+fn push_then_pop_all(mut queue: Box<dyn SchedulerQueue>, pcbs: &[Arc<ProcessControlBlock>]) -> usize {
+    for pcb in pcbs {
+        queue.push(pcb.clone());
+    }
+
+    let mut popped = 0;
+    while queue.pop().is_some() {
+        popped += 1;
+    }
+
+    popped
+}
+
+fn main() {
+    let mut bencher = Bencher::from_args("schedulers");
+
+    let workloads = [
+        ("shipped", common::load_disk(&common::shipped_program_file())),
+        ("generated_10k", common::load_disk(&common::generated_program_file(GENERATED_JOB_COUNT))),
+    ];
+
+    let policies = [
+        ("fifo", AdmissionPolicy::Fifo),
+        ("first_fit", AdmissionPolicy::FirstFit),
+        ("best_fit", AdmissionPolicy::BestFit),
+        ("smallest_first", AdmissionPolicy::SmallestFirst),
+    ];
+
+    for (workload, (disk, program_ids)) in &workloads {
+        for (policy_name, policy) in policies {
+            let new_lts = || {
+                let memory = Memory::new();
+                let mut lts = LongTermScheduler::with_policy(policy, DEFAULT_STARVATION_WINDOW);
+                lts.enqueue_programs(&disk, &memory, program_ids.clone());
+                (lts, memory)
+            };
+
+            let (mut lts, memory) = new_lts();
+            let admitted = lts.batch_step(&disk, &memory).len();
+            println!("lts/occupancy/{}/{}: {} jobs, {}/{} words",
+                     workload, policy_name, admitted, memory.get_used_memory(), memory.get_memory_size());
+
+            bencher.bench_with_setup(&format!("lts/batch_step/{}/{}", workload, policy_name),
+                                     new_lts,
+                                     |(mut lts, memory)| lts.batch_step(&disk, &memory));
+        }
+
+        // Admits the whole workload, emptying memory between rounds, one program at a time
+        // and then in bulk.
+        bencher.bench_with_setup(&format!("lts/admit_all/{}/per_process", workload),
+                                 || {
+                                     let memory = Memory::new();
+                                     let mut lts = LongTermScheduler::new();
+                                     lts.enqueue_programs(&disk, &memory, program_ids.clone());
+                                     (lts, memory)
+                                 },
+                                 |(mut lts, memory)| {
+                                     while lts.get_pending_count() > 0 {
+                                         while lts.step(&disk, &memory).is_ok() {}
+                                         memory.core_dump();
+                                     }
+                                 });
+
+        bencher.bench_with_setup(&format!("lts/admit_all/{}/bulk", workload),
+                                 || {
+                                     let memory = Memory::new();
+                                     let mut lts = LongTermScheduler::new();
+                                     lts.enqueue_programs(&disk, &memory, program_ids.clone());
+                                     (lts, memory)
+                                 },
+                                 |(mut lts, memory)| {
+                                     while lts.get_pending_count() > 0 {
+                                         lts.batch_step(&disk, &memory);
+                                         memory.core_dump();
+                                     }
+                                 });
+    }
+
+    // An admission burst: the whole generated workload admitted into memory that holds it, then
+    // marked ready a process at a time after looking each up by id, or as one batch.
+    let (disk, program_ids) = &workloads[1].1;
+    let burst_memory = MemoryConfig { size: BURST_MEMORY_SIZE, ..MemoryConfig::default() };
+    let admit_burst = || {
+        let memory = Memory::with_config(burst_memory);
+        let mut lts = LongTermScheduler::new();
+        lts.enqueue_programs(disk, &memory, program_ids.clone());
+        let pcbs = lts.batch_step(disk, &memory);
+        (memory, pcbs)
+    };
+    println!("sts/admission_burst: {} jobs", admit_burst().1.len());
+
+    bencher.bench_with_setup("sts/admission_burst_10k/schedule_each", admit_burst, |(memory, pcbs)| {
+        let mut sts = ShortTermScheduler::without_dispatcher(Box::new(FifoQueue::new()));
+        for pcb in &pcbs {
+            sts.schedule_process(memory.get_pcb_for(pcb.id));
+        }
+        sts
+    });
+    bencher.bench_with_setup("sts/admission_burst_10k/schedule_batch", admit_burst, |(_memory, pcbs)| {
+        let mut sts = ShortTermScheduler::without_dispatcher(Box::new(FifoQueue::new()));
+        sts.schedule_processes(pcbs);
+        sts
+    });
+
+    // The same burst of processes that halt at once, handed to parked dispatchers, so the
+    // wake ups dominate.
+    let memory = Arc::new(Memory::with_config(burst_memory));
+    let halt_info: Vec<_> = (0..GENERATED_JOB_COUNT as u32).map(|id| ProgramInfo {
+        id,
+        priority: 1,
+        instruction_buffer_size: 1,
+        in_buffer_size: 0,
+        out_buffer_size: 0,
+        temp_buffer_size: 0,
+        data_start_idx: 0,
+    }).collect();
+    let halting_pcbs = memory.create_processes(&halt_info.iter().map(|info| (info, &[HALT][..])).collect::<Vec<_>>());
+    let (termination_sender, termination_receiver) = mpsc::channel();
+    let mut sts = ShortTermScheduler::new(Box::new(FifoQueue::new()), BURST_CPU_COUNT, &[], IdleStrategy::Park,
+                                          memory.clone(), Arc::new(Clock::new()), termination_sender);
+
+    bencher.bench("sts/wake_parked_cpus_10k/schedule_each", || {
+        for pcb in &halting_pcbs {
+            sts.schedule_process(pcb.clone());
+        }
+        sts.drain();
+        termination_receiver.try_iter().count()
+    });
+    bencher.bench("sts/wake_parked_cpus_10k/schedule_batch", || {
+        sts.schedule_processes(halting_pcbs.iter().cloned());
+        sts.drain();
+        termination_receiver.try_iter().count()
+    });
+    sts.join();
+
+    let pcbs: Vec<_> = (0..QUEUE_LENGTH)
+        .map(|id| {
+            let program_info = ProgramInfo {
+                id,
+                priority: id.wrapping_mul(2654435761) % 32,
+                instruction_buffer_size: 1,
+                in_buffer_size: 0,
+                out_buffer_size: 0,
+                temp_buffer_size: 0,
+                data_start_idx: 0,
+            };
+            Arc::new(ProcessControlBlock::new(&program_info, 0, 1))
+        })
+        .collect();
+
+    bencher.bench("sts/fifo_queue/push_then_pop_10k", || push_then_pop_all(Box::new(FifoQueue::new()), &pcbs));
+    bencher.bench("sts/priority_queue/push_then_pop_10k", || push_then_pop_all(Box::new(PriorityQueue::new()), &pcbs));
+
+    bencher.bench("events/timing_wheel/hold_1m", hold_timing_wheel);
+    bencher.bench("events/binary_heap/hold_1m", hold_binary_heap);
+
+    bencher.finish();
+}
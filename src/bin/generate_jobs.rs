@@ -0,0 +1,88 @@
+use std::fs::File;
+use std::io::{BufReader, BufWriter, Write};
+use std::process;
+
+use operating_system_simulator::io::{Disk, generator::{self, IsaMix, WorkloadConfig}, loader};
+
+const USAGE: &str = "Usage: generate_jobs [options]
+    --jobs N                 number of jobs (default 30)
+    --seed N                 random seed (default 0)
+    --length MIN MAX         instructions per job
+    --priority MIN MAX       job priority
+    --buffers IN OUT TEMP    data buffer sizes in words
+    --mix A I M IO           weights of arithmetic, immediate, memory and I/O instructions
+    --templates PATH         reuse the programs in a job file instead of synthesizing them
+    --output PATH            write to a file instead of stdout";
+
+fn parse<T: std::str::FromStr>(args: &mut impl Iterator<Item = String>) -> T {
+    args.next().and_then(|arg| arg.parse().ok()).unwrap_or_else(|| {
+        eprintln!("{}", USAGE);
+        process::exit(2);
+    })
+}
+
+fn load_templates(path: &str) -> std::io::Result<Vec<generator::ProgramTemplate>> {
+    let file = File::open(path)?;
+    let mut disk = Disk::with_capacity(file.metadata()?.len() as usize);
+    let program_ids = loader::load_programs_from(BufReader::new(file), &mut disk)?;
+
+    Ok(generator::templates_from(&disk, &program_ids))
+}
+
+fn main() {
+    let mut config = WorkloadConfig::default();
+    let mut output_path = None;
+
+    let mut args = std::env::args().skip(1);
+    while let Some(arg) = args.next() {
+        match arg.as_str() {
+            "--jobs" => config.job_count = parse(&mut args),
+            "--seed" => config.seed = parse(&mut args),
+            "--length" => config.instruction_count = (parse(&mut args), parse(&mut args)),
+            "--priority" => config.priority = (parse(&mut args), parse(&mut args)),
+            "--buffers" => {
+                config.in_buffer_size = parse(&mut args);
+                config.out_buffer_size = parse(&mut args);
+                config.temp_buffer_size = parse(&mut args);
+            }
+            "--mix" => {
+                config.isa_mix = IsaMix {
+                    arithmetic: parse(&mut args),
+                    immediate: parse(&mut args),
+                    memory: parse(&mut args),
+                    io: parse(&mut args),
+                };
+            }
+            "--templates" => {
+                let path: String = parse(&mut args);
+                config.templates = load_templates(&path).unwrap_or_else(|err| {
+                    eprintln!("Failed to load templates from {}: {}", path, err);
+                    process::exit(1);
+                });
+            }
+            "--output" => output_path = Some(parse::<String>(&mut args)),
+            _ => {
+                eprintln!("{}", USAGE);
+                process::exit(2);
+            }
+        }
+    }
+
+    if let Err(err) = config.validate() {
+        eprintln!("{}\n{}", err, USAGE);
+        process::exit(2);
+    }
+
+    let writer: Box<dyn Write> = match output_path {
+        Some(path) => Box::new(File::create(&path).unwrap_or_else(|err| {
+            eprintln!("Failed to create {}: {}", path, err);
+            process::exit(1);
+        })),
+        None => Box::new(std::io::stdout().lock()),
+    };
+
+    if let Err(err) = generator::generate(&config, BufWriter::with_capacity(1 << 20, writer)) {
+        eprintln!("Failed to write jobs: {}", err);
+        process::exit(1);
+    }
+}
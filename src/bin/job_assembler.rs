@@ -0,0 +1,67 @@
+use std::fs::{self, File};
+use std::io::{BufWriter, Write};
+use std::process;
+
+use operating_system_simulator::io::{Disk, assembly, loader};
+
+const USAGE: &str = "Usage: job_assembler disassemble|assemble INPUT [options]
+    disassemble INPUT        list the jobs of a job file as assembly
+    assemble INPUT           turn an assembly listing into a job file
+    --output PATH            write to a file instead of stdout
+    --image PATH             when assembling, also write the jobs' words as little endian binary";
+
+fn usage() -> ! {
+    eprintln!("{}", USAGE);
+    process::exit(2);
+}
+
+fn fail(message: String) -> ! {
+    eprintln!("{}", message);
+    process::exit(1);
+}
+
+fn create(path: &str) -> BufWriter<File> {
+    BufWriter::new(File::create(path).unwrap_or_else(|err| fail(format!("Failed to create {}: {}", path, err))))
+}
+
+fn main() {
+    let mut args = std::env::args().skip(1);
+    let (Some(command), Some(input_path)) = (args.next(), args.next()) else { usage() };
+    let mut output_path = None;
+    let mut image_path = None;
+
+    while let Some(arg) = args.next() {
+        match arg.as_str() {
+            "--output" => output_path = Some(args.next().unwrap_or_else(|| usage())),
+            "--image" => image_path = Some(args.next().unwrap_or_else(|| usage())),
+            _ => usage(),
+        }
+    }
+
+    let input = fs::read_to_string(&input_path).unwrap_or_else(|err| fail(format!("Failed to read {}: {}", input_path, err)));
+    let mut writer: Box<dyn Write> = match &output_path {
+        Some(path) => Box::new(create(path)),
+        None => Box::new(BufWriter::new(std::io::stdout().lock())),
+    };
+
+    let result = match command.as_str() {
+        "disassemble" => {
+            let mut disk = Disk::with_capacity(input.lines().count());
+            let program_ids = loader::load_programs_from_str(&input, &mut disk, loader::default_thread_count())
+                .unwrap_or_else(|err| fail(format!("Failed to load {}: {}", input_path, err)));
+
+            assembly::disassemble_disk(&mut writer, &disk, &program_ids).and_then(|()| writer.flush())
+        }
+        "assemble" => {
+            let jobs = assembly::assemble(&input).unwrap_or_else(|err| fail(format!("{}: {}", input_path, err)));
+
+            assembly::write_job_file(&jobs, &mut writer)
+                .and_then(|()| image_path.as_deref().map_or(Ok(()), |path| assembly::write_image(&jobs, create(path))))
+        }
+        _ => usage(),
+    };
+
+    if let Err(err) = result {
+        fail(format!("Failed to write output: {}", err));
+    }
+}
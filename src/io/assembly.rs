@@ -0,0 +1,436 @@
+use std::io::{self, Error, ErrorKind, Write};
+
+use super::{Disk, ProgramInfo};
+use super::generator;
+
+use crate::kernel::cpu::{Format, Instruction, Opcode, WORD_SIZE};
+use crate::kernel::paging::PAGE_SIZE;
+use crate::kernel::{Memory, ProcessControlBlock};
+
+/// Width listings pad instructions to, so their address comments line up.
+const LISTING_WIDTH: usize = 22;
+/// Largest job in words: all an instruction's 16 bit byte address field can reach.
+const MAX_JOB_SIZE: usize = 0x10000 / WORD_SIZE;
+
+/// A job the assembler built, ready to be written as a job file or straight onto disk.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct Job {
+    pub id: u32,
+    pub priority: u32,
+    pub instructions: Vec<u32>,
+    pub in_buffer_size: usize,
+    pub out_buffer_size: usize,
+    pub temp_buffer_size: usize,
+    /// Words of the in, out and temp buffers, in that order.
+    pub data: Vec<u32>,
+}
+
+impl Job {
+    /// The words the job takes on disk and in memory: its instructions, then its buffers.
+    pub fn get_image(&self) -> Vec<u32> {
+        [self.instructions.as_slice(), self.data.as_slice()].concat()
+    }
+
+    pub fn write_to(&self, disk: &mut Disk) {
+        disk.write_program(self.id, self.priority, self.instructions.len(), self.in_buffer_size,
+                           self.out_buffer_size, self.temp_buffer_size, &self.get_image());
+    }
+}
+
+/// Disassembles a word as an instruction, or as a `.word` directive if it is not one the
+/// assembler would produce, so the listing assembles back to the same word either way.
+pub fn disassemble_word(word: u32) -> String {
+    match Instruction::decode(word) {
+        Ok(instruction) if instruction.encode() == word => instruction.to_string(),
+        _ => format!(".word {:#010X}", word),
+    }
+}
+
+/// Assembles one instruction in the notation `Instruction` displays, or a `.word` directive.
+pub fn assemble_instruction(line: &str) -> Result<u32, &'static str> {
+    let mut tokens = line.split_whitespace();
+    let mnemonic = tokens.next().ok_or("Empty instruction")?;
+    let operands: Vec<&str> = tokens.collect();
+
+    if mnemonic == ".word" {
+        return match operands.as_slice() {
+            [word] => parse_number(word, u32::MAX as usize).map(|word| word as u32),
+            _ => Err(".word takes one word"),
+        };
+    }
+
+    let opcode = Opcode::from_mnemonic(mnemonic).ok_or("Unknown mnemonic")?;
+    let mut instruction = Instruction { opcode, reg_1: 0, reg_2: 0, reg_3: 0, address: 0 };
+    let arrow = if opcode == Opcode::Wr { "->" } else { "<-" };
+
+    match (opcode.format(), operands.as_slice()) {
+        (Format::Arithmetic, [s1, s2, d]) => {
+            instruction.reg_1 = parse_register(s1)?;
+            instruction.reg_2 = parse_register(s2)?;
+            instruction.reg_3 = parse_register(d)?;
+        }
+        (Format::Jump, []) => {}
+        (Format::Jump, ["->", address]) => instruction.address = parse_number(address, 0xFF_FFFF)?,
+        (Format::Immediate, [b, d, "->", address]) if opcode.is_branch() => {
+            instruction.reg_1 = parse_register(b)?;
+            instruction.reg_2 = parse_register(d)?;
+            instruction.address = parse_number(address, 0xFFFF)?;
+        }
+        (Format::Immediate, [d, value]) if !opcode.is_branch() => {
+            instruction.reg_2 = parse_register(d)?;
+            instruction.address = parse_number(value, 0xFFFF)?;
+        }
+        (Format::Immediate, [b, d, value]) if !opcode.is_branch() => {
+            instruction.reg_1 = parse_register(b)?;
+            instruction.reg_2 = parse_register(d)?;
+            instruction.address = parse_number(value, 0xFFFF)?;
+        }
+        (Format::Io, [r1, direction, source]) if *direction == arrow => {
+            instruction.reg_1 = parse_register(r1)?;
+            match parse_register(source) {
+                Ok(r2) => instruction.reg_2 = r2,
+                Err(_) => instruction.address = parse_io_address(source)?,
+            }
+        }
+        (Format::Io, [r1, r2, direction, address]) if *direction == arrow => {
+            instruction.reg_1 = parse_register(r1)?;
+            instruction.reg_2 = parse_register(r2)?;
+            instruction.address = parse_io_address(address)?;
+        }
+        _ => return Err("Wrong operands for the instruction"),
+    }
+
+    Ok(instruction.encode())
+}
+
+fn parse_register(token: &str) -> Result<usize, &'static str> {
+    token.strip_prefix(['r', 'R'])
+        .and_then(|register| register.parse().ok())
+        .filter(|&register: &usize| register < 16)
+        .ok_or("Expected a register from r0 to r15")
+}
+
+/// Parses a decimal number, or a hex one with a 0x prefix, of at most `max`.
+fn parse_number(token: &str, max: usize) -> Result<usize, &'static str> {
+    let number = match token.strip_prefix("0x").or_else(|| token.strip_prefix("0X")) {
+        Some(hex) => usize::from_str_radix(hex, 16),
+        None => token.parse(),
+    };
+
+    number.ok().filter(|&number| number <= max).ok_or("Expected a number that fits the field")
+}
+
+/// An address of zero makes RD and WR use the address in r2 instead, so it cannot be written.
+fn parse_io_address(token: &str) -> Result<usize, &'static str> {
+    match parse_number(token, 0xFFFF)? {
+        0 => Err("RD and WR cannot address 0, name the register holding the address instead"),
+        address => Ok(address),
+    }
+}
+
+/// Assembles a listing into jobs. A job reads:
+///
+/// ```text
+/// .job 1 2                ; id and priority
+///     MOVI r5 3
+///     RD r6 <- 0x14
+///     HLT
+/// .data 2 1 0             ; in, out and temp buffer sizes in words
+///     .word 0x0000000A
+/// .end
+/// ```
+///
+/// Instructions use the notation `Instruction` displays. Anything after a `;` is a comment, and
+/// buffer words left out at the end of `.data` are zero.
+pub fn assemble(source: &str) -> io::Result<Vec<Job>> {
+    let mut jobs = Vec::new();
+    let mut job: Option<Job> = None;
+    let mut in_data = false;
+
+    for (idx, line) in source.lines().enumerate() {
+        let code = line.split(';').next().unwrap_or("").trim();
+        if code.is_empty() {
+            continue;
+        }
+
+        let error = |message: &str| Error::new(ErrorKind::InvalidData, format!("Line {}: {}: {}", idx + 1, message, line.trim()));
+        let fields: Vec<&str> = code.split_whitespace().collect();
+        let numbers = |max: usize| fields[1..].iter().map(|field| parse_number(field, max)).collect::<Result<Vec<_>, _>>().map_err(error);
+
+        match (fields[0], job.as_mut()) {
+            (".job", None) => {
+                let [id, priority] = numbers(u32::MAX as usize)?[..] else { return Err(error(".job takes an id and a priority")) };
+                job = Some(Job {
+                    id: id as u32,
+                    priority: priority as u32,
+                    instructions: Vec::new(),
+                    in_buffer_size: 0,
+                    out_buffer_size: 0,
+                    temp_buffer_size: 0,
+                    data: Vec::new(),
+                });
+                in_data = false;
+            }
+            (".job", Some(_)) => return Err(error("Job started before the last one ended")),
+            (_, None) => return Err(error("Outside of a job")),
+            (".data", Some(job)) if !in_data => {
+                let [in_size, out_size, temp_size] = numbers(u32::MAX as usize)?[..] else { return Err(error(".data takes three buffer sizes")) };
+                let data_size = in_size.checked_add(out_size).and_then(|size| size.checked_add(temp_size));
+                if data_size.map_or(true, |data_size| job.instructions.len() + data_size > MAX_JOB_SIZE) {
+                    return Err(error("Job is larger than an instruction can address"));
+                }
+
+                (job.in_buffer_size, job.out_buffer_size, job.temp_buffer_size) = (in_size, out_size, temp_size);
+                in_data = true;
+            }
+            (".data", Some(_)) => return Err(error("Job has two data sections")),
+            (".end", Some(_)) => {
+                let mut job = job.take().unwrap();
+                let data_size = job.in_buffer_size + job.out_buffer_size + job.temp_buffer_size;
+                if job.data.len() > data_size {
+                    return Err(error("More data words than the buffers hold"));
+                }
+                if job.instructions.len() + data_size > MAX_JOB_SIZE {
+                    return Err(error("Job is larger than an instruction can address"));
+                }
+
+                job.data.resize(data_size, 0);
+                jobs.push(job);
+            }
+            (_, Some(job)) if in_data => match assemble_instruction(code) {
+                Ok(word) if fields[0] == ".word" => job.data.push(word),
+                Ok(_) => return Err(error("Instruction in the data section")),
+                Err(message) => return Err(error(message)),
+            },
+            (_, Some(job)) => job.instructions.push(assemble_instruction(code).map_err(error)?),
+        }
+    }
+
+    match job {
+        Some(job) => Err(Error::new(ErrorKind::InvalidData, format!("Job {} has no .end", job.id))),
+        None => Ok(jobs),
+    }
+}
+
+/// Writes jobs in the `// JOB` / `// Data` / `// END` format the loader reads.
+pub fn write_job_file<W: Write>(jobs: &[Job], mut writer: W) -> io::Result<()> {
+    let mut text = Vec::new();
+
+    for job in jobs {
+        text.clear();
+        generator::push_job(&mut text, job.id, job.priority, &job.instructions,
+                            (job.in_buffer_size, job.out_buffer_size, job.temp_buffer_size), &job.data);
+        writer.write_all(&text)?;
+    }
+
+    writer.flush()
+}
+
+/// Writes the image of each job in turn as little endian words, as the loader lays them out on disk.
+pub fn write_image<W: Write>(jobs: &[Job], mut writer: W) -> io::Result<()> {
+    for job in jobs {
+        for word in job.get_image() {
+            writer.write_all(&word.to_le_bytes())?;
+        }
+    }
+
+    writer.flush()
+}
+
+fn write_line<W: Write>(writer: &mut W, text: &str, byte_address: usize) -> io::Result<()> {
+    writeln!(writer, "    {:<width$} ; {:#04X}", text, byte_address, width = LISTING_WIDTH)
+}
+
+/// Writes a listing of a job that `assemble` turns back into the same job. Each line carries
+/// the byte address branches and RD and WR name it by.
+pub fn disassemble_job<W: Write>(writer: &mut W, program_info: &ProgramInfo, data: &[u32]) -> io::Result<()> {
+    let (instructions, buffers) = data.split_at(program_info.instruction_buffer_size);
+
+    writeln!(writer, ".job {} {}", program_info.id, program_info.priority)?;
+    for (idx, &word) in instructions.iter().enumerate() {
+        write_line(writer, &disassemble_word(word), idx * WORD_SIZE)?;
+    }
+
+    writeln!(writer, ".data {} {} {}", program_info.in_buffer_size, program_info.out_buffer_size, program_info.temp_buffer_size)?;
+    let written = buffers.iter().rposition(|&word| word != 0).map_or(0, |last| last + 1);
+    for (idx, &word) in buffers[..written].iter().enumerate() {
+        write_line(writer, &format!(".word {:#010X}", word), (instructions.len() + idx) * WORD_SIZE)?;
+    }
+
+    writeln!(writer, ".end")
+}
+
+/// Writes a listing of programs on disk, in the order given.
+pub fn disassemble_disk<W: Write>(writer: &mut W, disk: &Disk, program_ids: &[u32]) -> io::Result<()> {
+    for (idx, &id) in program_ids.iter().enumerate() {
+        if idx > 0 {
+            writeln!(writer)?;
+        }
+
+        let program_info = disk.get_info_for(id);
+        disassemble_job(writer, program_info, disk.read_data_for(program_info))?;
+    }
+
+    Ok(())
+}
+
+/// Writes a listing of a process's words as they are in memory now. Pages that are not resident
+/// are noted rather than loaded, and nothing the pager tracks is touched.
+pub fn disassemble_process<W: Write>(writer: &mut W, memory: &Memory, pcb: &ProcessControlBlock) -> io::Result<()> {
+    let word_count = match &pcb.page_table {
+        Some(page_table) => (0..page_table.get_page_count()).map(|page| page_table.get_page_length(page)).sum(),
+        None => pcb.get_mem_end_address() - pcb.get_mem_start_address(),
+    };
+
+    writeln!(writer, "; process {}", pcb.id)?;
+    for idx in 0..word_count {
+        let address = match &pcb.page_table {
+            Some(page_table) => page_table.get_frame_for(idx / PAGE_SIZE).map(|frame| frame * PAGE_SIZE + idx % PAGE_SIZE),
+            None => Some(pcb.get_mem_start_address() + idx),
+        };
+
+        match address {
+            Some(address) if idx < pcb.instruction_buffer_size => write_line(writer, &disassemble_word(memory.read_from(address)), idx * WORD_SIZE)?,
+            Some(address) => write_line(writer, &format!(".word {:#010X}", memory.read_from(address)), idx * WORD_SIZE)?,
+            None if idx % PAGE_SIZE == 0 => writeln!(writer, "    ; page {} is not resident", idx / PAGE_SIZE)?,
+            None => {}
+        }
+    }
+
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use std::fs;
+
+    use super::*;
+
+    use crate::io::loader;
+
+    #[test]
+    fn test_disassemble_word() {
+        assert_eq!(disassemble_word(0x56810008), "BNE r8 r1 -> 0x08");
+        assert_eq!(disassemble_word(0x0000000A), ".word 0x0000000A");
+        // A valid opcode carrying another format's bits.
+        assert_eq!(disassemble_word(0x0B050000), ".word 0x0B050000");
+        assert_eq!(disassemble_word(0x3F000000), ".word 0x3F000000");
+    }
+
+    #[test]
+    fn test_assemble_instruction() {
+        assert_eq!(assemble_instruction("MOVI r5 3"), Ok(0x4B050003));
+        assert_eq!(assemble_instruction("slt r6 r5 r8"), Ok(0x10658000));
+        assert_eq!(assemble_instruction("BNE r8 r1 -> 0x08"), Ok(0x56810008));
+        assert_eq!(assemble_instruction("RD r11 <- r10"), Ok(0xC0BA0000));
+        assert_eq!(assemble_instruction("WR r0 -> 16"), Ok(0xC1000010));
+        assert_eq!(assemble_instruction("HLT"), Ok(0x92000000));
+        assert_eq!(assemble_instruction(".word 0x12345678"), Ok(0x12345678));
+
+        assert_eq!(assemble_instruction("BRA -> 0x08"), Err("Unknown mnemonic"));
+        assert_eq!(assemble_instruction("ADD r1 r2"), Err("Wrong operands for the instruction"));
+        assert_eq!(assemble_instruction("WR r0 <- 0x10"), Err("Wrong operands for the instruction"));
+        assert_eq!(assemble_instruction("ADD r1 r2 r16"), Err("Expected a register from r0 to r15"));
+        assert_eq!(assemble_instruction("ADDI r1 0x10000"), Err("Expected a number that fits the field"));
+        assert!(assemble_instruction("RD r1 <- 0").is_err());
+    }
+
+    #[test]
+    fn test_disassemble_then_assemble_every_kind_of_word() {
+        for word in (0..=u32::MAX).step_by(65_521).chain(Opcode::ALL.iter().map(|&opcode| Instruction { opcode, reg_1: 3, reg_2: 7, reg_3: 9, address: 0x5C }.encode())) {
+            assert_eq!(assemble_instruction(&disassemble_word(word)), Ok(word), "{:#010X} disassembled to {}", word, disassemble_word(word));
+        }
+    }
+
+    #[test]
+    fn test_assemble() {
+        let source = "
+            ; A job with one input word
+            .job 10 3
+                MOVI r5 3           ; the loop bound
+                RD r6 <- 0x0C
+                HLT
+            .data 1 2 0
+                .word 7
+            .end
+        ";
+
+        let jobs = assemble(source).unwrap();
+        assert_eq!(jobs, vec![Job {
+            id: 10,
+            priority: 3,
+            instructions: vec![0x4B050003, 0xC060000C, 0x92000000],
+            in_buffer_size: 1,
+            out_buffer_size: 2,
+            temp_buffer_size: 0,
+            data: vec![7, 0, 0],
+        }]);
+
+        let mut disk = Disk::new();
+        jobs[0].write_to(&mut disk);
+        assert_eq!(disk.read_data_for(disk.get_info_for(10)), &[0x4B050003, 0xC060000C, 0x92000000, 7, 0, 0]);
+
+        let mut image = Vec::new();
+        write_image(&jobs, &mut image).unwrap();
+        assert_eq!(image.len(), 6 * WORD_SIZE);
+        assert_eq!(image[..4], 0x4B050003u32.to_le_bytes());
+    }
+
+    #[test]
+    fn test_assemble_errors() {
+        let error = |source: &str| assemble(source).unwrap_err().to_string();
+
+        assert_eq!(error("HLT"), "Line 1: Outside of a job: HLT");
+        assert_eq!(error(".job 1 1\nHLT"), "Job 1 has no .end");
+        assert_eq!(error(".job 1 1\nJMP r1\n.end"), "Line 2: Wrong operands for the instruction: JMP r1");
+        assert_eq!(error(".job 1 1\n.data 0 1 0\nHLT\n.end"), "Line 3: Instruction in the data section: HLT");
+        assert_eq!(error(".job 1 1\n.data 0 1 0\n.word 1\n.word 2\n.end"), "Line 5: More data words than the buffers hold: .end");
+        assert_eq!(error(".job 1 1\nHLT\n.data 18446744073709551615 1 0\n.end"), "Line 3: Expected a number that fits the field: .data 18446744073709551615 1 0");
+        assert_eq!(error(".job 1 1\nHLT\n.data 0xFFFFFFFF 0xFFFFFFFF 2\n.end"), "Line 3: Job is larger than an instruction can address: .data 0xFFFFFFFF 0xFFFFFFFF 2");
+        assert_eq!(error(".job 1 1\nHLT\n.data 4000000000 0 0\n.end"), "Line 3: Job is larger than an instruction can address: .data 4000000000 0 0");
+        assert_eq!(error(&format!(".job 1 1\n{}.end", "HLT\n".repeat(MAX_JOB_SIZE + 1))), format!("Line {}: Job is larger than an instruction can address: .end", MAX_JOB_SIZE + 3));
+    }
+
+    #[test]
+    fn test_shipped_program_file_round_trips() {
+        let program_file = fs::read_to_string(loader::PROGRAM_FILE_PATH).unwrap();
+        let mut disk = Disk::with_capacity(program_file.lines().count());
+        let program_ids = loader::load_programs_from(program_file.as_bytes(), &mut disk).unwrap();
+
+        let mut listing = Vec::new();
+        disassemble_disk(&mut listing, &disk, &program_ids).unwrap();
+        let listing = String::from_utf8(listing).unwrap();
+        // Every instruction in the shipped file has a mnemonic, so .word only shows up in data.
+        let mut in_instructions = false;
+        for line in listing.lines() {
+            in_instructions = (in_instructions || line.starts_with(".job")) && !line.starts_with(".data");
+            assert!(!(in_instructions && line.contains(".word")), "{}", line);
+        }
+
+        let jobs = assemble(&listing).unwrap();
+        let mut reassembled = Vec::new();
+        write_job_file(&jobs, &mut reassembled).unwrap();
+
+        assert_eq!(String::from_utf8(reassembled).unwrap().trim_end(), program_file.trim_end());
+    }
+
+    #[test]
+    fn test_disassemble_process() {
+        let memory = Memory::with_demand_paging();
+        let mut program_data = vec![0x4B050003, 0x92000000];
+        program_data.resize(PAGE_SIZE + 1, 0);
+        program_data[PAGE_SIZE] = 5;
+
+        let mut disk = Disk::new();
+        disk.write_program(1, 1, 2, PAGE_SIZE - 1, 0, 0, &program_data);
+        memory.create_process(disk.get_info_for(1), disk.read_data_for(disk.get_info_for(1)));
+
+        let mut listing = Vec::new();
+        disassemble_process(&mut listing, &memory, &memory.get_pcb_for(1)).unwrap();
+        let listing = String::from_utf8(listing).unwrap();
+
+        assert!(listing.contains("MOVI r5 3"));
+        assert!(listing.contains("HLT"));
+        assert!(listing.contains("; page 1 is not resident"));
+    }
+}
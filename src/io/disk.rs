@@ -1,24 +1,53 @@
 use std::collections::HashMap;
+use std::ops::Range;
 
 use super::ProgramInfo;
 
-const DISK_SIZE: usize = 4096;
+use crate::kernel::instrumentation::{self, Counter};
+use crate::kernel::memory::DEFAULT_MEMORY_SIZE;
+
+pub const DISK_SIZE: usize = 4096;
+/// Words of swap per word of memory, room for several memories' worth of suspended processes.
+pub const SWAP_RATIO: usize = 4;
+pub const SWAP_SIZE: usize = SWAP_RATIO * DEFAULT_MEMORY_SIZE;
 
 pub struct Disk {
     program_map: HashMap<u32, ProgramInfo>,
-    data: [u32; DISK_SIZE],
+    data: Box<[u32]>,
     current_data_idx: usize,
+    /// Holds the images of processes swapped out of memory, kept apart from the program data.
+    swap: Box<[u32]>,
+    swap_map: HashMap<u32, Range<usize>>,
+    /// Unused extents of the swap area, sorted and never adjacent.
+    free_swap_extents: Vec<Range<usize>>,
 }
 
 impl Disk {
     pub fn new() -> Disk {
+        Disk::with_capacity(DISK_SIZE)
+    }
+
+    /// Creates a disk holding `capacity` words, for workloads larger than the default.
+    pub fn with_capacity(capacity: usize) -> Disk {
+        Disk::with_swap_capacity(capacity, SWAP_SIZE)
+    }
+
+    /// Creates a disk holding `capacity` words of programs and `swap_capacity` words of swap.
+    pub fn with_swap_capacity(capacity: usize, swap_capacity: usize) -> Disk {
         Disk {
             program_map: HashMap::new(),
-            data: [0; DISK_SIZE],
+            data: vec![0; capacity].into_boxed_slice(),
             current_data_idx: 0,
+            swap: vec![0; swap_capacity].into_boxed_slice(),
+            swap_map: HashMap::new(),
+            free_swap_extents: vec![0..swap_capacity],
         }
     }
 
+    pub fn get_capacity(&self) -> usize {
+        self.data.len()
+    }
+
     pub fn get_info_for(&self, program_id: u32) -> &ProgramInfo {
         match self.program_map.get(&program_id) {
             Some(program_info) => program_info,
@@ -28,12 +57,79 @@ impl Disk {
 
     pub fn read_data_for(&self, program_info: &ProgramInfo) -> &[u32] {
         let data_start_idx = program_info.data_start_idx;
-        let data_end_idx = data_start_idx + program_info.instruction_buffer_size +
-            program_info.in_buffer_size + program_info.out_buffer_size + program_info.temp_buffer_size;
+        let data_end_idx = data_start_idx + program_info.get_size();
 
+        record_read(data_end_idx - data_start_idx);
         &self.data[data_start_idx..data_end_idx]
     }
 
+    /// Overwrites words of a stored program, starting `offset` words into its data.
+    pub fn write_data_for(&mut self, program_id: u32, offset: usize, data: &[u32]) {
+        let program_info = self.get_info_for(program_id);
+        let data_start_idx = program_info.data_start_idx + offset;
+        let data_end_idx = data_start_idx + data.len();
+
+        if data_end_idx > program_info.data_start_idx + program_info.get_size() {
+            panic!("Out of bounds disk access");
+        }
+
+        record_write(data.len());
+        self.data[data_start_idx..data_end_idx].copy_from_slice(data);
+    }
+
+    /// Stores the image of a swapped out process in the first free extent that holds it.
+    pub fn write_swap(&mut self, process_id: u32, image: &[u32]) -> Result<(), &'static str> {
+        if self.swap_map.contains_key(&process_id) {
+            return Err("Process is already swapped out");
+        }
+
+        let idx = self.free_swap_extents.iter().position(|extent| extent.len() >= image.len()).ok_or("Swap area full")?;
+        let start = self.free_swap_extents[idx].start;
+        self.free_swap_extents[idx].start += image.len();
+
+        if self.free_swap_extents[idx].is_empty() {
+            self.free_swap_extents.remove(idx);
+        }
+
+        record_write(image.len());
+        self.swap[start..start + image.len()].copy_from_slice(image);
+        self.swap_map.insert(process_id, start..start + image.len());
+
+        Ok(())
+    }
+
+    pub fn read_swap(&self, process_id: u32) -> &[u32] {
+        match self.swap_map.get(&process_id) {
+            Some(extent) => {
+                record_read(extent.len());
+                &self.swap[extent.clone()]
+            }
+            _ => panic!("Process {} is not swapped out", process_id),
+        }
+    }
+
+    /// Releases a process's swap extent, merging it with free neighbours.
+    pub fn free_swap(&mut self, process_id: u32) {
+        let extent = match self.swap_map.remove(&process_id) {
+            Some(extent) => extent,
+            _ => panic!("Process {} is not swapped out", process_id),
+        };
+
+        let idx = self.free_swap_extents.partition_point(|free| free.start < extent.start);
+        self.free_swap_extents.insert(idx, extent);
+
+        if idx + 1 < self.free_swap_extents.len() && self.free_swap_extents[idx].end == self.free_swap_extents[idx + 1].start {
+            self.free_swap_extents[idx].end = self.free_swap_extents.remove(idx + 1).end;
+        }
+        if idx > 0 && self.free_swap_extents[idx - 1].end == self.free_swap_extents[idx].start {
+            self.free_swap_extents[idx - 1].end = self.free_swap_extents.remove(idx).end;
+        }
+    }
+
+    pub fn get_used_swap(&self) -> usize {
+        self.swap_map.values().map(|extent| extent.len()).sum()
+    }
+
     pub fn write_program(&mut self,
                          id: u32,
                          priority: u32,
@@ -45,10 +141,11 @@ impl Disk {
         let data_start_idx = self.current_data_idx;
         let data_end_idx = data_start_idx + data.len();
 
-        if data_end_idx > DISK_SIZE {
+        if data_end_idx > self.data.len() {
             panic!("Out of bounds disk access");
         }
 
+        record_write(data.len());
         self.data[data_start_idx..data_end_idx].copy_from_slice(data);
         self.current_data_idx += data.len();
 
@@ -66,6 +163,16 @@ impl Disk {
     }
 }
 
+fn record_read(words: usize) {
+    instrumentation::add(Counter::DiskReads, 1);
+    instrumentation::add(Counter::DiskReadWords, words as u64);
+}
+
+fn record_write(words: usize) {
+    instrumentation::add(Counter::DiskWrites, 1);
+    instrumentation::add(Counter::DiskWriteWords, words as u64);
+}
+
 #[cfg(test)]
 mod tests {
     use super::*;
@@ -79,6 +186,54 @@ mod tests {
         assert_eq!(data, &[1, 2, 3, 4, 5]);
     }
 
+    #[test]
+    fn test_disk_write_data_for() {
+        let mut disk = Disk::new();
+        disk.write_program(0, 0, 1, 1, 1, 2, &[1, 2, 3, 4, 5]);
+        disk.write_data_for(0, 3, &[9, 9]);
+
+        let data = disk.read_data_for(disk.get_info_for(0));
+        assert_eq!(data, &[1, 2, 3, 9, 9]);
+    }
+
+    #[test]
+    #[should_panic]
+    fn test_disk_out_of_bounds_write_data_for() {
+        let mut disk = Disk::new();
+        disk.write_program(0, 0, 1, 1, 1, 2, &[1, 2, 3, 4, 5]);
+        disk.write_data_for(0, 4, &[9, 9]);
+    }
+
+    #[test]
+    fn test_disk_swap() {
+        let mut disk = Disk::new();
+        disk.write_swap(1, &[1; 10]).unwrap();
+        disk.write_swap(2, &[2; 20]).unwrap();
+        disk.write_swap(3, &[3; 30]).unwrap();
+
+        assert_eq!(disk.write_swap(2, &[2]), Err("Process is already swapped out"));
+        assert_eq!(disk.read_swap(2), &[2; 20]);
+
+        disk.free_swap(1);
+        disk.free_swap(2);
+        disk.write_swap(4, &[4; 25]).unwrap();
+        assert_eq!(disk.get_used_swap(), 55);
+
+        disk.free_swap(3);
+        disk.free_swap(4);
+        assert_eq!(disk.get_used_swap(), 0);
+        assert_eq!(disk.write_swap(5, &[5; SWAP_SIZE]), Ok(()));
+        assert_eq!(disk.write_swap(6, &[6]), Err("Swap area full"));
+    }
+
+    #[test]
+    fn test_disk_with_swap_capacity() {
+        let mut disk = Disk::with_swap_capacity(DISK_SIZE, 2 * SWAP_SIZE);
+        assert_eq!(disk.write_swap(1, &[1; SWAP_SIZE + 1]), Ok(()));
+        assert_eq!(disk.read_swap(1).len(), SWAP_SIZE + 1);
+        assert_eq!(disk.write_swap(2, &[2; SWAP_SIZE]), Err("Swap area full"));
+    }
+
     #[test]
     #[should_panic]
     fn test_disk_out_of_bounds_read_data_for() {
@@ -92,4 +247,11 @@ mod tests {
         let mut disk = Disk::new();
         disk.write_program(0, 0, 0, 0, 0, 0, &[0; DISK_SIZE + 1]);
     }
+
+    #[test]
+    #[should_panic]
+    fn test_disk_with_capacity_out_of_bounds_write_program() {
+        let mut disk = Disk::with_capacity(4);
+        disk.write_program(0, 0, 1, 1, 1, 2, &[1, 2, 3, 4, 5]);
+    }
 }
\ No newline at end of file
@@ -0,0 +1,400 @@
+use std::io::Write;
+
+use super::{Disk, ProgramInfo};
+
+use crate::kernel::cpu::{Instruction, Opcode, WORD_SIZE};
+
+/// Registers reserved by synthetic programs. Everything else is free for the generated body.
+const ZERO_REGISTER: u32 = 1;
+const FLAG_REGISTER: u32 = 12;
+const LOOP_BOUND_REGISTER: u32 = 13;
+const DIVISOR_REGISTER: u32 = 14;
+const LOOP_COUNTER_REGISTER: u32 = 15;
+const WORK_REGISTERS: [u32; 11] = [0, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11];
+
+const PROLOGUE_LENGTH: usize = 4;
+const EPILOGUE_LENGTH: usize = 4;
+const MIN_INSTRUCTION_COUNT: usize = PROLOGUE_LENGTH + EPILOGUE_LENGTH + 1;
+const MAX_LOOP_ITERATIONS: u64 = 8;
+const MAX_IMMEDIATE: u64 = 0xFF;
+
+/// Relative weights of the instruction classes in a synthetic program body.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub struct IsaMix {
+    pub arithmetic: u32,
+    pub immediate: u32,
+    pub memory: u32,
+    pub io: u32,
+}
+
+/// A program whose instructions are reused by generated jobs with fresh input data.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct ProgramTemplate {
+    pub instructions: Vec<u32>,
+    pub in_buffer: Vec<u32>,
+    pub out_buffer_size: usize,
+    pub temp_buffer_size: usize,
+}
+
+/// Describes a workload. Ranges are inclusive and sampled uniformly.
+#[derive(Clone, Debug)]
+pub struct WorkloadConfig {
+    pub seed: u64,
+    pub job_count: usize,
+    pub instruction_count: (usize, usize),
+    pub priority: (u32, u32),
+    pub in_buffer_size: usize,
+    pub out_buffer_size: usize,
+    pub temp_buffer_size: usize,
+    pub isa_mix: IsaMix,
+    /// When not empty, every job copies the instructions of a randomly chosen template instead
+    /// of getting a synthetic program, and the buffer sizes above are ignored.
+    pub templates: Vec<ProgramTemplate>,
+}
+
+impl Default for WorkloadConfig {
+    /// A workload shaped like the shipped job file.
+    fn default() -> WorkloadConfig {
+        WorkloadConfig {
+            seed: 0,
+            job_count: 30,
+            instruction_count: (19, 28),
+            priority: (1, 31),
+            in_buffer_size: 0x14,
+            out_buffer_size: 0xC,
+            temp_buffer_size: 0xC,
+            isa_mix: IsaMix { arithmetic: 4, immediate: 4, memory: 2, io: 1 },
+            templates: Vec::new(),
+        }
+    }
+}
+
+impl WorkloadConfig {
+    /// Checks the ranges are not inverted, since sampling one would underflow.
+    pub fn validate(&self) -> Result<(), &'static str> {
+        if self.instruction_count.0 > self.instruction_count.1 {
+            return Err("Instruction count range has its minimum above its maximum");
+        }
+        if self.priority.0 > self.priority.1 {
+            return Err("Priority range has its minimum above its maximum");
+        }
+
+        Ok(())
+    }
+}
+
+/// SplitMix64. Small, fast and fully determined by its seed.
+struct Rng {
+    state: u64,
+}
+
+impl Rng {
+    fn new(seed: u64) -> Rng {
+        Rng { state: seed }
+    }
+
+    fn next_u64(&mut self) -> u64 {
+        self.state = self.state.wrapping_add(0x9E37_79B9_7F4A_7C15);
+
+        let mut z = self.state;
+        z = (z ^ (z >> 30)).wrapping_mul(0xBF58_476D_1CE4_E5B9);
+        z = (z ^ (z >> 27)).wrapping_mul(0x94D0_49BB_1331_11EB);
+        z ^ (z >> 31)
+    }
+
+    /// Returns a value in `min..=max`.
+    fn range(&mut self, min: u64, max: u64) -> u64 {
+        min + self.next_u64() % (max - min + 1)
+    }
+
+    fn pick<T: Copy>(&mut self, items: &[T]) -> T {
+        items[self.range(0, items.len() as u64 - 1) as usize]
+    }
+}
+
+fn r_type(opcode: Opcode, s1: u32, s2: u32, d: u32) -> u32 {
+    Instruction { opcode, reg_1: s1 as usize, reg_2: s2 as usize, reg_3: d as usize, address: 0 }.encode()
+}
+
+fn i_type(opcode: Opcode, b: u32, d: u32, address: u32) -> u32 {
+    Instruction { opcode, reg_1: b as usize, reg_2: d as usize, reg_3: 0, address: address as usize }.encode()
+}
+
+fn io_type(opcode: Opcode, r1: u32, address: u32) -> u32 {
+    Instruction { opcode, reg_1: r1 as usize, reg_2: 0, reg_3: 0, address: address as usize }.encode()
+}
+
+fn j_type(opcode: Opcode, address: u32) -> u32 {
+    Instruction { opcode, reg_1: 0, reg_2: 0, reg_3: 0, address: address as usize }.encode()
+}
+
+/// Builds the instructions of a synthetic program: a prologue that sets up the reserved
+/// registers, a random body, and a bounded loop around the body that always ends in HLT.
+/// Every address stays inside the program and nothing divides by zero, so jobs always finish.
+fn generate_instructions(rng: &mut Rng, config: &WorkloadConfig, instructions: &mut Vec<u32>) {
+    let (min_length, max_length) = config.instruction_count;
+    let length = rng.range(min_length.max(MIN_INSTRUCTION_COUNT) as u64, max_length.max(MIN_INSTRUCTION_COUNT) as u64) as usize;
+
+    let in_start = length;
+    let out_start = in_start + config.in_buffer_size;
+    let data_end = out_start + config.out_buffer_size + config.temp_buffer_size;
+    let byte_address = |word: usize| (word * WORD_SIZE) as u32;
+
+    instructions.push(i_type(Opcode::Movi, 0, ZERO_REGISTER, 0));
+    instructions.push(i_type(Opcode::Movi, 0, DIVISOR_REGISTER, rng.range(1, MAX_IMMEDIATE) as u32));
+    instructions.push(i_type(Opcode::Movi, 0, LOOP_COUNTER_REGISTER, 0));
+    instructions.push(i_type(Opcode::Movi, 0, LOOP_BOUND_REGISTER, rng.range(1, MAX_LOOP_ITERATIONS) as u32));
+
+    let IsaMix { arithmetic, immediate, memory, io } = config.isa_mix;
+    let total_weight = (arithmetic + immediate + memory + io).max(1) as u64;
+
+    for _ in 0..length - PROLOGUE_LENGTH - EPILOGUE_LENGTH {
+        let work = rng.pick(&WORK_REGISTERS);
+        let other = rng.pick(&WORK_REGISTERS);
+        let class = rng.range(0, total_weight - 1) as u32;
+
+        let instruction = if class < arithmetic {
+            match rng.range(0, 7) {
+                0 => r_type(Opcode::Add, work, other, rng.pick(&WORK_REGISTERS)),
+                1 => r_type(Opcode::Sub, work, other, rng.pick(&WORK_REGISTERS)),
+                2 => r_type(Opcode::Mul, work, other, rng.pick(&WORK_REGISTERS)),
+                3 => r_type(Opcode::And, work, other, rng.pick(&WORK_REGISTERS)),
+                4 => r_type(Opcode::Or, work, other, rng.pick(&WORK_REGISTERS)),
+                5 => r_type(Opcode::Slt, work, other, rng.pick(&WORK_REGISTERS)),
+                6 => r_type(Opcode::Div, work, DIVISOR_REGISTER, rng.pick(&WORK_REGISTERS)),
+                _ => r_type(Opcode::Mov, work, other, 0),
+            }
+        } else if class < arithmetic + immediate {
+            let value = rng.range(0, MAX_IMMEDIATE) as u32;
+
+            match rng.range(0, 4) {
+                0 => i_type(Opcode::Movi, 0, work, value),
+                1 => i_type(Opcode::Addi, 0, work, value),
+                2 => i_type(Opcode::Muli, 0, work, value),
+                3 => i_type(Opcode::Divi, 0, work, value.max(1)),
+                _ => i_type(Opcode::Slti, other, work, value),
+            }
+        } else if class < arithmetic + immediate + memory && data_end > out_start && rng.range(0, 1) == 0 {
+            i_type(Opcode::St, work, ZERO_REGISTER, byte_address(rng.range(out_start as u64, data_end as u64 - 1) as usize))
+        } else if class < arithmetic + immediate + memory && data_end > in_start {
+            i_type(Opcode::Lw, ZERO_REGISTER, work, byte_address(rng.range(in_start as u64, data_end as u64 - 1) as usize))
+        } else if config.out_buffer_size > 0 && rng.range(0, 1) == 0 {
+            io_type(Opcode::Wr, work, byte_address(rng.range(out_start as u64, (out_start + config.out_buffer_size) as u64 - 1) as usize))
+        } else if config.in_buffer_size > 0 {
+            io_type(Opcode::Rd, work, byte_address(rng.range(in_start as u64, out_start as u64 - 1) as usize))
+        } else {
+            j_type(Opcode::Nop, 0)
+        };
+
+        instructions.push(instruction);
+    }
+
+    instructions.push(i_type(Opcode::Addi, 0, LOOP_COUNTER_REGISTER, 1));
+    instructions.push(r_type(Opcode::Slt, LOOP_COUNTER_REGISTER, LOOP_BOUND_REGISTER, FLAG_REGISTER));
+    instructions.push(i_type(Opcode::Bne, FLAG_REGISTER, ZERO_REGISTER, byte_address(PROLOGUE_LENGTH)));
+    instructions.push(j_type(Opcode::Hlt, 0));
+}
+
+fn push_hex(line: &mut Vec<u8>, value: u64) {
+    const DIGITS: &[u8; 16] = b"0123456789ABCDEF";
+
+    let digit_count = (64 - value.leading_zeros() as usize).max(1).div_ceil(4);
+    for idx in (0..digit_count).rev() {
+        line.push(DIGITS[(value >> (idx * 4)) as usize & 0xF]);
+    }
+}
+
+fn push_word(line: &mut Vec<u8>, word: u32) {
+    const DIGITS: &[u8; 16] = b"0123456789ABCDEF";
+
+    line.extend_from_slice(b"0x");
+    for idx in (0..8).rev() {
+        line.push(DIGITS[(word >> (idx * 4)) as usize & 0xF]);
+    }
+    line.push(b'\n');
+}
+
+/// Appends one job in the `// JOB` / `// Data` / `// END` format. `data` holds the words of the
+/// in, out and temp buffers, whose sizes are `buffer_sizes`.
+pub(super) fn push_job(job: &mut Vec<u8>, id: u32, priority: u32, instructions: &[u32], buffer_sizes: (usize, usize, usize), data: &[u32]) {
+    let (in_buffer_size, out_buffer_size, temp_buffer_size) = buffer_sizes;
+
+    job.extend_from_slice(b"// JOB ");
+    push_hex(job, id as u64);
+    job.push(b' ');
+    push_hex(job, instructions.len() as u64);
+    job.push(b' ');
+    push_hex(job, priority as u64);
+    job.push(b'\n');
+
+    for &word in instructions {
+        push_word(job, word);
+    }
+
+    job.extend_from_slice(b"// Data ");
+    push_hex(job, in_buffer_size as u64);
+    job.push(b' ');
+    push_hex(job, out_buffer_size as u64);
+    job.push(b' ');
+    push_hex(job, temp_buffer_size as u64);
+    job.push(b'\n');
+
+    for &word in data {
+        push_word(job, word);
+    }
+
+    job.extend_from_slice(b"// END\n");
+}
+
+/// Writes a job file in the `// JOB` / `// Data` / `// END` format. The same config always
+/// produces the same bytes.
+pub fn generate<W: Write>(config: &WorkloadConfig, mut writer: W) -> std::io::Result<()> {
+    config.validate().map_err(|err| std::io::Error::new(std::io::ErrorKind::InvalidInput, err))?;
+
+    let mut rng = Rng::new(config.seed);
+    let mut instructions = Vec::new();
+    let mut data = Vec::new();
+    let mut job = Vec::new();
+
+    for idx in 0..config.job_count {
+        instructions.clear();
+        job.clear();
+
+        let priority = rng.range(config.priority.0 as u64, config.priority.1 as u64);
+
+        let (in_buffer, out_buffer_size, temp_buffer_size) = if config.templates.is_empty() {
+            generate_instructions(&mut rng, config, &mut instructions);
+            (None, config.out_buffer_size, config.temp_buffer_size)
+        } else {
+            let template = &config.templates[rng.range(0, config.templates.len() as u64 - 1) as usize];
+            instructions.extend_from_slice(&template.instructions);
+            (Some(&template.in_buffer), template.out_buffer_size, template.temp_buffer_size)
+        };
+        let in_buffer_size = in_buffer.map_or(config.in_buffer_size, |in_buffer| in_buffer.len());
+
+        // Templates keep their first input word, which the shipped programs use as an element count.
+        data.clear();
+        for word_idx in 0..in_buffer_size {
+            data.push(match in_buffer {
+                Some(in_buffer) if word_idx == 0 => in_buffer[0],
+                _ => rng.range(0, MAX_IMMEDIATE) as u32,
+            });
+        }
+        data.resize(in_buffer_size + out_buffer_size + temp_buffer_size, 0);
+
+        push_job(&mut job, idx as u32 + 1, priority as u32, &instructions, (in_buffer_size, out_buffer_size, temp_buffer_size), &data);
+        writer.write_all(&job)?;
+    }
+
+    writer.flush()
+}
+
+/// Turns programs already on disk into templates.
+pub fn templates_from(disk: &Disk, program_ids: &[u32]) -> Vec<ProgramTemplate> {
+    program_ids.iter()
+        .map(|&id| {
+            let ProgramInfo { instruction_buffer_size, in_buffer_size, out_buffer_size, temp_buffer_size, .. } = *disk.get_info_for(id);
+            let data = disk.read_data_for(disk.get_info_for(id));
+
+            ProgramTemplate {
+                instructions: data[..instruction_buffer_size].to_vec(),
+                in_buffer: data[instruction_buffer_size..instruction_buffer_size + in_buffer_size].to_vec(),
+                out_buffer_size,
+                temp_buffer_size,
+            }
+        })
+        .collect()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    use crate::io::loader;
+    use crate::kernel::{CPU, Memory};
+
+    fn generate_to_string(config: &WorkloadConfig) -> String {
+        let mut output = Vec::new();
+        generate(config, &mut output).unwrap();
+        String::from_utf8(output).unwrap()
+    }
+
+    #[test]
+    fn test_generate_is_deterministic() {
+        let config = WorkloadConfig { seed: 7, job_count: 100, ..WorkloadConfig::default() };
+
+        assert_eq!(generate_to_string(&config), generate_to_string(&config));
+        assert_ne!(generate_to_string(&config), generate_to_string(&WorkloadConfig { seed: 8, ..config.clone() }));
+    }
+
+    #[test]
+    fn test_generate_rejects_inverted_ranges() {
+        let config = WorkloadConfig { priority: (5, 3), ..WorkloadConfig::default() };
+        assert_eq!(config.validate(), Err("Priority range has its minimum above its maximum"));
+        assert_eq!(generate(&config, Vec::new()).unwrap_err().kind(), std::io::ErrorKind::InvalidInput);
+
+        let config = WorkloadConfig { instruction_count: (28, 19), ..WorkloadConfig::default() };
+        assert_eq!(config.validate(), Err("Instruction count range has its minimum above its maximum"));
+
+        let config = WorkloadConfig { priority: (4, 4), ..WorkloadConfig::default() };
+        assert_eq!(config.validate(), Ok(()));
+    }
+
+    #[test]
+    fn test_generate_then_load_programs_from() {
+        let config = WorkloadConfig { job_count: 40, priority: (3, 5), ..WorkloadConfig::default() };
+        let program_file = generate_to_string(&config);
+
+        let mut disk = Disk::with_capacity(program_file.lines().count());
+        let program_ids = loader::load_programs_from(program_file.as_bytes(), &mut disk).unwrap();
+
+        assert_eq!(program_ids, (1..=40).collect::<Vec<u32>>());
+        for id in program_ids {
+            let program = disk.get_info_for(id);
+            assert!((3..=5).contains(&program.priority));
+            assert!((19..=28).contains(&program.instruction_buffer_size));
+            assert_eq!(program.in_buffer_size, 0x14);
+        }
+    }
+
+    #[test]
+    fn test_generated_programs_run_to_completion() {
+        let config = WorkloadConfig { job_count: 12, seed: 3, ..WorkloadConfig::default() };
+        let program_file = generate_to_string(&config);
+
+        let mut disk = Disk::with_capacity(program_file.lines().count());
+        let program_ids = loader::load_programs_from(program_file.as_bytes(), &mut disk).unwrap();
+
+        let memory = Memory::new();
+        let mut cpu = CPU::new();
+        for id in program_ids {
+            let program_info = disk.get_info_for(id);
+            memory.create_process(program_info, disk.read_data_for(program_info));
+
+            assert_eq!(cpu.execute(&memory.get_pcb_for(id), &memory), Ok(()));
+        }
+    }
+
+    #[test]
+    fn test_generate_from_templates() {
+        let mut disk = Disk::new();
+        let program_ids = loader::load_programs_into_disk(&mut disk).unwrap();
+        let templates = templates_from(&disk, &program_ids[..3]);
+
+        let config = WorkloadConfig { job_count: 20, templates: templates.clone(), ..WorkloadConfig::default() };
+        let program_file = generate_to_string(&config);
+
+        let mut generated = Disk::with_capacity(program_file.lines().count());
+        let generated_ids = loader::load_programs_from(program_file.as_bytes(), &mut generated).unwrap();
+
+        for id in generated_ids {
+            let program = generated.get_info_for(id);
+            let data = generated.read_data_for(program);
+            let instructions = &data[..program.instruction_buffer_size];
+
+            let template = templates.iter().find(|template| template.instructions == instructions).unwrap();
+            assert_eq!(data[program.instruction_buffer_size], template.in_buffer[0]);
+            assert_eq!(program.temp_buffer_size, template.temp_buffer_size);
+        }
+    }
+}
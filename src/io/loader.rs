@@ -1,69 +1,175 @@
-use std::fs::File;
-use std::io::{BufRead, BufReader};
+use std::fs;
+use std::io::{BufRead, Error, ErrorKind};
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::thread;
 
-use super::Disk;
+use super::{Disk, ProgramInfo};
 
-const PROGRAM_FILE_PATH: &str = "data/program_file.txt";
+pub const PROGRAM_FILE_PATH: &str = "data/program_file.txt";
+
+/// Inputs smaller than this are parsed on the calling thread, since spawning costs more than it saves.
+const MIN_PARALLEL_INPUT_SIZE: usize = 1 << 20;
+
+/// Chunks per thread. More chunks than threads evens out jobs of different sizes.
+const CHUNKS_PER_THREAD: usize = 4;
+
+/// Programs parsed from one chunk of a job file. `data_start_idx` is relative to `data`.
+struct ParsedChunk {
+    programs: Vec<ProgramInfo>,
+    data: Vec<u32>,
+}
 
 pub fn load_programs_into_disk(disk: &mut Disk) -> std::io::Result<Vec<u32>> {
-    let file = File::open(PROGRAM_FILE_PATH)?;
-    let reader = BufReader::new(file);
+    let program_file = fs::read_to_string(PROGRAM_FILE_PATH)?;
+    load_programs_from_str(&program_file, disk, default_thread_count())
+}
 
-    let mut program_ids = Vec::new();
+/// Parses a job file in the `// JOB` / `// Data` / `// END` format and writes each program to disk.
+pub fn load_programs_from<R: BufRead>(mut reader: R, disk: &mut Disk) -> std::io::Result<Vec<u32>> {
+    let mut program_file = String::new();
+    reader.read_to_string(&mut program_file)?;
 
-    let mut data = Vec::new();
-    let mut id = 0;
-    let mut priority = 0;
-    let mut instruction_buffer_size = 0;
-    let mut in_buffer_size = 0;
-    let mut out_buffer_size = 0;
-    let mut temp_buffer_size = 0;
+    load_programs_from_str(&program_file, disk, default_thread_count())
+}
+
+/// Splits the job file at `// JOB` lines and parses the pieces on up to `thread_count` threads.
+/// Programs are then written to disk in file order, so ids and disk layout do not depend on
+/// the thread count.
+pub fn load_programs_from_str(program_file: &str, disk: &mut Disk, thread_count: usize) -> std::io::Result<Vec<u32>> {
+    let chunks = if thread_count <= 1 || program_file.len() < MIN_PARALLEL_INPUT_SIZE {
+        vec![parse_chunk(program_file)?]
+    } else {
+        parse_chunks_in_parallel(program_file, thread_count)?
+    };
+
+    let mut program_ids = Vec::with_capacity(chunks.iter().map(|chunk| chunk.programs.len()).sum());
+
+    for chunk in &chunks {
+        for program in &chunk.programs {
+            let data_end_idx = program.data_start_idx + program.get_size();
+
+            disk.write_program(program.id,
+                               program.priority,
+                               program.instruction_buffer_size,
+                               program.in_buffer_size,
+                               program.out_buffer_size,
+                               program.temp_buffer_size,
+                               &chunk.data[program.data_start_idx..data_end_idx]);
+
+            program_ids.push(program.id);
+        }
+    }
+
+    Ok(program_ids)
+}
+
+pub fn default_thread_count() -> usize {
+    thread::available_parallelism().map_or(1, |count| count.get())
+}
+
+fn parse_chunks_in_parallel(program_file: &str, thread_count: usize) -> std::io::Result<Vec<ParsedChunk>> {
+    let pieces = split_at_jobs(program_file, thread_count * CHUNKS_PER_THREAD);
+    let next_piece = AtomicUsize::new(0);
+
+    let mut parsed: Vec<(usize, std::io::Result<ParsedChunk>)> = thread::scope(|scope| {
+        let workers: Vec<_> = (0..thread_count.min(pieces.len()))
+            .map(|_| scope.spawn(|| {
+                let mut parsed = Vec::new();
+
+                loop {
+                    let idx = next_piece.fetch_add(1, Ordering::Relaxed);
+                    let Some(piece) = pieces.get(idx) else { return parsed };
+                    parsed.push((idx, parse_chunk(piece)));
+                }
+            }))
+            .collect();
+
+        workers.into_iter().flat_map(|worker| worker.join().unwrap()).collect()
+    });
+
+    parsed.sort_by_key(|(idx, _)| *idx);
+    parsed.into_iter().map(|(_, chunk)| chunk).collect()
+}
+
+/// Cuts the file into about `piece_count` pieces, each starting at a `// JOB` line.
+fn split_at_jobs(program_file: &str, piece_count: usize) -> Vec<&str> {
+    let bytes = program_file.as_bytes();
+    let target_size = program_file.len() / piece_count.max(1) + 1;
+
+    let mut pieces = Vec::with_capacity(piece_count);
+    let mut start = 0;
+
+    while start < bytes.len() {
+        let mut end = (start + target_size).min(bytes.len());
+
+        while end < bytes.len() && !(bytes[end - 1] == b'\n' && bytes[end..].starts_with(b"// JOB")) {
+            end += 1;
+        }
+
+        pieces.push(&program_file[start..end]);
+        start = end;
+    }
 
-    for line in reader.lines() {
-        let line = line?;
+    pieces
+}
+
+fn parse_hex(field: Option<&str>, line: &str) -> std::io::Result<u32> {
+    field.and_then(|field| u32::from_str_radix(field, 16).ok())
+        .ok_or_else(|| Error::new(ErrorKind::InvalidData, format!("Failed to parse job file line: {}", line)))
+}
 
+fn parse_chunk(chunk: &str) -> std::io::Result<ParsedChunk> {
+    let mut programs = Vec::new();
+    let mut data = Vec::new();
+    let mut program = ProgramInfo {
+        id: 0,
+        priority: 0,
+        instruction_buffer_size: 0,
+        in_buffer_size: 0,
+        out_buffer_size: 0,
+        temp_buffer_size: 0,
+        data_start_idx: 0,
+    };
+
+    for line in chunk.lines() {
         if line.starts_with("// JOB") {
-            let job_info = &line[7..];
-            let job_info: Vec<&str> = job_info.split_whitespace().collect();
+            let mut job_info = line[6..].split_whitespace();
 
-            id = u32::from_str_radix(job_info[0], 16).unwrap();
-            instruction_buffer_size = usize::from_str_radix(job_info[1], 16).unwrap();
-            priority = u32::from_str_radix(job_info[2], 16).unwrap();
+            program.id = parse_hex(job_info.next(), line)?;
+            program.instruction_buffer_size = parse_hex(job_info.next(), line)? as usize;
+            program.priority = parse_hex(job_info.next(), line)?;
+            program.data_start_idx = data.len();
         } else if line.starts_with("// Data") {
-            let data_info = &line[8..];
-            let data_info: Vec<&str> = data_info.split_whitespace().collect();
+            let mut data_info = line[7..].split_whitespace();
 
-            in_buffer_size = usize::from_str_radix(data_info[0], 16).unwrap();
-            out_buffer_size = usize::from_str_radix(data_info[1], 16).unwrap();
-            temp_buffer_size = usize::from_str_radix(data_info[2], 16).unwrap();
+            program.in_buffer_size = parse_hex(data_info.next(), line)? as usize;
+            program.out_buffer_size = parse_hex(data_info.next(), line)? as usize;
+            program.temp_buffer_size = parse_hex(data_info.next(), line)? as usize;
         } else if line.starts_with("// END") {
-            disk.write_program(id,
-                               priority,
-                               instruction_buffer_size,
-                               in_buffer_size,
-                               out_buffer_size,
-                               temp_buffer_size,
-                               data.as_slice());
-
-            program_ids.push(id);
-            data.clear();
+            if data.len() - program.data_start_idx != program.get_size() {
+                return Err(Error::new(ErrorKind::InvalidData, format!("Job {} does not match its declared buffer sizes", program.id)));
+            }
+
+            programs.push(ProgramInfo { ..program });
         } else {
             let line = line.trim();
-            let value = u32::from_str_radix(&line[2..], 16).unwrap_or_else(|_| {
-                panic!("Failed to parse hex value: {}", line)
-            });
+            if line.is_empty() {
+                continue;
+            }
 
-            data.push(value);
+            data.push(parse_hex(line.get(2..), line)?);
         }
     }
-    
-    Ok(program_ids)
+
+    Ok(ParsedChunk { programs, data })
 }
 
 #[cfg(test)]
 mod tests {
     use super::*;
 
+    use crate::io::generator::{self, WorkloadConfig};
+
     #[test]
     fn test_load_programs_into_disk() {
         let mut disk = Disk::new();
@@ -87,4 +193,59 @@ mod tests {
         assert_eq!(program.out_buffer_size, 12);
         assert_eq!(program.temp_buffer_size, 12);
     }
+
+    #[test]
+    fn test_load_programs_from() {
+        let program_file = "// JOB A 2 3\n0x4B000005\n0x92000000\n// Data 1 1 1\n0x00000007\n0x0\n0x0\n// END\n";
+
+        let mut disk = Disk::new();
+        let program_ids = load_programs_from(program_file.as_bytes(), &mut disk).unwrap();
+
+        assert_eq!(program_ids, vec![10]);
+        assert_eq!(disk.get_info_for(10).priority, 3);
+        assert_eq!(disk.read_data_for(disk.get_info_for(10)), &[0x4B000005, 0x92000000, 7, 0, 0]);
+    }
+
+    #[test]
+    fn test_load_programs_from_malformed_word() {
+        let program_file = "// JOB 1 1 1\n0xZZ\n// Data 0 0 0\n// END\n";
+
+        let result = load_programs_from(program_file.as_bytes(), &mut Disk::new());
+
+        assert_eq!(result.unwrap_err().kind(), ErrorKind::InvalidData);
+    }
+
+    #[test]
+    fn test_split_at_jobs() {
+        let program_file = fs::read_to_string(PROGRAM_FILE_PATH).unwrap();
+
+        let pieces = split_at_jobs(&program_file, 7);
+
+        assert!(pieces.len() > 1);
+        assert!(pieces.iter().all(|piece| piece.starts_with("// JOB")));
+        assert_eq!(pieces.concat(), program_file);
+    }
+
+    #[test]
+    fn test_load_programs_from_str_parallel_matches_sequential() {
+        let config = WorkloadConfig { job_count: 3000, ..WorkloadConfig::default() };
+        let mut program_file = Vec::new();
+        generator::generate(&config, &mut program_file).unwrap();
+        let program_file = String::from_utf8(program_file).unwrap();
+        assert!(program_file.len() > MIN_PARALLEL_INPUT_SIZE);
+
+        let mut sequential_disk = Disk::with_capacity(program_file.lines().count());
+        let sequential_ids = load_programs_from_str(&program_file, &mut sequential_disk, 1).unwrap();
+        let mut parallel_disk = Disk::with_capacity(program_file.lines().count());
+        let parallel_ids = load_programs_from_str(&program_file, &mut parallel_disk, 4).unwrap();
+
+        assert_eq!(sequential_ids, parallel_ids);
+        for id in sequential_ids {
+            let sequential_info = sequential_disk.get_info_for(id);
+            let parallel_info = parallel_disk.get_info_for(id);
+
+            assert_eq!(sequential_info.data_start_idx, parallel_info.data_start_idx);
+            assert_eq!(sequential_disk.read_data_for(sequential_info), parallel_disk.read_data_for(parallel_info));
+        }
+    }
 }
\ No newline at end of file
@@ -1,4 +1,6 @@
+pub mod assembly;
 pub mod disk;
+pub mod generator;
 pub mod loader;
 pub mod program_info;
 
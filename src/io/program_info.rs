@@ -6,4 +6,11 @@ pub struct ProgramInfo {
     pub out_buffer_size: usize,
     pub temp_buffer_size: usize,
     pub data_start_idx: usize,
-}
\ No newline at end of file
+}
+
+impl ProgramInfo {
+    /// Words the program takes on disk, buffers included.
+    pub fn get_size(&self) -> usize {
+        self.instruction_buffer_size + self.in_buffer_size + self.out_buffer_size + self.temp_buffer_size
+    }
+}
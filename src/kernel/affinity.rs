@@ -0,0 +1,187 @@
+use std::fs;
+use std::thread;
+
+/// Selects the host cores the CPU threads run on: CPU i's own thread in the deterministic
+/// engine, and dispatcher i in the threaded engine. A dispatcher runs whichever simulated CPU is
+/// free earliest, so there the pinning follows the thread rather than any one CPU.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub enum Affinity {
+    /// Leaves placement to the host scheduler, which may move threads between cores.
+    Unpinned,
+    /// Pins each CPU thread to a core of the layout `HostTopology::layout` picks for this host.
+    Topology,
+    /// Pins CPU thread i to the i-th listed host core, starting over once the list runs out.
+    Cores(Vec<usize>),
+}
+
+impl Affinity {
+    /// Host cores for CPU threads 0 to `cpu_count`, or none to leave them unpinned.
+    pub fn host_cores(&self, cpu_count: usize) -> Vec<usize> {
+        let cores = match self {
+            Affinity::Unpinned => return Vec::new(),
+            Affinity::Topology => HostTopology::detect().layout(),
+            Affinity::Cores(cores) => cores.clone(),
+        };
+
+        cores.iter().copied().cycle().take(if cores.is_empty() { 0 } else { cpu_count }).collect()
+    }
+}
+
+/// A host core as the kernel numbers it, with the socket and physical core it belongs to.
+/// Hyperthread siblings share a physical core.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub struct HostCore {
+    pub id: usize,
+    pub package: usize,
+    pub core: usize,
+}
+
+pub struct HostTopology {
+    cores: Vec<HostCore>,
+}
+
+impl HostTopology {
+    /// Reads where each core this process may run on sits from sysfs. Cores it cannot place
+    /// count as separate physical cores of socket 0.
+    pub fn detect() -> HostTopology {
+        let read_id = |id: usize, file: &str| -> Option<usize> {
+            fs::read_to_string(format!("/sys/devices/system/cpu/cpu{}/topology/{}", id, file)).ok()?.trim().parse().ok()
+        };
+
+        let cores = allowed_host_cores().into_iter()
+            .map(|id| HostCore { id, package: read_id(id, "physical_package_id").unwrap_or(0), core: read_id(id, "core_id").unwrap_or(id) })
+            .collect();
+
+        HostTopology::from_cores(cores)
+    }
+
+    pub fn from_cores(mut cores: Vec<HostCore>) -> HostTopology {
+        cores.sort_by_key(|core| core.id);
+        HostTopology { cores }
+    }
+
+    pub fn get_cores(&self) -> &[HostCore] {
+        &self.cores
+    }
+
+    /// Orders the host cores for CPUs 0, 1, 2 and so on. The CPUs take every physical core of
+    /// one socket before moving to the next, so neighbouring CPUs share a last level cache, and
+    /// only share physical cores once each has one.
+    pub fn layout(&self) -> Vec<usize> {
+        let mut ranked: Vec<_> = self.cores.iter().enumerate()
+            .map(|(idx, core)| {
+                let sibling = self.cores[..idx].iter().filter(|other| (other.package, other.core) == (core.package, core.core)).count();
+                (sibling, core.package, core.core, core.id)
+            })
+            .collect();
+        ranked.sort();
+
+        ranked.into_iter().map(|(_, _, _, id)| id).collect()
+    }
+}
+
+/// Pins the calling thread to a host core.
+pub fn pin_current_thread(host_core: usize) -> Result<(), &'static str> {
+    sys::set_affinity(host_core)
+}
+
+/// Pins CPU thread `thread_idx` to its core in `host_cores`, if it has one. A thread that
+/// cannot be pinned runs on unpinned.
+pub fn pin_cpu_thread(thread_idx: usize, host_cores: &[usize]) {
+    let Some(&host_core) = host_cores.get(thread_idx) else { return };
+
+    if let Err(err) = pin_current_thread(host_core) {
+        println!("CPU thread {} was not pinned to host core {}: {}", thread_idx, host_core, err);
+    }
+}
+
+/// Host cores the calling thread may run on.
+pub fn allowed_host_cores() -> Vec<usize> {
+    sys::get_affinity().unwrap_or_else(|| (0..thread::available_parallelism().map_or(1, |count| count.get())).collect())
+}
+
+#[cfg(target_os = "linux")]
+mod sys {
+    /// Matches the C library's cpu_set_t, which holds 1024 cores.
+    const CPU_SET_WORDS: usize = 1024 / u64::BITS as usize;
+
+    extern "C" {
+        fn sched_setaffinity(pid: i32, cpusetsize: usize, mask: *const u64) -> i32;
+        fn sched_getaffinity(pid: i32, cpusetsize: usize, mask: *mut u64) -> i32;
+    }
+
+    pub fn set_affinity(host_core: usize) -> Result<(), &'static str> {
+        let mut mask = [0u64; CPU_SET_WORDS];
+        let word = mask.get_mut(host_core / u64::BITS as usize).ok_or("Host core out of range")?;
+        *word |= 1 << (host_core % u64::BITS as usize);
+
+        // A pid of 0 is the calling thread, and the mask outlives the call.
+        match unsafe { sched_setaffinity(0, std::mem::size_of_val(&mask), mask.as_ptr()) } {
+            0 => Ok(()),
+            _ => Err("Host core not available to this process"),
+        }
+    }
+
+    pub fn get_affinity() -> Option<Vec<usize>> {
+        let mut mask = [0u64; CPU_SET_WORDS];
+        if unsafe { sched_getaffinity(0, std::mem::size_of_val(&mask), mask.as_mut_ptr()) } != 0 {
+            return None;
+        }
+
+        Some((0..CPU_SET_WORDS * u64::BITS as usize).filter(|&core| mask[core / 64] & (1 << (core % 64)) != 0).collect())
+    }
+}
+
+#[cfg(not(target_os = "linux"))]
+mod sys {
+    pub fn set_affinity(_host_core: usize) -> Result<(), &'static str> {
+        Err("Pinning threads is only supported on Linux")
+    }
+
+    pub fn get_affinity() -> Option<Vec<usize>> {
+        None
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_host_topology_layout() {
+        // Two sockets of two cores with two hyperthreads each, numbered the way Linux usually
+        // does: the first thread of every core, then the second.
+        let cores = (0..8).map(|id| HostCore { id, package: id / 2 % 2, core: id % 2 }).collect();
+        let topology = HostTopology::from_cores(cores);
+
+        assert_eq!(topology.layout(), vec![0, 1, 2, 3, 4, 5, 6, 7]);
+
+        // Numbered by socket, with siblings adjacent.
+        let cores = (0..8).map(|id| HostCore { id, package: id / 4, core: id / 2 % 2 }).collect();
+        let topology = HostTopology::from_cores(cores);
+
+        assert_eq!(topology.layout(), vec![0, 2, 4, 6, 1, 3, 5, 7]);
+    }
+
+    #[test]
+    fn test_affinity_host_cores() {
+        assert_eq!(Affinity::Unpinned.host_cores(4), Vec::<usize>::new());
+        assert_eq!(Affinity::Cores(vec![3, 5]).host_cores(5), vec![3, 5, 3, 5, 3]);
+        assert_eq!(Affinity::Cores(Vec::new()).host_cores(2), Vec::<usize>::new());
+        assert_eq!(Affinity::Topology.host_cores(3).len(), 3);
+    }
+
+    #[test]
+    #[cfg(target_os = "linux")]
+    fn test_pin_current_thread() {
+        let allowed = allowed_host_cores();
+        let last = *allowed.last().unwrap();
+
+        thread::spawn(move || {
+            pin_current_thread(last).unwrap();
+            assert_eq!(allowed_host_cores(), vec![last]);
+        }).join().unwrap();
+
+        assert_eq!(pin_current_thread(4096), Err("Host core out of range"));
+    }
+}
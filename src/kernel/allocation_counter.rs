@@ -0,0 +1,31 @@
+use std::alloc::{GlobalAlloc, Layout, System};
+use std::cell::Cell;
+
+/// Counts heap allocations made by the current thread, so tests running in parallel do not
+/// disturb each other's counts.
+struct CountingAllocator;
+
+thread_local! {
+    static ALLOCATION_COUNT: Cell<usize> = const { Cell::new(0) };
+}
+
+unsafe impl GlobalAlloc for CountingAllocator {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        let _ = ALLOCATION_COUNT.try_with(|count| count.set(count.get() + 1));
+        System.alloc(layout)
+    }
+
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        System.dealloc(ptr, layout)
+    }
+}
+
+#[global_allocator]
+static ALLOCATOR: CountingAllocator = CountingAllocator;
+
+/// The heap allocations `routine` makes on the calling thread.
+pub fn count_allocations(routine: impl FnOnce()) -> usize {
+    let before = ALLOCATION_COUNT.with(Cell::get);
+    routine();
+    ALLOCATION_COUNT.with(Cell::get) - before
+}
@@ -0,0 +1,51 @@
+use std::sync::atomic::{AtomicU64, Ordering};
+
+/// Simulation time measured in CPU cycles. Every executed instruction takes one cycle.
+pub struct Clock {
+    ticks: AtomicU64,
+}
+
+impl Clock {
+    pub fn new() -> Clock {
+        Clock {
+            ticks: AtomicU64::new(0),
+        }
+    }
+
+    pub fn now(&self) -> u64 {
+        self.ticks.load(Ordering::Acquire)
+    }
+
+    /// Moves time forward and returns the new time.
+    pub fn advance(&self, cycles: u64) -> u64 {
+        self.ticks.fetch_add(cycles, Ordering::AcqRel) + cycles
+    }
+
+    /// Moves time forward to `ticks` unless it is already later, as when CPUs running side by
+    /// side each report the time they reached. Returns the new time.
+    pub fn advance_to(&self, ticks: u64) -> u64 {
+        self.ticks.fetch_max(ticks, Ordering::AcqRel).max(ticks)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_clock_advance() {
+        let clock = Clock::new();
+        assert_eq!(clock.now(), 0);
+        assert_eq!(clock.advance(5), 5);
+        assert_eq!(clock.advance(3), 8);
+        assert_eq!(clock.now(), 8);
+    }
+
+    #[test]
+    fn test_clock_advance_to() {
+        let clock = Clock::new();
+        assert_eq!(clock.advance_to(5), 5);
+        assert_eq!(clock.advance_to(3), 5);
+        assert_eq!(clock.now(), 5);
+    }
+}
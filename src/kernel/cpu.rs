@@ -1,6 +1,572 @@
+use std::fmt;
+
+use super::{Memory, ProcessControlBlock};
+use super::instrumentation;
+use super::profiler::{self, Profile};
+use super::paging::{Access, PAGE_FAULT};
+use super::process_control_block::Context;
+
+/// Number of general purpose registers. Register 0 is the accumulator.
+pub const REGISTER_COUNT: usize = 16;
+
+/// Addresses inside instructions are byte offsets from the start of the program.
+pub const WORD_SIZE: usize = 4;
+
+/// Returned when a process used up its quantum. Its context is saved as on a page fault.
+pub const QUANTUM_EXPIRED: &str = "Quantum expired";
+
+#[derive(Clone, Copy, Debug, PartialEq, Eq, Hash)]
+pub enum Opcode {
+    Rd, Wr, St, Lw, Mov, Add, Sub, Mul, Div, And, Or, Movi, Addi, Muli,
+    Divi, Ldi, Slt, Slti, Hlt, Nop, Jmp, Beq, Bne, Bez, Bnz, Bgz, Blz,
+}
+
+/// How an instruction word lays out its fields, named by the top two bits of the word.
+#[derive(Clone, Copy, Debug, PartialEq, Eq, Hash)]
+pub enum Format {
+    /// Registers s1, s2 and d.
+    Arithmetic = 0b00,
+    /// Registers b and d and a 16 bit immediate or address.
+    Immediate = 0b01,
+    /// A 24 bit address.
+    Jump = 0b10,
+    /// Registers r1 and r2 and a 16 bit address.
+    Io = 0b11,
+}
+
+impl Format {
+    fn from_bits(bits: u32) -> Format {
+        match bits & 0b11 {
+            0b00 => Format::Arithmetic,
+            0b01 => Format::Immediate,
+            0b10 => Format::Jump,
+            _ => Format::Io,
+        }
+    }
+}
+
+/// Mnemonic and format of each opcode, in encoding order. The decoder, the disassembler and the
+/// assembler all read their opcodes from here.
+const OPCODE_TABLE: [(Opcode, &str, Format); 27] = {
+    use Format::*;
+    use Opcode::*;
+    [
+        (Rd, "RD", Io), (Wr, "WR", Io), (St, "ST", Immediate), (Lw, "LW", Immediate),
+        (Mov, "MOV", Arithmetic), (Add, "ADD", Arithmetic), (Sub, "SUB", Arithmetic), (Mul, "MUL", Arithmetic),
+        (Div, "DIV", Arithmetic), (And, "AND", Arithmetic), (Or, "OR", Arithmetic),
+        (Movi, "MOVI", Immediate), (Addi, "ADDI", Immediate), (Muli, "MULI", Immediate), (Divi, "DIVI", Immediate),
+        (Ldi, "LDI", Immediate), (Slt, "SLT", Arithmetic), (Slti, "SLTI", Immediate),
+        (Hlt, "HLT", Jump), (Nop, "NOP", Jump), (Jmp, "JMP", Jump),
+        (Beq, "BEQ", Immediate), (Bne, "BNE", Immediate), (Bez, "BEZ", Immediate), (Bnz, "BNZ", Immediate),
+        (Bgz, "BGZ", Immediate), (Blz, "BLZ", Immediate),
+    ]
+};
+
+impl Opcode {
+    /// Every opcode, in encoding order.
+    pub const ALL: [Opcode; 27] = {
+        let mut opcodes = [Opcode::Rd; 27];
+        let mut idx = 0;
+        while idx < opcodes.len() {
+            opcodes[idx] = OPCODE_TABLE[idx].0;
+            idx += 1;
+        }
+        opcodes
+    };
+
+    fn from_bits(bits: u32) -> Option<Opcode> {
+        Opcode::ALL.get(bits as usize).copied()
+    }
+
+    /// Looks an opcode up by its mnemonic, ignoring case.
+    pub fn from_mnemonic(mnemonic: &str) -> Option<Opcode> {
+        OPCODE_TABLE.iter().find(|(_, name, _)| name.eq_ignore_ascii_case(mnemonic)).map(|&(opcode, _, _)| opcode)
+    }
+
+    pub fn mnemonic(self) -> &'static str {
+        OPCODE_TABLE[self as usize].1
+    }
+
+    /// The format the opcode is encoded in.
+    pub fn format(self) -> Format {
+        OPCODE_TABLE[self as usize].2
+    }
+
+    /// Whether the opcode may move the program counter somewhere other than the next instruction.
+    pub fn is_branch(self) -> bool {
+        use Opcode::*;
+        matches!(self, Jmp | Beq | Bne | Bez | Bnz | Bgz | Blz)
+    }
+}
+
+/// A decoded instruction word. Registers are named by position because their role depends on
+/// the format: (s1, s2, d) for arithmetic, (b, d) for immediate and branch, (r1, r2) for I/O.
+#[derive(Clone, Copy, Debug, PartialEq, Eq, Hash)]
+pub struct Instruction {
+    pub opcode: Opcode,
+    pub reg_1: usize,
+    pub reg_2: usize,
+    pub reg_3: usize,
+    pub address: usize,
+}
+
+impl Instruction {
+    /// Decodes the fields the format bits of the word name, whichever format the opcode is
+    /// normally encoded in.
+    pub fn decode(word: u32) -> Result<Instruction, &'static str> {
+        let opcode = Opcode::from_bits((word >> 24) & 0x3F).ok_or("Invalid opcode")?;
+        let reg_1 = ((word >> 20) & 0xF) as usize;
+        let reg_2 = ((word >> 16) & 0xF) as usize;
+
+        let instruction = match Format::from_bits(word >> 30) {
+            Format::Arithmetic => Instruction { opcode, reg_1, reg_2, reg_3: ((word >> 12) & 0xF) as usize, address: 0 },
+            Format::Jump => Instruction { opcode, reg_1: 0, reg_2: 0, reg_3: 0, address: (word & 0xFF_FFFF) as usize },
+            Format::Immediate | Format::Io => Instruction { opcode, reg_1, reg_2, reg_3: 0, address: (word & 0xFFFF) as usize },
+        };
+
+        Ok(instruction)
+    }
+
+    /// Encodes the instruction in its opcode's format. Fields that format has no room for are
+    /// dropped, and registers and addresses are masked to their width.
+    pub fn encode(&self) -> u32 {
+        let Instruction { opcode, reg_1, reg_2, reg_3, address } = *self;
+        let (reg_1, reg_2, reg_3, address) = ((reg_1 & 0xF) as u32, (reg_2 & 0xF) as u32, (reg_3 & 0xF) as u32, address as u32);
+
+        let fields = match opcode.format() {
+            Format::Arithmetic => reg_1 << 20 | reg_2 << 16 | reg_3 << 12,
+            Format::Jump => address & 0xFF_FFFF,
+            Format::Immediate | Format::Io => reg_1 << 20 | reg_2 << 16 | address & 0xFFFF,
+        };
+
+        (opcode.format() as u32) << 30 | (opcode as u32) << 24 | fields
+    }
+}
+
+/// Disassembles the instruction in the notation the tests comment programs with, such as
+/// "MOVI r5 3", "SLT r6 r5 r8", "BNE r8 r1 -> 0x08" and "RD r5 <- 0x1C". Addresses are byte
+/// offsets in hex and immediates are decimal, except the address LDI loads.
+impl fmt::Display for Instruction {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        let Instruction { opcode, reg_1, reg_2, reg_3, address } = *self;
+        let mnemonic = opcode.mnemonic();
+
+        match opcode.format() {
+            Format::Io => {
+                let arrow = if opcode == Opcode::Wr { "->" } else { "<-" };
+                match (reg_2, address) {
+                    (_, 0) => write!(f, "{} r{} {} r{}", mnemonic, reg_1, arrow, reg_2),
+                    (0, _) => write!(f, "{} r{} {} {:#04X}", mnemonic, reg_1, arrow, address),
+                    _ => write!(f, "{} r{} r{} {} {:#04X}", mnemonic, reg_1, reg_2, arrow, address),
+                }
+            }
+            Format::Arithmetic => write!(f, "{} r{} r{} r{}", mnemonic, reg_1, reg_2, reg_3),
+            Format::Jump if address == 0 => write!(f, "{}", mnemonic),
+            Format::Jump => write!(f, "{} -> {:#04X}", mnemonic, address),
+            Format::Immediate if opcode.is_branch() => write!(f, "{} r{} r{} -> {:#04X}", mnemonic, reg_1, reg_2, address),
+            Format::Immediate => {
+                write!(f, "{}", mnemonic)?;
+                // Most immediate instructions only use d, so b is left out while it is r0.
+                if reg_1 != 0 {
+                    write!(f, " r{}", reg_1)?;
+                }
+                match opcode {
+                    Opcode::Ldi => write!(f, " r{} {:#04X}", reg_2, address),
+                    _ => write!(f, " r{} {}", reg_2, address),
+                }
+            }
+        }
+    }
+}
+
+/// Translates a program relative byte address into a physical memory address.
+pub(crate) fn translate(pcb: &ProcessControlBlock, byte_address: usize, access: Access) -> Result<usize, &'static str> {
+    if let Some(page_table) = &pcb.page_table {
+        return page_table.translate(byte_address / WORD_SIZE, access);
+    }
+
+    let address = pcb.get_mem_start_address() + byte_address / WORD_SIZE;
+
+    if address >= pcb.get_mem_end_address() {
+        return Err("Out of bounds memory access");
+    }
+
+    Ok(address)
+}
+
+pub(crate) fn fetch(pcb: &ProcessControlBlock, memory: &Memory, program_counter: usize) -> Result<Instruction, &'static str> {
+    if program_counter >= pcb.instruction_buffer_size {
+        return Err("Program counter out of bounds");
+    }
+
+    Instruction::decode(memory.read_from(translate(pcb, program_counter * WORD_SIZE, Access::Read)?))
+}
+
+/// Work done by one process during a run on a CPU.
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub struct ExecutionStats {
+    pub cycles: u64,
+    pub io_operations: u64,
+}
+
 /// Controls the execution of program instructions.
-pub struct CPU {}
+pub struct CPU {
+    /// Numbers the CPU in instrumentation.
+    id: usize,
+    registers: [u32; REGISTER_COUNT],
+    program_counter: usize,
+    stats: ExecutionStats,
+    /// Counts the instructions this CPU executes while profiling.
+    profile: Option<Box<Profile>>,
+}
 
 impl CPU {
-    pub fn start() {}
+    pub fn new() -> CPU {
+        CPU::with_id(0)
+    }
+
+    pub fn with_id(id: usize) -> CPU {
+        CPU {
+            id,
+            registers: [0; REGISTER_COUNT],
+            program_counter: 0,
+            stats: ExecutionStats::default(),
+            profile: profiler::is_enabled().then(|| Box::new(Profile::new())),
+        }
+    }
+
+    pub fn get_id(&self) -> usize {
+        self.id
+    }
+
+    /// Starts counting executed instructions. CPUs created while `profiler::enable` is in effect
+    /// start out profiling and hand their profile to the profiler when dropped.
+    pub fn enable_profiling(&mut self) {
+        self.profile.get_or_insert_with(|| Box::new(Profile::new()));
+    }
+
+    /// Takes the instructions counted so far and stops profiling.
+    pub fn take_profile(&mut self) -> Option<Profile> {
+        self.profile.take().map(|profile| *profile)
+    }
+
+    /// Runs the process until it halts or faults. On a page fault the context is saved in the
+    /// process control block, and the next `execute` resumes at the faulting instruction.
+    pub fn execute(&mut self, pcb: &ProcessControlBlock, memory: &Memory) -> Result<(), &'static str> {
+        self.execute_for(pcb, memory, u64::MAX)
+    }
+
+    /// Like `execute`, but stops with QUANTUM_EXPIRED once the process has run `quantum` cycles.
+    pub fn execute_for(&mut self, pcb: &ProcessControlBlock, memory: &Memory, quantum: u64) -> Result<(), &'static str> {
+        // Held for the whole run, so the pager cannot evict this process's pages under it.
+        let mut context = pcb.context.lock().unwrap();
+
+        self.registers = context.registers;
+        self.program_counter = context.program_counter;
+        self.stats = context.stats;
+
+        let cycles_before = self.stats.cycles;
+        let cycle_limit = cycles_before.saturating_add(quantum);
+
+        // Monomorphized per observer, so runs that are not profiled pay nothing for it.
+        let result = match self.profile.take() {
+            Some(mut profile) => {
+                let mut recorder = profile.recorder(pcb.id, pcb.instruction_buffer_size);
+                let result = self.run(pcb, memory, &mut context, cycle_limit, |program_counter, instruction, next_program_counter| {
+                    recorder.record(program_counter, instruction, next_program_counter)
+                });
+
+                self.profile = Some(profile);
+                result
+            }
+            None => self.run(pcb, memory, &mut context, cycle_limit, |_, _, _| {}),
+        };
+
+        let cycles = self.stats.cycles - cycles_before;
+        instrumentation::record_cpu(self.id, cycles, cycles);
+
+        result
+    }
+
+    /// Executes instructions until the program halts, faults or reaches `cycle_limit`, passing
+    /// each completed instruction to `observe` along with where the program counter was before
+    /// and after it.
+    fn run(&mut self, pcb: &ProcessControlBlock, memory: &Memory, context: &mut Context, cycle_limit: u64,
+           mut observe: impl FnMut(usize, Instruction, usize)) -> Result<(), &'static str> {
+        loop {
+            let stats = self.stats;
+            if stats.cycles == cycle_limit {
+                *context = Context { registers: self.registers, program_counter: self.program_counter, stats };
+                return Err(QUANTUM_EXPIRED);
+            }
+
+            let program_counter = self.program_counter;
+            let result = fetch(pcb, memory, program_counter).and_then(|instruction| {
+                let running = self.step(instruction, pcb, memory)?;
+                observe(program_counter, instruction, self.program_counter);
+                Ok(running)
+            });
+
+            match result {
+                Ok(true) => {}
+                Ok(false) => return Ok(()),
+                Err(PAGE_FAULT) => {
+                    // The instruction is retried once the page is in, so it is not counted yet.
+                    self.stats = stats;
+                    *context = Context { registers: self.registers, program_counter: self.program_counter, stats };
+
+                    return Err(PAGE_FAULT);
+                }
+                Err(err) => return Err(err),
+            }
+        }
+    }
+
+    /// Stats of the most recent `execute` call, including any earlier runs it resumed.
+    pub fn get_stats(&self) -> ExecutionStats {
+        self.stats
+    }
+
+    /// Executes one instruction. Returns false once the program halts. Inlined into the loop of
+    /// every `run`, which it stops being once it has more than one caller.
+    #[inline(always)]
+    fn step(&mut self, instruction: Instruction, pcb: &ProcessControlBlock, memory: &Memory) -> Result<bool, &'static str> {
+        use Opcode::*;
+
+        let Instruction { opcode, reg_1, reg_2, reg_3, address } = instruction;
+        let registers = &mut self.registers;
+        let mut next_program_counter = self.program_counter + 1;
+
+        self.stats.cycles += 1;
+        if opcode == Rd || opcode == Wr {
+            self.stats.io_operations += 1;
+        }
+
+        match opcode {
+            Rd => {
+                let source = if address != 0 { address } else { registers[reg_2] as usize };
+                registers[reg_1] = memory.read_from(translate(pcb, source, Access::Read)?);
+            }
+            Wr => {
+                let destination = if address != 0 { address } else { registers[reg_2] as usize };
+                memory.write_to(translate(pcb, destination, Access::Write)?, registers[reg_1]);
+            }
+            St => memory.write_to(translate(pcb, registers[reg_2] as usize + address, Access::Write)?, registers[reg_1]),
+            Lw => registers[reg_2] = memory.read_from(translate(pcb, registers[reg_1] as usize + address, Access::Read)?),
+            Mov => registers[reg_1] = registers[reg_2],
+            Add => registers[reg_3] = registers[reg_1].wrapping_add(registers[reg_2]),
+            Sub => registers[reg_3] = registers[reg_1].wrapping_sub(registers[reg_2]),
+            Mul => registers[reg_3] = registers[reg_1].wrapping_mul(registers[reg_2]),
+            Div => registers[reg_3] = registers[reg_1].checked_div(registers[reg_2]).ok_or("Division by zero")?,
+            And => registers[reg_3] = registers[reg_1] & registers[reg_2],
+            Or => registers[reg_3] = registers[reg_1] | registers[reg_2],
+            Movi | Ldi => registers[reg_2] = address as u32,
+            Addi => registers[reg_2] = registers[reg_2].wrapping_add(address as u32),
+            Muli => registers[reg_2] = registers[reg_2].wrapping_mul(address as u32),
+            Divi => registers[reg_2] = registers[reg_2].checked_div(address as u32).ok_or("Division by zero")?,
+            Slt => registers[reg_3] = ((registers[reg_1] as i32) < (registers[reg_2] as i32)) as u32,
+            Slti => registers[reg_2] = ((registers[reg_1] as i32) < address as i32) as u32,
+            Hlt => return Ok(false),
+            Nop => {}
+            Jmp => next_program_counter = address / WORD_SIZE,
+            Beq | Bne | Bez | Bnz | Bgz | Blz => {
+                if branch_taken(opcode, registers[reg_1], registers[reg_2]) {
+                    next_program_counter = address / WORD_SIZE;
+                }
+            }
+        }
+
+        self.program_counter = next_program_counter;
+        Ok(true)
+    }
+}
+
+impl Drop for CPU {
+    fn drop(&mut self) {
+        if let Some(profile) = self.profile.take() {
+            profiler::submit(*profile);
+        }
+    }
+}
+
+pub(crate) fn branch_taken(opcode: Opcode, b: u32, d: u32) -> bool {
+    match opcode {
+        Opcode::Beq => b == d,
+        Opcode::Bne => b != d,
+        Opcode::Bez => b == 0,
+        Opcode::Bnz => b != 0,
+        Opcode::Bgz => (b as i32) > 0,
+        Opcode::Blz => (b as i32) < 0,
+        _ => false,
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::sync::Arc;
+
+    use super::*;
+
+    use crate::io::ProgramInfo;
+
+    fn create_process(memory: &Memory, instructions: &[u32], data_size: usize) -> Arc<ProcessControlBlock> {
+        let program_info = ProgramInfo {
+            id: 1,
+            priority: 1,
+            instruction_buffer_size: instructions.len(),
+            in_buffer_size: data_size,
+            out_buffer_size: 0,
+            temp_buffer_size: 0,
+            data_start_idx: 0,
+        };
+        let mut program_data = instructions.to_vec();
+        program_data.resize(instructions.len() + data_size, 0);
+
+        memory.create_process(&program_info, &program_data);
+        memory.get_pcb_for(1)
+    }
+
+    #[test]
+    fn test_instruction_decode() {
+        let instruction = Instruction::decode(0xC050005C).unwrap();
+        assert_eq!(instruction, Instruction { opcode: Opcode::Rd, reg_1: 5, reg_2: 0, reg_3: 0, address: 0x5C });
+
+        let instruction = Instruction::decode(0x10658000).unwrap();
+        assert_eq!(instruction, Instruction { opcode: Opcode::Slt, reg_1: 6, reg_2: 5, reg_3: 8, address: 0 });
+
+        let instruction = Instruction::decode(0x92000000).unwrap();
+        assert_eq!(instruction.opcode, Opcode::Hlt);
+    }
+
+    #[test]
+    fn test_instruction_display() {
+        let disassemble = |word| Instruction::decode(word).unwrap().to_string();
+
+        assert_eq!(disassemble(0x4B050003), "MOVI r5 3");
+        assert_eq!(disassemble(0x10658000), "SLT r6 r5 r8");
+        assert_eq!(disassemble(0x56810008), "BNE r8 r1 -> 0x08");
+        assert_eq!(disassemble(0xC050005C), "RD r5 <- 0x5C");
+        assert_eq!(disassemble(0xC0BA0000), "RD r11 <- r10");
+        assert_eq!(disassemble(0xC1000010), "WR r0 -> 0x10");
+        assert_eq!(disassemble(0x4F0A005C), "LDI r10 0x5C");
+        assert_eq!(disassemble(0x43970000), "LW r9 r7 0");
+        assert_eq!(disassemble(0x92000000), "HLT");
+        assert_eq!(disassemble(0x94000020), "JMP -> 0x20");
+    }
+
+    #[test]
+    fn test_instruction_encode() {
+        for word in [0xC050005C, 0x10658000, 0x4B050003, 0x56810008, 0xC0BA0000, 0x94000020, 0x92000000] {
+            assert_eq!(Instruction::decode(word).unwrap().encode(), word);
+        }
+
+        // A MOVI carrying arithmetic format bits decodes as arithmetic but encodes as immediate.
+        assert_eq!(Instruction::decode(0x0B050000).unwrap().encode(), 0x4B050000);
+    }
+
+    #[test]
+    fn test_opcode_table() {
+        for opcode in Opcode::ALL {
+            assert_eq!(Opcode::from_bits(opcode as u32), Some(opcode));
+            assert_eq!(Opcode::from_mnemonic(opcode.mnemonic()), Some(opcode));
+        }
+
+        assert_eq!(Opcode::from_mnemonic("bne"), Some(Opcode::Bne));
+        assert_eq!(Opcode::from_mnemonic("BRA"), None);
+    }
+
+    #[test]
+    fn test_instruction_decode_invalid_opcode() {
+        assert_eq!(Instruction::decode(0x3F000000), Err("Invalid opcode"));
+    }
+
+    #[test]
+    fn test_cpu_execute_arithmetic_then_write() {
+        let memory = Memory::new();
+        // MOVI r0 5, ADDI r0 3, WR r0 -> 0x10, HLT
+        let pcb = create_process(&memory, &[0x4B000005, 0x4C000003, 0xC1000010, 0x92000000], 1);
+
+        let mut cpu = CPU::new();
+        cpu.execute(&pcb, &memory).unwrap();
+
+        assert_eq!(cpu.registers[0], 8);
+        assert_eq!(cpu.get_stats(), ExecutionStats { cycles: 4, io_operations: 1 });
+        assert_eq!(memory.read_from(4), 8);
+    }
+
+    #[test]
+    fn test_cpu_execute_loop() {
+        let memory = Memory::new();
+        // MOVI r5 3, MOVI r1 0, ADDI r6 1, SLT r6 r5 r8, BNE r8 r1 -> 0x08, HLT
+        let pcb = create_process(&memory, &[0x4B050003, 0x4B010000, 0x4C060001, 0x10658000, 0x56810008, 0x92000000], 0);
+
+        let mut cpu = CPU::new();
+        cpu.execute(&pcb, &memory).unwrap();
+
+        assert_eq!(cpu.registers[6], 3);
+    }
+
+    #[test]
+    fn test_cpu_execute_resumes_after_page_fault() {
+        use crate::io::Disk;
+        use crate::kernel::{Pager, pager::FifoReplacement, paging::PAGE_SIZE};
+
+        // MOVI r0 5, JMP -> second page, then ADDI r0 3, WR r0 -> last word, HLT on the second page
+        let mut program_data = vec![0x4B000005, 0x94000000 | (PAGE_SIZE * WORD_SIZE) as u32];
+        program_data.resize(PAGE_SIZE, 0);
+        program_data.extend([0x4C000003, 0xC1000000 | ((PAGE_SIZE + 3) * WORD_SIZE) as u32, 0x92000000, 0]);
+
+        let mut disk = Disk::new();
+        disk.write_program(1, 1, PAGE_SIZE + 3, 1, 0, 0, &program_data);
+
+        let memory = Memory::with_demand_paging();
+        memory.create_process(disk.get_info_for(1), disk.read_data_for(disk.get_info_for(1)));
+        let pcb = memory.get_pcb_for(1);
+
+        let mut cpu = CPU::new();
+        assert_eq!(cpu.execute(&pcb, &memory), Err(PAGE_FAULT));
+        assert_eq!(cpu.get_stats().cycles, 2);
+
+        Pager::new(Box::new(FifoReplacement::new())).handle_page_fault(&mut disk, &memory, &pcb).unwrap();
+        cpu.execute(&pcb, &memory).unwrap();
+
+        assert_eq!(cpu.registers[0], 8);
+        assert_eq!(cpu.get_stats(), ExecutionStats { cycles: 5, io_operations: 1 });
+    }
+
+    #[test]
+    fn test_cpu_execute_for_resumes_after_quantum() {
+        let memory = Memory::new();
+        // MOVI r5 3, MOVI r1 0, ADDI r6 1, SLT r6 r5 r8, BNE r8 r1 -> 0x08, HLT
+        let pcb = create_process(&memory, &[0x4B050003, 0x4B010000, 0x4C060001, 0x10658000, 0x56810008, 0x92000000], 0);
+
+        let mut cpu = CPU::new();
+        assert_eq!(cpu.execute_for(&pcb, &memory, 4), Err(QUANTUM_EXPIRED));
+        assert_eq!(pcb.context.lock().unwrap().program_counter, 4);
+
+        cpu.execute_for(&pcb, &memory, 100).unwrap();
+
+        assert_eq!(cpu.registers[6], 3);
+        assert_eq!(cpu.get_stats().cycles, 12);
+    }
+
+    #[test]
+    fn test_cpu_execute_division_by_zero() {
+        let memory = Memory::new();
+        // DIV r0 r1 r0
+        let pcb = create_process(&memory, &[0x08010000, 0x92000000], 0);
+
+        let mut cpu = CPU::new();
+        assert_eq!(cpu.execute(&pcb, &memory), Err("Division by zero"));
+    }
+
+    #[test]
+    fn test_cpu_execute_out_of_bounds_write() {
+        let memory = Memory::new();
+        // WR r0 -> 0x40
+        let pcb = create_process(&memory, &[0xC1000040, 0x92000000], 1);
+
+        let mut cpu = CPU::new();
+        assert_eq!(cpu.execute(&pcb, &memory), Err("Out of bounds memory access"));
+    }
 }
@@ -1,27 +1,221 @@
-use super::{Memory, LongTermScheduler, FifoQueue, PriorityQueue, ShortTermScheduler};
+use std::cell::RefCell;
+use std::collections::VecDeque;
+use std::fs::{self, File};
+use std::io::{self, BufWriter, Write};
+use std::sync::{Arc, Barrier, Mutex, atomic::{AtomicBool, Ordering}, mpsc::{self, Receiver}};
+use std::thread;
+use std::time::Instant;
 
-use crate::io::{Disk, loader};
+use super::{Affinity, AdmissionPolicy, Clock, Memory, MetricsTable, LongTermScheduler, MediumTermScheduler, FifoQueue, PriorityQueue, ShortTermScheduler, IdleStrategy, LockstepCPU, Pager, PageReplacement, Termination};
+use super::{affinity, CPU, lockstep_cpu, long_term_scheduler::DEFAULT_STARVATION_WINDOW, memory::MemoryConfig, pager::DEFAULT_PAGE_IN_CYCLES, paging::PAGE_FAULT};
+use super::cpu::QUANTUM_EXPIRED;
+use super::executor::{Channel, Executor, Handle, Notify};
+use super::instrumentation;
+use super::profiler;
+use super::tracer::{self, EventKind};
+use super::{ProcessControlBlock, TimingWheel};
+
+use crate::io::{Disk, disk::{DISK_SIZE, SWAP_RATIO}, loader};
+
+const METRICS_FILE_PATH: &str = "metrics.csv";
+
+/// Cycles a CPU of the async, discrete event and deterministic engines runs before the others
+/// catch up. The process stays on its CPU, so this only bounds how far apart in virtual time the
+/// CPUs' events are.
+pub const QUANTUM: u64 = 64;
+
+/// Selects how admitted processes are run.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum ExecutionMode {
+    /// Each process is handed to the short term scheduler.
+    Scalar,
+    /// Processes with identical instructions are batched and run side by side on a LockstepCPU.
+    Lockstep,
+}
+
+/// Selects what runs the CPUs in scalar mode.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum Engine {
+    /// A dispatcher thread per CPU runs processes, each on whichever CPU is free earliest,
+    /// while the driver schedules on its own thread. The threads race, so with more than one CPU
+    /// results vary from run to run.
+    Threaded,
+    /// A thread per CPU as well, but the CPUs run in rounds of at most QUANTUM cycles between
+    /// barriers. Only the driver touches the ready queue and scheduler state, between rounds and
+    /// in CPU order, so runs are bit-identical.
+    Deterministic,
+    /// The CPUs and the driver are tasks on the driver's thread, and virtual time moves from one
+    /// event to the next, so any number of CPUs share a host core.
+    Async,
+    /// CPU bursts, context switches and scheduling rounds are timestamped events popped in order
+    /// from a timing wheel, with no threads or tasks at all.
+    DiscreteEvent,
+}
+
+/// An event of the discrete event engine.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+enum Event {
+    /// A process left its CPU. The driver records it, then runs a scheduling round.
+    Schedule(Termination),
+    /// A CPU starts on the process it was handed, the context switch paid.
+    Dispatch { cpu: usize },
+    /// A CPU's process ran for a quantum, or until it halted or faulted.
+    BurstEnd { cpu: usize, result: Result<(), &'static str> },
+    /// The page the longest blocked process faulted on is due in from disk.
+    PageIn,
+}
+
+/// A CPU of the discrete event or deterministic engine.
+struct Core {
+    cpu: CPU,
+    pcb: Option<Arc<ProcessControlBlock>>,
+    dispatched_at: u64,
+    /// How the latest round went, for the deterministic engine.
+    burst: Option<(Result<(), &'static str>, u64)>,
+}
+
+impl Core {
+    /// Runs the process for up to a quantum. Returns how it stopped and the cycles it ran.
+    fn run_burst(&mut self, memory: &Memory) -> (Result<(), &'static str>, u64) {
+        let pcb = self.pcb.as_ref().unwrap();
+        let cycles = pcb.context.lock().unwrap().stats.cycles;
+        let result = self.cpu.execute_for(pcb, memory, QUANTUM);
+
+        (result, self.cpu.get_stats().cycles - cycles)
+    }
+}
+
+#[derive(Clone, Debug)]
+pub struct DriverConfig {
+    pub execution_mode: ExecutionMode,
+    pub engine: Engine,
+    pub cpu_count: usize,
+    /// Host cores the CPU threads of the threaded and deterministic engines run on. Threaded
+    /// dispatchers are pinned, not the simulated CPUs they take turns running.
+    pub affinity: Affinity,
+    /// How the threaded engine's CPUs wait for work.
+    pub idle_strategy: IdleStrategy,
+    /// Cycles a CPU spends switching to a process. Only the async and discrete event engines
+    /// charge it.
+    pub context_switch_cycles: u64,
+    /// Cycles a faulted page takes to come in from disk. The process is not ready again until
+    /// it has.
+    pub page_in_cycles: u64,
+    pub admission_policy: AdmissionPolicy,
+    pub starvation_window: usize,
+    pub memory: MemoryConfig,
+    /// Slide waiting processes down over the holes finished ones leave, so larger programs fit.
+    pub compaction: bool,
+    /// Swap ready processes out to disk to make room for waiting programs of higher priority.
+    pub swapping: bool,
+    pub page_replacement: PageReplacement,
+    pub program_file_path: String,
+    pub metrics_file_path: String,
+    /// Where to write the instrumentation snapshot taken once every process has run: JSON if the
+    /// path ends in .json, otherwise Prometheus text.
+    pub instrumentation_file_path: Option<String>,
+    /// Where to write a Chrome trace of every process's admission, dispatches and exits. Tracing
+    /// is off without one.
+    pub trace_file_path: Option<String>,
+    /// Count the instructions the CPUs execute and print the hottest ones. Lockstep CPUs are
+    /// not profiled.
+    pub profile: bool,
+}
+
+impl Default for DriverConfig {
+    fn default() -> DriverConfig {
+        DriverConfig {
+            execution_mode: ExecutionMode::Scalar,
+            engine: Engine::Threaded,
+            cpu_count: 1,
+            affinity: Affinity::Unpinned,
+            idle_strategy: IdleStrategy::Park,
+            context_switch_cycles: 0,
+            page_in_cycles: DEFAULT_PAGE_IN_CYCLES,
+            admission_policy: AdmissionPolicy::Fifo,
+            starvation_window: DEFAULT_STARVATION_WINDOW,
+            memory: MemoryConfig::default(),
+            compaction: false,
+            swapping: false,
+            page_replacement: PageReplacement::Clock,
+            program_file_path: loader::PROGRAM_FILE_PATH.to_string(),
+            metrics_file_path: METRICS_FILE_PATH.to_string(),
+            instrumentation_file_path: None,
+            trace_file_path: None,
+            profile: false,
+        }
+    }
+}
 
 pub struct Driver {
+    config: DriverConfig,
     disk: Disk,
-    memory: Memory,
+    memory: Arc<Memory>,
     lts: LongTermScheduler,
+    mts: MediumTermScheduler,
     sts: ShortTermScheduler,
+    pager: Pager,
+    /// Processes waiting for a frame to load their faulted page into.
+    blocked_process_ids: VecDeque<u32>,
+    /// Processes whose faulted page is on its way in from disk, with the cycle it arrives, in
+    /// that order. The threaded engine marks them ready at once instead, as of that cycle.
+    paging_in: VecDeque<(u64, Arc<ProcessControlBlock>)>,
+    clock: Arc<Clock>,
+    /// While the threaded engine runs, the latest time any of its processes left a CPU, which the
+    /// current scheduling round follows.
+    round_at: Option<u64>,
+    metrics: MetricsTable,
+    termination_receiver: Receiver<Termination>,
 }
 
 impl Driver {
     pub fn new() -> Driver {
+        Driver::with_config(DriverConfig::default())
+    }
+
+    pub fn with_config(config: DriverConfig) -> Driver {
+        // Before the dispatchers start, so they set up their trace buffers first thing.
+        if config.trace_file_path.is_some() {
+            tracer::enable(tracer::DEFAULT_CAPACITY);
+        }
+        if config.profile {
+            profiler::enable();
+        }
+
+        let memory = Arc::new(Memory::with_config(config.memory));
+        let clock = Arc::new(Clock::new());
+        let (termination_sender, termination_receiver) = mpsc::channel();
+        let scheduler_queue = Box::new(FifoQueue::new());
+        // let scheduler_queue = Box::new(PriorityQueue::new());
+        let sts = match config.engine {
+            Engine::Threaded => ShortTermScheduler::new(scheduler_queue, config.cpu_count, &config.affinity.host_cores(config.cpu_count.max(1)), config.idle_strategy, memory.clone(), clock.clone(), termination_sender),
+            Engine::Async | Engine::DiscreteEvent | Engine::Deterministic => ShortTermScheduler::without_dispatcher(scheduler_queue),
+        };
+
         Driver {
+            lts: LongTermScheduler::with_policy(config.admission_policy, config.starvation_window),
+            mts: MediumTermScheduler::new(),
+            pager: Pager::new(config.page_replacement.create_policy()),
+            config,
             disk: Disk::new(),
-            memory: Memory::new(),
-            lts: LongTermScheduler::new(),
-            sts: ShortTermScheduler::new(Box::new(FifoQueue::new())),
-            // sts: ShortTermScheduler::new(Box::new(PriorityQueue::new())),
+            memory: memory.clone(),
+            sts,
+            blocked_process_ids: VecDeque::new(),
+            paging_in: VecDeque::new(),
+            clock,
+            round_at: None,
+            // Sized once the programs are loaded and the largest id is known.
+            metrics: MetricsTable::new(0, memory.get_memory_size()),
+            termination_receiver,
         }
     }
 
+    pub fn get_metrics(&self) -> &MetricsTable {
+        &self.metrics
+    }
+
     pub fn start(&mut self) {
-        let program_ids = loader::load_programs_into_disk(&mut self.disk)
+        let program_ids = self.load_programs()
             .unwrap_or_else(|err| {
                 println!("Failed to load programs into disk: {}", err);
                 return Vec::new();
@@ -32,12 +226,877 @@ impl Driver {
             return;
         }
 
-        self.lts.enqueue_programs(program_ids);
-        let process_ids = self.lts.batch_step(&mut self.disk, &mut self.memory);
-        
-        for process_id in process_ids {
+        let capacity = program_ids.iter().max().map_or(0, |&id| id as usize + 1);
+        self.metrics = MetricsTable::new(capacity, self.memory.get_memory_size());
+        self.lts.enqueue_programs(&self.disk, &self.memory, program_ids);
+
+        let process_ids = match self.config.execution_mode {
+            ExecutionMode::Lockstep if self.memory.is_demand_paged() => {
+                println!("Lockstep execution needs processes loaded whole. Running them one at a time instead.");
+                self.run_scalar()
+            }
+            ExecutionMode::Scalar => self.run_scalar(),
+            ExecutionMode::Lockstep => self.run_lockstep(),
+        };
+
+        if self.lts.get_pending_count() > 0 {
+            println!("{} programs never fit in memory and were not run.", self.lts.get_pending_count());
+        }
+
+        if self.config.swapping && self.memory.is_demand_paged() {
+            println!("Swapping needs processes loaded whole, so it was left off.");
+        } else if self.config.swapping {
+            let (words_out, words_in) = self.mts.get_swap_io_words();
+            println!("Swapping: {} processes out ({} words written), {} in ({} words read)",
+                     self.mts.get_swap_outs(), words_out, self.mts.get_swap_ins(), words_in);
+
+            if self.mts.get_inversion_cycles() > 0 {
+                println!("Priority inversion: {} cycles with the oldest waiting program outranking a resident process",
+                         self.mts.get_inversion_cycles());
+            }
+        }
+
+        if self.memory.is_demand_paged() {
+            println!("{:?} replacement: {} pages evicted, {} written back to disk",
+                     self.config.page_replacement, self.pager.get_evictions(), self.pager.get_write_backs());
+        }
+
+        self.report_metrics(&process_ids);
+        self.report_instrumentation();
+        self.report_trace();
+        self.report_profile();
+    }
+
+    fn load_programs(&mut self) -> io::Result<Vec<u32>> {
+        let program_file = fs::read_to_string(&self.config.program_file_path)?;
+
+        // Every word of a job sits on its own line, so the line count is enough disk for any file.
+        // Swap scales with memory, since a process can never be larger than the memory it left.
+        self.disk = Disk::with_swap_capacity(program_file.lines().count().max(DISK_SIZE), SWAP_RATIO * self.config.memory.size);
+        loader::load_programs_from_str(&program_file, &mut self.disk, loader::default_thread_count())
+    }
+
+    /// Admits as many waiting programs as fit in the free memory and marks them ready. The whole
+    /// round shares one timestamp, taken before any of it can be dispatched.
+    fn admit(&mut self) -> Vec<Arc<ProcessControlBlock>> {
+        let now = self.now();
+        let pcbs = self.lts.batch_step(&self.disk, &self.memory);
+
+        for pcb in &pcbs {
+            self.metrics.record_admission(pcb.id, now, pcb.get_resident_words(), self.memory.get_used_memory());
+            self.metrics.record_ready(pcb.id, now);
+            self.mts.record_admission(pcb);
+            tracer::record(EventKind::Admit, now, pcb.id, None);
+            tracer::record(EventKind::Ready, now, pcb.id, None);
+        }
+
+        pcbs
+    }
+
+    /// Records a finished process and gives its memory back for the next admission.
+    fn retire(&mut self, termination: Termination) {
+        if let Err(err) = termination.result {
+            println!("Process {} faulted: {}", termination.process_id, err);
+        }
+
+        self.metrics.record_dispatch(termination.process_id, termination.dispatched_at);
+        self.metrics.record_completion(termination.process_id, termination.completed_at,
+                                       termination.stats, termination.result.is_err());
+        self.mts.record_exit(&self.memory.get_pcb_for(termination.process_id));
+        self.memory.free_process(termination.process_id);
+    }
+
+    /// Keeps the short term scheduler fed until the disk drains. Every process leaving a CPU
+    /// wakes the loop. A page fault blocks the process until the pager has loaded the page, after
+    /// which it is ready again; a termination gives memory back for the next admission.
+    fn run_scalar(&mut self) -> Vec<u32> {
+        match self.config.engine {
+            Engine::Async => return self.run_async(),
+            Engine::DiscreteEvent => return self.run_discrete(),
+            Engine::Deterministic => return self.run_deterministic(),
+            Engine::Threaded => {}
+        }
+
+        let mut process_ids = Vec::new();
+        let mut running = 0;
+        self.round_at = Some(0);
+
+        loop {
+            running += self.schedule(&mut process_ids);
+            if running == 0 {
+                break;
+            }
+
+            // What this round makes ready became so when the process left its CPU, or when an
+            // earlier round freed what it needed, should that have come later.
+            let termination = self.termination_receiver.recv().unwrap();
+            let round_at = self.round_at.unwrap_or(0).max(termination.completed_at);
+            self.round_at = Some(round_at);
+            self.sts.set_ready_time(round_at);
+
+            if self.handle_termination(termination) {
+                running -= 1;
+            }
+        }
+        self.round_at = None;
+
+        let drain_latency = self.sts.drain();
+        let joined_at = Instant::now();
+        let dispatchers = self.sts.join();
+        println!("Dispatchers: {} drained in {:.1} us and joined in {:.1} us",
+                 dispatchers, drain_latency.as_secs_f64() * 1e6, joined_at.elapsed().as_secs_f64() * 1e6);
+
+        let micros = |percentile| self.sts.get_dispatch_latency(percentile).unwrap_or_default().as_secs_f64() * 1e6;
+        println!("Dispatch latency ({:?}): p50 {:.1} us, p90 {:.1} us, p99 {:.1} us, max {:.1} us over {} idle dispatches",
+                 self.sts.get_idle_strategy(), micros(50.0), micros(90.0), micros(99.0), micros(100.0), self.sts.get_dispatch_count());
+
+        process_ids
+    }
+
+    /// Runs `run_scalar`'s loop as one task and each CPU as another, all on this thread. A CPU
+    /// yields when its process leaves it and every QUANTUM cycles, sleeping for the cycles it
+    /// ran. With one CPU, processes run in the same order and finish at the same times as on the
+    /// threaded engine.
+    fn run_async(&mut self) -> Vec<u32> {
+        let mut process_ids = Vec::new();
+        let memory = self.memory.clone();
+        let terminations = Channel::new();
+        let idle_cpus = Notify::new();
+        let page_ins = Notify::new();
+        let mut executor = Executor::new(self.clock.clone());
+        let driver = RefCell::new(self);
+
+        let DriverConfig { cpu_count, context_switch_cycles, .. } = driver.borrow().config;
+        for cpu in 0..cpu_count.max(1) {
+            executor.spawn(run_cpu(CPU::with_id(cpu), executor.handle(), &driver, &memory, context_switch_cycles, &terminations, &idle_cpus));
+        }
+
+        executor.spawn(async {
+            let mut running = 0;
+
+            loop {
+                running += driver.borrow_mut().schedule(&mut process_ids);
+                if driver.borrow().sts.has_ready_processes() {
+                    idle_cpus.notify_one();
+                }
+                if driver.borrow().next_page_in().is_some() {
+                    page_ins.notify_one();
+                }
+
+                if running == 0 {
+                    break;
+                }
+
+                let termination = terminations.recv().await;
+                if driver.borrow_mut().handle_termination(termination) {
+                    running -= 1;
+                }
+            }
+        });
+
+        // The disk: makes each process whose page it was sent for ready once the page is in.
+        let (handle, driver, page_ins, idle_cpus) = (executor.handle(), &driver, &page_ins, &idle_cpus);
+        executor.spawn(async move {
+            loop {
+                let Some(at) = driver.borrow().next_page_in() else {
+                    page_ins.notified().await;
+                    continue;
+                };
+
+                handle.sleep(at.saturating_sub(handle.now())).await;
+                driver.borrow_mut().release_paged_in();
+                if driver.borrow().sts.has_ready_processes() {
+                    idle_cpus.notify_one();
+                }
+            }
+        });
+
+        executor.run();
+        drop(executor);
+
+        process_ids
+    }
+
+    /// Runs `run_scalar`'s loop as timestamped events popped from a timing wheel. Each burst is
+    /// executed when it starts, and its end queued at the cycle it finishes. Events at the same
+    /// cycle run in the order they were queued, the way the async engine's tasks wake, so both
+    /// engines give the same results.
+    fn run_discrete(&mut self) -> Vec<u32> {
+        let cpu_count = self.config.cpu_count.max(1);
+        let context_switch_cycles = self.config.context_switch_cycles;
+        let mut process_ids = Vec::new();
+        let mut cores: Vec<_> = (0..cpu_count).map(|cpu| Core { cpu: CPU::with_id(cpu), pcb: None, dispatched_at: 0, burst: None }).collect();
+        let mut idle_cpus: Vec<_> = (0..cpu_count).rev().collect();
+        let mut events = TimingWheel::new();
+        let mut event_count = 0u64;
+        // Whether a PageIn event is queued for the page due in first.
+        let mut page_in_queued = false;
+        let started_at = Instant::now();
+
+        self.schedule(&mut process_ids);
+        self.dispatch_idle(&mut idle_cpus, &mut cores, &mut events);
+
+        // Runs until no process is left on a CPU to queue another event.
+        while let Some((now, event)) = events.pop() {
+            self.clock.advance(now - self.clock.now());
+            event_count += 1;
+
+            match event {
+                Event::Schedule(termination) => {
+                    self.handle_termination(termination);
+                    self.schedule(&mut process_ids);
+                    self.dispatch_idle(&mut idle_cpus, &mut cores, &mut events);
+                }
+                Event::PageIn => {
+                    page_in_queued = false;
+                    self.release_paged_in();
+                    self.dispatch_idle(&mut idle_cpus, &mut cores, &mut events);
+                }
+                Event::Dispatch { cpu } => {
+                    instrumentation::record_cpu(cpu, 0, context_switch_cycles);
+                    tracer::record(EventKind::Dispatch, now, cores[cpu].pcb.as_ref().unwrap().id, Some(cpu));
+                    cores[cpu].dispatched_at = now;
+                    let (result, cycles) = cores[cpu].run_burst(&self.memory);
+                    events.schedule(now + cycles, Event::BurstEnd { cpu, result });
+                }
+                Event::BurstEnd { cpu, result: Err(QUANTUM_EXPIRED) } => {
+                    // The process keeps its CPU, so there is nothing to trace.
+                    let (result, cycles) = cores[cpu].run_burst(&self.memory);
+                    events.schedule(now + cycles, Event::BurstEnd { cpu, result });
+                }
+                Event::BurstEnd { cpu, result } => {
+                    let core = &mut cores[cpu];
+                    let process_id = core.pcb.take().unwrap().id;
+                    let termination = Termination { process_id, dispatched_at: core.dispatched_at, completed_at: now, stats: core.cpu.get_stats(), result };
+                    tracer::record(EventKind::of_exit(result), now, process_id, Some(cpu));
+
+                    // The CPU moves on to the next ready process before the driver hears of it.
+                    core.pcb = self.sts.try_dispatch(self.memory.get_bank_for_cpu(cpu));
+                    match core.pcb {
+                        Some(_) => events.schedule(now + context_switch_cycles, Event::Dispatch { cpu }),
+                        None => idle_cpus.push(cpu),
+                    }
+
+                    events.schedule(now, Event::Schedule(termination));
+                }
+            }
+
+            // Pages come in in the order they were sent for, so only the first needs an event.
+            if let (false, Some(at)) = (page_in_queued, self.next_page_in()) {
+                events.schedule(at, Event::PageIn);
+                page_in_queued = true;
+            }
+        }
+
+        let elapsed = started_at.elapsed().as_secs_f64();
+        println!("Discrete event engine: {} events in {:.1} ms ({:.2}M events per second)",
+                 event_count, elapsed * 1e3, event_count as f64 / elapsed / 1e6);
+
+        process_ids
+    }
+
+    /// Runs `run_scalar`'s loop with a thread per CPU, in rounds. Between rounds the driver hands
+    /// ready processes to idle CPUs, lowest numbered first. In a round each busy CPU runs its
+    /// process for up to QUANTUM cycles, touching only that process. The round lasts as long as
+    /// its longest run, after which the driver retires the finished processes in CPU order and
+    /// schedules once. With one CPU this matches the threaded engine.
+    fn run_deterministic(&mut self) -> Vec<u32> {
+        let cpu_count = self.config.cpu_count.max(1);
+        let cores: Vec<_> = (0..cpu_count).map(|cpu| Mutex::new(Core { cpu: CPU::with_id(cpu), pcb: None, dispatched_at: 0, burst: None })).collect();
+        let host_cores = self.config.affinity.host_cores(cpu_count);
+        let barrier = Barrier::new(cpu_count + 1);
+        let finished = AtomicBool::new(false);
+        let memory = self.memory.clone();
+        let mut process_ids = Vec::new();
+
+        thread::scope(|scope| {
+            for (cpu, core) in cores.iter().enumerate() {
+                let (barrier, finished, memory, host_cores) = (&barrier, &finished, &memory, &host_cores);
+
+                let worker = thread::Builder::new().name(format!("cpu{}", cpu)).spawn_scoped(scope, move || {
+                    affinity::pin_cpu_thread(cpu, host_cores);
+
+                    loop {
+                        barrier.wait();
+                        if finished.load(Ordering::Acquire) {
+                            break;
+                        }
+
+                        let mut core = core.lock().unwrap();
+                        if core.pcb.is_some() {
+                            core.burst = Some(core.run_burst(memory));
+                        }
+                        drop(core);
+
+                        barrier.wait();
+                    }
+                });
+
+                worker.expect("Failed to start a CPU thread");
+            }
+
+            self.schedule(&mut process_ids);
+
+            loop {
+                let mut busy = false;
+                for (cpu, core) in cores.iter().enumerate() {
+                    let mut core = core.lock().unwrap();
+                    if core.pcb.is_none() {
+                        core.pcb = self.sts.try_dispatch(self.memory.get_bank_for_cpu(cpu));
+                        core.dispatched_at = self.clock.now();
+
+                        if let Some(pcb) = &core.pcb {
+                            tracer::record(EventKind::Dispatch, core.dispatched_at, pcb.id, Some(cpu));
+                        }
+                    }
+                    busy |= core.pcb.is_some();
+                }
+
+                if !busy {
+                    // Every CPU is idle until the next page comes in from disk, if one is on its way.
+                    let Some(at) = self.next_page_in() else { break };
+                    self.clock.advance(at - self.clock.now());
+                    self.schedule(&mut process_ids);
+                    continue;
+                }
+
+                barrier.wait();
+                barrier.wait();
+
+                let round_start = self.clock.now();
+                let round_cycles = cores.iter().filter_map(|core| core.lock().unwrap().burst.map(|(_, cycles)| cycles)).max();
+                self.clock.advance(round_cycles.unwrap_or(0));
+
+                for (cpu, core) in cores.iter().enumerate() {
+                    let mut core = core.lock().unwrap();
+                    let Some((result, cycles)) = core.burst.take() else { continue };
+                    // The process carries on when the next round starts.
+                    if result == Err(QUANTUM_EXPIRED) {
+                        continue;
+                    }
+
+                    let process_id = core.pcb.take().unwrap().id;
+                    tracer::record(EventKind::of_exit(result), round_start + cycles, process_id, Some(cpu));
+                    let termination = Termination { process_id, dispatched_at: core.dispatched_at, completed_at: round_start + cycles, stats: core.cpu.get_stats(), result };
+                    drop(core);
+
+                    self.handle_termination(termination);
+                }
+
+                self.schedule(&mut process_ids);
+            }
+
+            finished.store(true, Ordering::Release);
+            barrier.wait();
+        });
+
+        process_ids
+    }
+
+    /// Hands ready processes to idle CPUs of the discrete event engine, lowest numbered first.
+    fn dispatch_idle(&mut self, idle_cpus: &mut Vec<usize>, cores: &mut [Core], events: &mut TimingWheel<Event>) {
+        while let Some(&cpu) = idle_cpus.last() {
+            let Some(pcb) = self.sts.try_dispatch(self.memory.get_bank_for_cpu(cpu)) else { break };
+
+            idle_cpus.pop();
+            cores[cpu].pcb = Some(pcb);
+            events.schedule(events.now() + self.config.context_switch_cycles, Event::Dispatch { cpu });
+        }
+    }
+
+    /// One round of scheduling between processes leaving CPUs: pages in faulted processes,
+    /// makes room, and marks newly admitted processes ready. Returns how many were admitted.
+    fn schedule(&mut self, process_ids: &mut Vec<u32>) -> usize {
+        self.resume_blocked();
+        self.release_paged_in();
+
+        if self.config.compaction {
+            self.compact();
+        }
+
+        if self.config.swapping && !self.memory.is_demand_paged() {
+            self.swap();
+        }
+
+        let admitted = self.admit();
+        let admitted_count = admitted.len();
+        process_ids.extend(admitted.iter().map(|pcb| pcb.id));
+        self.sts.schedule_processes(admitted);
+
+        let waiting_priority = self.get_waiting_program().map(|(priority, _)| priority);
+        self.mts.observe(self.clock.now(), waiting_priority);
+
+        admitted_count
+    }
+
+    /// Returns true if the process is done, or false if it blocked on a page fault.
+    fn handle_termination(&mut self, termination: Termination) -> bool {
+        if termination.result == Err(PAGE_FAULT) {
+            self.metrics.record_dispatch(termination.process_id, termination.dispatched_at);
+            self.metrics.record_page_fault(termination.process_id);
+            self.blocked_process_ids.push_back(termination.process_id);
+
+            return false;
+        }
+
+        self.retire(termination);
+        true
+    }
+
+    /// Sends for the faulted pages of blocked processes, in the order they faulted. Stops at the
+    /// first one with no frame to spare. Each process stays blocked until its page is in, which
+    /// takes `page_in_cycles`.
+    fn resume_blocked(&mut self) {
+        while let Some(&process_id) = self.blocked_process_ids.front() {
             let pcb = self.memory.get_pcb_for(process_id);
-            self.sts.schedule_process(pcb);
+
+            if self.pager.handle_page_fault(&mut self.disk, &self.memory, &pcb).is_err() {
+                break;
+            }
+
+            self.metrics.record_memory_usage(self.memory.get_used_memory());
+            self.blocked_process_ids.pop_front();
+
+            let arrives_at = self.now() + self.config.page_in_cycles;
+            match self.config.engine {
+                Engine::Threaded => self.make_paged_in_ready(pcb, arrives_at),
+                Engine::Async | Engine::DiscreteEvent | Engine::Deterministic => self.paging_in.push_back((arrives_at, pcb)),
+            }
         }
     }
-}
\ No newline at end of file
+
+    /// Makes ready the processes whose page has come in by now.
+    fn release_paged_in(&mut self) {
+        while let Some(&(arrives_at, _)) = self.paging_in.front() {
+            if arrives_at > self.clock.now() {
+                break;
+            }
+
+            let (_, pcb) = self.paging_in.pop_front().unwrap();
+            self.make_paged_in_ready(pcb, arrives_at);
+        }
+    }
+
+    /// When the next page on its way in from disk arrives.
+    fn next_page_in(&self) -> Option<u64> {
+        self.paging_in.front().map(|&(arrives_at, _)| arrives_at)
+    }
+
+    fn make_paged_in_ready(&mut self, pcb: Arc<ProcessControlBlock>, arrives_at: u64) {
+        self.metrics.record_ready(pcb.id, arrives_at);
+        tracer::record(EventKind::IoEnd, arrives_at, pcb.id, None);
+        tracer::record(EventKind::Ready, arrives_at, pcb.id, None);
+        self.sts.schedule_process_at(pcb, arrives_at);
+    }
+
+    /// The time of the current scheduling round. The threaded engine's CPUs each keep their own
+    /// time and the clock follows the one furthest ahead, so its rounds take the time of the
+    /// terminations that set them off instead.
+    fn now(&self) -> u64 {
+        self.round_at.unwrap_or_else(|| self.clock.now())
+    }
+
+    /// Priority and admission size of the program that has waited longest.
+    fn get_waiting_program(&self) -> Option<(u32, usize)> {
+        let program_info = self.disk.get_info_for(self.lts.get_oldest_pending()?);
+        Some((program_info.priority, self.memory.get_admission_size(program_info.get_size())))
+    }
+
+    /// Brings swapped out processes back while nothing waiting outranks them, then swaps out
+    /// lower priority ready processes if that lets the oldest waiting program in.
+    fn swap(&mut self) {
+        let waiting_program = self.get_waiting_program();
+
+        let swapped_in = self.mts.swap_in(&mut self.disk, &self.memory, waiting_program.map(|(priority, _)| priority));
+        for pcb in &swapped_in {
+            self.metrics.record_ready(pcb.id, self.now());
+            tracer::record(EventKind::Ready, self.now(), pcb.id, None);
+        }
+        self.sts.schedule_processes(swapped_in);
+
+        if let Some((priority, size)) = waiting_program {
+            self.mts.make_room(&mut self.disk, &self.memory, &mut self.sts, self.config.compaction.then_some(&self.metrics), priority, size);
+        }
+    }
+
+    /// Compacts memory when programs are waiting and finished processes have left holes. The
+    /// process on the CPU stays put, and everything else keeps running meanwhile.
+    fn compact(&mut self) {
+        if self.lts.get_pending_count() == 0 || self.memory.get_fragmented_memory() == 0 {
+            return;
+        }
+
+        let started_at = Instant::now();
+        let stats = self.memory.compact();
+        self.metrics.record_compaction(started_at.elapsed(), stats);
+    }
+
+    /// Runs each admitted batch to completion on a LockstepCPU, then admits the next one.
+    fn run_lockstep(&mut self) -> Vec<u32> {
+        let mut process_ids = Vec::new();
+        let mut lockstep_cpu = LockstepCPU::new();
+
+        loop {
+            let pcbs = self.admit();
+            if pcbs.is_empty() {
+                break;
+            }
+
+            for batch in lockstep_cpu::group_by_instructions(&pcbs, &self.memory) {
+                let dispatched_at = self.clock.now();
+                let results = lockstep_cpu.execute(&batch, &self.memory);
+                let completed_at = self.clock.advance(lockstep_cpu.get_issued_cycles());
+
+                for ((pcb, result), &stats) in batch.iter().zip(results).zip(lockstep_cpu.get_stats()) {
+                    tracer::record(EventKind::Dispatch, dispatched_at, pcb.id, Some(0));
+                    tracer::record(EventKind::of_exit(result), completed_at, pcb.id, Some(0));
+                    self.retire(Termination { process_id: pcb.id, dispatched_at, completed_at, stats, result });
+                }
+            }
+
+            process_ids.extend(pcbs.iter().map(|pcb| pcb.id));
+        }
+
+        process_ids
+    }
+
+    fn report_metrics(&self, process_ids: &[u32]) {
+        self.metrics.print_summary(process_ids);
+
+        let path = &self.config.metrics_file_path;
+        let result = File::create(path)
+            .and_then(|file| self.metrics.write_csv(&mut BufWriter::new(file), process_ids));
+
+        if let Err(err) = result {
+            println!("Failed to write metrics to {}: {}", path, err);
+        }
+    }
+
+    fn report_trace(&self) {
+        let Some(path) = &self.config.trace_file_path else { return };
+
+        tracer::disable();
+        let trace = tracer::take();
+        let result = File::create(path).and_then(|file| {
+            let mut writer = BufWriter::new(file);
+            trace.write_chrome_json(&mut writer)?;
+            writer.flush()
+        });
+
+        match result {
+            Ok(()) => println!("Trace: {} events written to {} ({} dropped)", trace.get_events().len(), path, trace.get_dropped()),
+            Err(err) => println!("Failed to write trace to {}: {}", path, err),
+        }
+    }
+
+    fn report_profile(&self) {
+        if !self.config.profile {
+            return;
+        }
+
+        // Every CPU has been dropped by now, which hands its profile over.
+        profiler::disable();
+        if let Err(err) = profiler::take().write_report(&mut io::stdout().lock(), profiler::DEFAULT_REPORT_LENGTH) {
+            println!("Failed to write profile: {}", err);
+        }
+    }
+
+    fn report_instrumentation(&self) {
+        let Some(path) = &self.config.instrumentation_file_path else { return };
+
+        let snapshot = instrumentation::snapshot();
+        let result = File::create(path).and_then(|file| {
+            let mut writer = BufWriter::new(file);
+            match path.ends_with(".json") {
+                true => snapshot.write_json(&mut writer)?,
+                false => snapshot.write_prometheus(&mut writer)?,
+            }
+            writer.flush()
+        });
+
+        if let Err(err) = result {
+            println!("Failed to write instrumentation to {}: {}", path, err);
+        }
+    }
+}
+
+/// A CPU of the async engine. It takes ready processes from the short term scheduler, waiting on
+/// `idle_cpus` while there are none, and passes the next idle CPU along if more are ready.
+async fn run_cpu(mut cpu: CPU, handle: Handle, driver: &RefCell<&mut Driver>, memory: &Memory, context_switch_cycles: u64,
+                 terminations: &Channel<Termination>, idle_cpus: &Notify) {
+    loop {
+        let Some(pcb) = driver.borrow_mut().sts.try_dispatch(memory.get_bank_for_cpu(cpu.get_id())) else {
+            idle_cpus.notified().await;
+            continue;
+        };
+
+        if driver.borrow().sts.has_ready_processes() {
+            idle_cpus.notify_one();
+        }
+
+        handle.sleep(context_switch_cycles).await;
+        instrumentation::record_cpu(cpu.get_id(), 0, context_switch_cycles);
+        let dispatched_at = handle.now();
+        let mut cycles = pcb.context.lock().unwrap().stats.cycles;
+
+        tracer::record(EventKind::Dispatch, dispatched_at, pcb.id, Some(cpu.get_id()));
+
+        let result = loop {
+            let result = cpu.execute_for(&pcb, memory, QUANTUM);
+            handle.sleep(cpu.get_stats().cycles - cycles).await;
+            cycles = cpu.get_stats().cycles;
+
+            if result != Err(QUANTUM_EXPIRED) {
+                break result;
+            }
+        };
+        tracer::record(EventKind::of_exit(result), handle.now(), pcb.id, Some(cpu.get_id()));
+
+        terminations.send(Termination { process_id: pcb.id, dispatched_at, completed_at: handle.now(), stats: cpu.get_stats(), result });
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::io::generator::{self, WorkloadConfig};
+
+    /// Runs a generated workload several times larger than memory and checks every job finished.
+    fn run_generated_workload(name: &str, config: DriverConfig) -> Driver {
+        let directory = std::env::temp_dir().join(format!("driver_test_{}_{}", name, std::process::id()));
+        fs::create_dir_all(&directory).unwrap();
+
+        let program_file_path = directory.join("programs.txt");
+        let workload = WorkloadConfig { seed: 31, job_count: 200, ..WorkloadConfig::default() };
+        generator::generate(&workload, &mut File::create(&program_file_path).unwrap()).unwrap();
+
+        let mut driver = Driver::with_config(DriverConfig {
+            program_file_path: program_file_path.to_string_lossy().into_owned(),
+            metrics_file_path: directory.join("metrics.csv").to_string_lossy().into_owned(),
+            ..config
+        });
+        driver.start();
+
+        for process_id in 1..=200 {
+            let job = driver.get_metrics().snapshot(process_id);
+            assert!(job.completed_at > 0, "job {} never completed", process_id);
+            assert!(!job.faulted);
+        }
+        assert_eq!(driver.memory.get_used_memory(), 0);
+
+        fs::remove_dir_all(&directory).unwrap();
+        driver
+    }
+
+    #[test]
+    fn test_driver_scalar_drains_disk() {
+        run_generated_workload("scalar", DriverConfig::default());
+    }
+
+    #[test]
+    fn test_driver_demand_paging_drains_disk() {
+        run_generated_workload("demand_paging", DriverConfig {
+            memory: MemoryConfig { demand_paging: true, ..MemoryConfig::default() },
+            ..DriverConfig::default()
+        });
+    }
+
+    #[test]
+    fn test_driver_memory_banks_drain_disk() {
+        run_generated_workload("memory_banks", DriverConfig {
+            admission_policy: AdmissionPolicy::FirstFit,
+            memory: MemoryConfig { size: 4096, bank_count: 4, demand_paging: false },
+            ..DriverConfig::default()
+        });
+    }
+
+    #[test]
+    fn test_driver_compaction_drains_disk() {
+        run_generated_workload("compaction", DriverConfig { compaction: true, ..DriverConfig::default() });
+    }
+
+    #[test]
+    fn test_driver_swapping_drains_disk() {
+        run_generated_workload("swapping", DriverConfig { swapping: true, ..DriverConfig::default() });
+    }
+
+    #[test]
+    fn test_driver_best_fit_drains_disk() {
+        run_generated_workload("best_fit", DriverConfig { admission_policy: AdmissionPolicy::BestFit, ..DriverConfig::default() });
+    }
+
+    #[test]
+    fn test_driver_async_engine_matches_threaded() {
+        let threaded = run_generated_workload("threaded", DriverConfig::default());
+        let driver = run_generated_workload("async", DriverConfig { engine: Engine::Async, ..DriverConfig::default() });
+
+        for process_id in 1..=200 {
+            let (expected, job) = (threaded.get_metrics().snapshot(process_id), driver.get_metrics().snapshot(process_id));
+            assert_eq!((job.dispatched_at, job.completed_at, job.cpu_cycles), (expected.dispatched_at, expected.completed_at, expected.cpu_cycles));
+        }
+    }
+
+    #[test]
+    fn test_driver_threaded_engine_many_cpus_drain_disk() {
+        run_generated_workload("threaded_many_cpus", DriverConfig { cpu_count: 4, ..DriverConfig::default() });
+    }
+
+    #[test]
+    fn test_driver_deterministic_engine_matches_threaded() {
+        let threaded = run_generated_workload("threaded_reference", DriverConfig::default());
+        let driver = run_generated_workload("deterministic", DriverConfig { engine: Engine::Deterministic, ..DriverConfig::default() });
+
+        for process_id in 1..=200 {
+            let (expected, job) = (threaded.get_metrics().snapshot(process_id), driver.get_metrics().snapshot(process_id));
+            assert_eq!((job.dispatched_at, job.completed_at, job.cpu_cycles), (expected.dispatched_at, expected.completed_at, expected.cpu_cycles));
+        }
+    }
+
+    #[test]
+    fn test_driver_deterministic_engine_is_reproducible() {
+        let config = DriverConfig {
+            engine: Engine::Deterministic,
+            cpu_count: 4,
+            compaction: true,
+            swapping: true,
+            memory: MemoryConfig { size: 2048, ..MemoryConfig::default() },
+            ..DriverConfig::default()
+        };
+        let first = run_generated_workload("deterministic_first", config.clone());
+        let second = run_generated_workload("deterministic_second", config);
+
+        for process_id in 1..=200 {
+            assert_eq!(first.get_metrics().snapshot(process_id), second.get_metrics().snapshot(process_id));
+        }
+    }
+
+    #[test]
+    fn test_driver_discrete_event_engine_matches_async() {
+        for cpu_count in [1, 8] {
+            let config = DriverConfig { cpu_count, memory: MemoryConfig { size: 4096, ..MemoryConfig::default() }, ..DriverConfig::default() };
+            let async_driver = run_generated_workload("async_reference", DriverConfig { engine: Engine::Async, ..config.clone() });
+            let driver = run_generated_workload("discrete_event", DriverConfig { engine: Engine::DiscreteEvent, ..config });
+
+            for process_id in 1..=200 {
+                assert_eq!(driver.get_metrics().snapshot(process_id), async_driver.get_metrics().snapshot(process_id));
+            }
+        }
+    }
+
+    #[test]
+    fn test_driver_discrete_event_engine_context_switches() {
+        let driver = run_generated_workload("context_switches", DriverConfig {
+            engine: Engine::DiscreteEvent,
+            context_switch_cycles: 10,
+            ..DriverConfig::default()
+        });
+
+        let job = driver.get_metrics().snapshot(200);
+        assert!(job.completed_at >= (1..=200).map(|process_id| driver.get_metrics().snapshot(process_id).cpu_cycles + 10).sum::<u64>());
+    }
+
+    #[test]
+    fn test_driver_discrete_event_engine_demand_paging_drains_disk() {
+        let driver = run_generated_workload("discrete_event_demand_paging", DriverConfig {
+            engine: Engine::DiscreteEvent,
+            cpu_count: 4,
+            memory: MemoryConfig { demand_paging: true, ..MemoryConfig::default() },
+            ..DriverConfig::default()
+        });
+
+        // A process back from a page fault queues behind the others again, and that wait counts too.
+        let requeued_waits = (1..=200).map(|process_id| driver.get_metrics().snapshot(process_id))
+            .filter(|job| job.page_faults > 0 && job.wait_time() > job.dispatched_at - job.ready_at)
+            .count();
+        assert!(requeued_waits > 0);
+    }
+
+    #[test]
+    fn test_driver_page_ins_block_the_faulting_process() {
+        for engine in [Engine::Threaded, Engine::Deterministic, Engine::Async, Engine::DiscreteEvent] {
+            let driver = run_generated_workload("page_in_cycles", DriverConfig {
+                engine,
+                cpu_count: 4,
+                page_in_cycles: 500,
+                memory: MemoryConfig { demand_paging: true, ..MemoryConfig::default() },
+                ..DriverConfig::default()
+            });
+
+            // Each fault keeps its process off the CPUs for as long as the page takes to come in.
+            let snapshots: Vec<_> = (1..=200).map(|process_id| driver.get_metrics().snapshot(process_id)).collect();
+            assert!(snapshots.iter().any(|job| job.page_faults > 0), "{:?}", engine);
+            for job in &snapshots {
+                assert!(job.completed_at - job.ready_at >= job.cpu_cycles + job.page_faults as u64 * 500, "{:?}: {:?}", engine, job);
+            }
+        }
+    }
+
+    #[test]
+    fn test_driver_async_engine_many_cpus_drain_disk() {
+        let driver = run_generated_workload("async_many_cpus", DriverConfig {
+            engine: Engine::Async,
+            cpu_count: 256,
+            memory: MemoryConfig { size: 16384, ..MemoryConfig::default() },
+            ..DriverConfig::default()
+        });
+
+        // Run side by side, the jobs finish well before their cycles add up.
+        let snapshots: Vec<_> = (1..=200).map(|process_id| driver.get_metrics().snapshot(process_id)).collect();
+        let makespan = snapshots.iter().map(|job| job.completed_at).max().unwrap();
+        assert!(makespan < snapshots.iter().map(|job| job.cpu_cycles).sum::<u64>() / 4);
+    }
+
+    #[test]
+    fn test_driver_async_engine_demand_paging_drains_disk() {
+        run_generated_workload("async_demand_paging", DriverConfig {
+            engine: Engine::Async,
+            cpu_count: 4,
+            memory: MemoryConfig { demand_paging: true, ..MemoryConfig::default() },
+            ..DriverConfig::default()
+        });
+    }
+
+    #[test]
+    fn test_driver_lockstep_drains_disk() {
+        run_generated_workload("lockstep", DriverConfig { execution_mode: ExecutionMode::Lockstep, ..DriverConfig::default() });
+    }
+
+    /// Other tests start threads of their own, so run this one alone:
+    /// cargo test --release -- --ignored --exact kernel::driver::tests::test_driver_soak_keeps_thread_count_steady
+    #[test]
+    #[ignore]
+    #[cfg(target_os = "linux")]
+    fn test_driver_soak_keeps_thread_count_steady() {
+        let thread_count = || -> usize {
+            let status = fs::read_to_string("/proc/self/status").unwrap();
+            status.lines().find_map(|line| line.strip_prefix("Threads:")).unwrap().trim().parse().unwrap()
+        };
+
+        let directory = std::env::temp_dir().join(format!("driver_test_soak_{}", std::process::id()));
+        fs::create_dir_all(&directory).unwrap();
+        let program_file_path = directory.join("programs.txt");
+        let workload = WorkloadConfig { seed: 31, job_count: 20, ..WorkloadConfig::default() };
+        generator::generate(&workload, &mut File::create(&program_file_path).unwrap()).unwrap();
+
+        let config = DriverConfig {
+            cpu_count: 4,
+            program_file_path: program_file_path.to_string_lossy().into_owned(),
+            metrics_file_path: directory.join("metrics.csv").to_string_lossy().into_owned(),
+            ..DriverConfig::default()
+        };
+        let before = thread_count();
+
+        // Each simulation starts its dispatchers, drains them and joins them on the way out.
+        for run in 0..10_000 {
+            let mut driver = Driver::with_config(config.clone());
+            assert_eq!(thread_count(), before + 4, "run {}", run);
+
+            driver.start();
+            assert!(driver.get_metrics().snapshot(20).completed_at > 0);
+            drop(driver);
+            assert_eq!(thread_count(), before, "run {}", run);
+        }
+
+        fs::remove_dir_all(&directory).unwrap();
+    }
+}
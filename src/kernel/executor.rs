@@ -0,0 +1,288 @@
+use std::cell::{Cell, RefCell};
+use std::collections::VecDeque;
+use std::future::Future;
+use std::pin::Pin;
+use std::rc::Rc;
+use std::sync::{Arc, Mutex, atomic::{AtomicBool, Ordering as AtomicOrdering}};
+use std::task::{Context, Poll, Wake, Waker};
+
+use super::{Clock, TimingWheel};
+
+type Task<'a> = Pin<Box<dyn Future<Output = ()> + 'a>>;
+
+/// Runs tasks cooperatively on the current thread against a virtual clock. Time only moves once
+/// every task is waiting, and then jumps straight to the earliest timer, so a run costs host time
+/// in proportion to its events rather than to the length of simulated time.
+pub struct Executor<'a> {
+    tasks: Vec<Option<Task<'a>>>,
+    wakers: Vec<Arc<TaskWaker>>,
+    ready: Arc<Mutex<VecDeque<usize>>>,
+    timers: Rc<Timers>,
+}
+
+impl<'a> Executor<'a> {
+    pub fn new(clock: Arc<Clock>) -> Executor<'a> {
+        Executor {
+            tasks: Vec::new(),
+            wakers: Vec::new(),
+            ready: Arc::new(Mutex::new(VecDeque::new())),
+            timers: Rc::new(Timers {
+                clock,
+                wheel: RefCell::new(TimingWheel::new()),
+            }),
+        }
+    }
+
+    /// Lets tasks read the virtual time and sleep.
+    pub fn handle(&self) -> Handle {
+        Handle { timers: self.timers.clone() }
+    }
+
+    /// Adds a task, which first runs once `run` is called.
+    pub fn spawn(&mut self, task: impl Future<Output = ()> + 'a) {
+        let waker = Arc::new(TaskWaker { id: self.tasks.len(), queued: AtomicBool::new(false), ready: self.ready.clone() });
+
+        waker.wake_by_ref();
+        self.tasks.push(Some(Box::pin(task)));
+        self.wakers.push(waker);
+    }
+
+    /// Runs until every task has finished or waits on something no other task will provide.
+    /// Timers that come due together fire in the order they were set.
+    pub fn run(&mut self) {
+        loop {
+            loop {
+                let Some(id) = self.ready.lock().unwrap().pop_front() else { break };
+                self.poll(id);
+            }
+
+            let Some((at, waker)) = self.timers.wheel.borrow_mut().pop() else { break };
+            let clock = &self.timers.clock;
+            clock.advance(at.saturating_sub(clock.now()));
+            waker.wake();
+        }
+    }
+
+    fn poll(&mut self, id: usize) {
+        let Some(task) = self.tasks[id].as_mut() else { return };
+
+        let task_waker = &self.wakers[id];
+        task_waker.queued.store(false, AtomicOrdering::Release);
+        let waker = Waker::from(task_waker.clone());
+
+        if task.as_mut().poll(&mut Context::from_waker(&waker)).is_ready() {
+            self.tasks[id] = None;
+        }
+    }
+}
+
+struct TaskWaker {
+    id: usize,
+    /// Set while the task sits in the ready queue, so repeated wakes queue it once.
+    queued: AtomicBool,
+    ready: Arc<Mutex<VecDeque<usize>>>,
+}
+
+impl Wake for TaskWaker {
+    fn wake(self: Arc<Self>) {
+        self.wake_by_ref();
+    }
+
+    fn wake_by_ref(self: &Arc<Self>) {
+        if !self.queued.swap(true, AtomicOrdering::AcqRel) {
+            self.ready.lock().unwrap().push_back(self.id);
+        }
+    }
+}
+
+struct Timers {
+    clock: Arc<Clock>,
+    wheel: RefCell<TimingWheel<Waker>>,
+}
+
+#[derive(Clone)]
+pub struct Handle {
+    timers: Rc<Timers>,
+}
+
+impl Handle {
+    pub fn now(&self) -> u64 {
+        self.timers.clock.now()
+    }
+
+    /// Completes once `cycles` of virtual time have passed.
+    pub fn sleep(&self, cycles: u64) -> Sleep {
+        Sleep { timers: self.timers.clone(), at: self.now() + cycles, set: false }
+    }
+}
+
+pub struct Sleep {
+    timers: Rc<Timers>,
+    at: u64,
+    set: bool,
+}
+
+impl Future for Sleep {
+    type Output = ();
+
+    fn poll(self: Pin<&mut Self>, cx: &mut Context<'_>) -> Poll<()> {
+        let sleep = self.get_mut();
+        if sleep.timers.clock.now() >= sleep.at {
+            return Poll::Ready(());
+        }
+
+        if !sleep.set {
+            sleep.timers.wheel.borrow_mut().schedule(sleep.at, cx.waker().clone());
+            sleep.set = true;
+        }
+
+        Poll::Pending
+    }
+}
+
+/// Wakes tasks waiting for something to happen, in the order they started waiting. A notification
+/// with nobody waiting is dropped, which suits tasks that check their condition right before
+/// waiting on it: nothing else runs in between.
+pub struct Notify {
+    waiters: RefCell<VecDeque<(Rc<Cell<bool>>, Waker)>>,
+}
+
+impl Notify {
+    pub fn new() -> Notify {
+        Notify {
+            waiters: RefCell::new(VecDeque::new()),
+        }
+    }
+
+    pub fn notified(&self) -> Notified<'_> {
+        Notified { notify: self, notified: None }
+    }
+
+    /// Wakes the task that has waited longest. Returns false if no task was waiting.
+    pub fn notify_one(&self) -> bool {
+        let Some((notified, waker)) = self.waiters.borrow_mut().pop_front() else { return false };
+
+        notified.set(true);
+        waker.wake();
+        true
+    }
+}
+
+pub struct Notified<'a> {
+    notify: &'a Notify,
+    notified: Option<Rc<Cell<bool>>>,
+}
+
+impl Future for Notified<'_> {
+    type Output = ();
+
+    fn poll(self: Pin<&mut Self>, cx: &mut Context<'_>) -> Poll<()> {
+        let waiter = self.get_mut();
+
+        match &waiter.notified {
+            Some(notified) if notified.get() => Poll::Ready(()),
+            Some(_) => Poll::Pending,
+            None => {
+                let notified = Rc::new(Cell::new(false));
+                waiter.notify.waiters.borrow_mut().push_back((notified.clone(), cx.waker().clone()));
+                waiter.notified = Some(notified);
+
+                Poll::Pending
+            }
+        }
+    }
+}
+
+/// An unbounded queue from any number of tasks to one receiving task.
+pub struct Channel<T> {
+    queue: RefCell<VecDeque<T>>,
+    receiver: Notify,
+}
+
+impl<T> Channel<T> {
+    pub fn new() -> Channel<T> {
+        Channel {
+            queue: RefCell::new(VecDeque::new()),
+            receiver: Notify::new(),
+        }
+    }
+
+    pub fn send(&self, value: T) {
+        self.queue.borrow_mut().push_back(value);
+        self.receiver.notify_one();
+    }
+
+    pub async fn recv(&self) -> T {
+        loop {
+            if let Some(value) = self.queue.borrow_mut().pop_front() {
+                return value;
+            }
+
+            self.receiver.notified().await;
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_executor_advances_virtual_time_by_event() {
+        let clock = Arc::new(Clock::new());
+        let events = RefCell::new(Vec::new());
+        let mut executor = Executor::new(clock.clone());
+
+        for (name, period) in [("a", 3), ("b", 5)] {
+            let handle = executor.handle();
+            let events = &events;
+
+            executor.spawn(async move {
+                for _ in 0..3 {
+                    handle.sleep(period).await;
+                    events.borrow_mut().push((handle.now(), name));
+                }
+            });
+        }
+
+        executor.run();
+        drop(executor);
+
+        assert_eq!(events.into_inner(), vec![(3, "a"), (5, "b"), (6, "a"), (9, "a"), (10, "b"), (15, "b")]);
+        assert_eq!(clock.now(), 15);
+    }
+
+    #[test]
+    fn test_executor_channel_and_notify() {
+        let clock = Arc::new(Clock::new());
+        let channel = Channel::new();
+        let idle = Notify::new();
+        let received = RefCell::new(Vec::new());
+        let mut executor = Executor::new(clock);
+        let handle = executor.handle();
+        let (channel, idle) = (&channel, &idle);
+
+        executor.spawn(async {
+            for _ in 0..3 {
+                received.borrow_mut().push(channel.recv().await);
+            }
+            idle.notify_one();
+        });
+        executor.spawn(async move {
+            channel.send(1);
+            channel.send(2);
+            handle.sleep(4).await;
+            channel.send(3);
+            idle.notified().await;
+            channel.send(4);
+        });
+
+        executor.run();
+        drop(executor);
+
+        // Nobody receives the last value, and nobody is left waiting to be notified.
+        assert_eq!(received.into_inner(), vec![1, 2, 3]);
+        assert_eq!(channel.queue.borrow().iter().collect::<Vec<_>>(), vec![&4]);
+        assert!(!idle.notify_one());
+    }
+}
@@ -0,0 +1,556 @@
+use std::collections::BTreeMap;
+use std::io::{self, Write};
+use std::sync::{Arc, Mutex, OnceLock, atomic::{AtomicU64, Ordering}};
+use std::thread;
+use std::time::Duration;
+
+/// Counts events per thread.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum Counter {
+    DiskReads,
+    DiskReadWords,
+    DiskWrites,
+    DiskWriteWords,
+    MemoryReadWords,
+    MemoryWriteWords,
+    /// Accesses that found a bank of `Memory::data` locked against them.
+    MemoryLockWaits,
+    MemoryLockWaitNanos,
+}
+
+const COUNTER_COUNT: usize = 8;
+
+impl Counter {
+    pub const ALL: [Counter; COUNTER_COUNT] = [
+        Counter::DiskReads, Counter::DiskReadWords, Counter::DiskWrites, Counter::DiskWriteWords,
+        Counter::MemoryReadWords, Counter::MemoryWriteWords, Counter::MemoryLockWaits, Counter::MemoryLockWaitNanos,
+    ];
+
+    pub fn name(self) -> &'static str {
+        match self {
+            Counter::DiskReads => "disk_reads",
+            Counter::DiskReadWords => "disk_read_words",
+            Counter::DiskWrites => "disk_writes",
+            Counter::DiskWriteWords => "disk_write_words",
+            Counter::MemoryReadWords => "memory_read_words",
+            Counter::MemoryWriteWords => "memory_write_words",
+            Counter::MemoryLockWaits => "memory_lock_waits",
+            Counter::MemoryLockWaitNanos => "memory_lock_wait_nanoseconds",
+        }
+    }
+}
+
+/// Records how values are distributed, in HDR histograms.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum Distribution {
+    /// Nanoseconds from a process becoming ready to an idle CPU taking it.
+    DispatchLatency,
+    /// Processes in the short term scheduler's queue after each scheduling.
+    ReadyQueueDepth,
+    /// Nanoseconds spent waiting for a locked bank of `Memory::data`.
+    MemoryLockWait,
+}
+
+const DISTRIBUTION_COUNT: usize = 3;
+
+impl Distribution {
+    pub const ALL: [Distribution; DISTRIBUTION_COUNT] = [Distribution::DispatchLatency, Distribution::ReadyQueueDepth, Distribution::MemoryLockWait];
+
+    pub fn name(self) -> &'static str {
+        match self {
+            Distribution::DispatchLatency => "dispatch_latency_nanoseconds",
+            Distribution::ReadyQueueDepth => "ready_queue_depth",
+            Distribution::MemoryLockWait => "memory_lock_wait_nanoseconds",
+        }
+    }
+}
+
+/// CPUs numbered from here on are not counted.
+pub const MAX_CPUS: usize = 1024;
+
+/// Each power of two is split into 2^SUB_BITS buckets, so a bucket is at most 1/32 of its values
+/// wide.
+const SUB_BITS: u32 = 5;
+const SUB_BUCKETS: usize = 1 << SUB_BITS;
+/// Larger values are counted in the last bucket. 2^40 nanoseconds is about 18 minutes.
+const VALUE_BITS: u32 = 40;
+const BUCKET_COUNT: usize = (VALUE_BITS - SUB_BITS + 1) as usize * SUB_BUCKETS;
+
+fn bucket_of(value: u64) -> usize {
+    let value = value.min((1 << VALUE_BITS) - 1);
+    if value < SUB_BUCKETS as u64 {
+        return value as usize;
+    }
+
+    let shift = u64::BITS - 1 - value.leading_zeros() - SUB_BITS;
+    (shift as usize + 1) * SUB_BUCKETS + (value >> shift) as usize - SUB_BUCKETS
+}
+
+fn lowest_value_in(bucket: usize) -> u64 {
+    if bucket < SUB_BUCKETS {
+        return bucket as u64;
+    }
+
+    ((bucket % SUB_BUCKETS + SUB_BUCKETS) as u64) << (bucket / SUB_BUCKETS - 1)
+}
+
+fn highest_value_in(bucket: usize) -> u64 {
+    lowest_value_in(bucket + 1) - 1
+}
+
+/// Only its thread writes to a shard, so updates are plain loads and stores with no read-modify-
+/// write, and snapshots read the atomics from other threads.
+fn bump(counter: &AtomicU64, value: u64) {
+    counter.store(counter.load(Ordering::Relaxed).wrapping_add(value), Ordering::Relaxed);
+}
+
+struct Buckets {
+    counts: Box<[AtomicU64]>,
+    sum: AtomicU64,
+    max: AtomicU64,
+}
+
+impl Buckets {
+    fn new() -> Buckets {
+        Buckets {
+            counts: (0..BUCKET_COUNT).map(|_| AtomicU64::new(0)).collect(),
+            sum: AtomicU64::new(0),
+            max: AtomicU64::new(0),
+        }
+    }
+
+    fn record(&self, value: u64) {
+        bump(&self.counts[bucket_of(value)], 1);
+        bump(&self.sum, value);
+        if value > self.max.load(Ordering::Relaxed) {
+            self.max.store(value, Ordering::Relaxed);
+        }
+    }
+}
+
+/// Counters on cache lines of their own, so a thread bumping them never shares a line with
+/// another thread's.
+#[repr(align(64))]
+struct Counters([AtomicU64; COUNTER_COUNT]);
+
+/// The instrumentation of one thread. Histograms and CPU counts are allocated on first use, as
+/// most threads never record them.
+struct Shard {
+    counters: Counters,
+    label: String,
+    histograms: [OnceLock<Buckets>; DISTRIBUTION_COUNT],
+    /// Instructions and cycles of each CPU, interleaved.
+    cpus: OnceLock<Box<[AtomicU64]>>,
+}
+
+impl Shard {
+    fn new(label: String) -> Shard {
+        Shard {
+            counters: Counters(std::array::from_fn(|_| AtomicU64::new(0))),
+            label,
+            histograms: std::array::from_fn(|_| OnceLock::new()),
+            cpus: OnceLock::new(),
+        }
+    }
+}
+
+/// Registers a shard when its thread first records, and folds it into the retired totals when
+/// the thread exits, so short lived threads do not pile up shards.
+struct ShardHandle(Arc<Shard>);
+
+impl ShardHandle {
+    fn register() -> ShardHandle {
+        let label = thread::current().name().unwrap_or("unnamed").to_string();
+        let shard = Arc::new(Shard::new(label));
+
+        REGISTRY.lock().unwrap().live.push(shard.clone());
+        ShardHandle(shard)
+    }
+}
+
+impl Drop for ShardHandle {
+    fn drop(&mut self) {
+        let mut registry = REGISTRY.lock().unwrap();
+        registry.live.retain(|shard| !Arc::ptr_eq(shard, &self.0));
+        registry.retired.add(&self.0);
+    }
+}
+
+struct Registry {
+    live: Vec<Arc<Shard>>,
+    retired: Snapshot,
+}
+
+static REGISTRY: Mutex<Registry> = Mutex::new(Registry { live: Vec::new(), retired: Snapshot::new() });
+
+thread_local! {
+    static SHARD: ShardHandle = ShardHandle::register();
+}
+
+/// Runs `record` on this thread's shard. Records made while the thread is exiting are dropped.
+fn with_shard(record: impl FnOnce(&Shard)) {
+    let _ = SHARD.try_with(|handle| record(&handle.0));
+}
+
+pub fn add(counter: Counter, value: u64) {
+    with_shard(|shard| bump(&shard.counters.0[counter as usize], value));
+}
+
+pub fn record(distribution: Distribution, value: u64) {
+    with_shard(|shard| shard.histograms[distribution as usize].get_or_init(Buckets::new).record(value));
+}
+
+/// Counts a wait for a bank of `Memory::data`.
+pub fn record_lock_wait(wait: Duration) {
+    let nanos = wait.as_nanos() as u64;
+
+    with_shard(|shard| {
+        bump(&shard.counters.0[Counter::MemoryLockWaits as usize], 1);
+        bump(&shard.counters.0[Counter::MemoryLockWaitNanos as usize], nanos);
+        shard.histograms[Distribution::MemoryLockWait as usize].get_or_init(Buckets::new).record(nanos);
+    });
+}
+
+/// Counts work done on a simulated CPU. Cycles include any the CPU spent switching contexts.
+pub fn record_cpu(cpu: usize, instructions: u64, cycles: u64) {
+    if cpu >= MAX_CPUS {
+        return;
+    }
+
+    with_shard(|shard| {
+        let cpus = shard.cpus.get_or_init(|| (0..2 * MAX_CPUS).map(|_| AtomicU64::new(0)).collect());
+        bump(&cpus[2 * cpu], instructions);
+        bump(&cpus[2 * cpu + 1], cycles);
+    });
+}
+
+/// Adds up every thread's instrumentation, including that of threads which have exited.
+pub fn snapshot() -> Snapshot {
+    let registry = REGISTRY.lock().unwrap();
+
+    let mut snapshot = registry.retired.clone();
+    for shard in &registry.live {
+        snapshot.add(shard);
+    }
+
+    snapshot
+}
+
+#[derive(Clone, Debug, Default, PartialEq, Eq)]
+pub struct HistogramSnapshot {
+    /// Empty until a value is recorded, then one count per bucket.
+    counts: Vec<u64>,
+    count: u64,
+    sum: u64,
+    max: u64,
+}
+
+impl HistogramSnapshot {
+    const fn new() -> HistogramSnapshot {
+        HistogramSnapshot { counts: Vec::new(), count: 0, sum: 0, max: 0 }
+    }
+
+    fn add(&mut self, buckets: &Buckets) {
+        if self.counts.is_empty() {
+            self.counts = vec![0; BUCKET_COUNT];
+        }
+
+        for (total, count) in self.counts.iter_mut().zip(buckets.counts.iter()) {
+            let count = count.load(Ordering::Relaxed);
+            *total += count;
+            self.count += count;
+        }
+        self.sum += buckets.sum.load(Ordering::Relaxed);
+        self.max = self.max.max(buckets.max.load(Ordering::Relaxed));
+    }
+
+    pub fn get_count(&self) -> u64 {
+        self.count
+    }
+
+    pub fn get_sum(&self) -> u64 {
+        self.sum
+    }
+
+    pub fn get_max(&self) -> u64 {
+        self.max
+    }
+
+    /// The value below which `percentile` percent of values fall, to within the width of its
+    /// bucket. Zero if nothing was recorded.
+    pub fn get_value_at(&self, percentile: f64) -> u64 {
+        let rank = ((percentile / 100.0 * self.count as f64).ceil() as u64).clamp(1, self.count.max(1));
+
+        let mut seen = 0;
+        for (bucket, &count) in self.counts.iter().enumerate() {
+            seen += count;
+            if seen >= rank {
+                return highest_value_in(bucket).min(self.max);
+            }
+        }
+
+        0
+    }
+
+    /// Upper bounds of the buckets holding values, each with the number of values up to it.
+    fn cumulative_buckets(&self) -> impl Iterator<Item = (u64, u64)> + '_ {
+        let mut seen = 0;
+        self.counts.iter().enumerate().filter(|(_, &count)| count > 0).map(move |(bucket, &count)| {
+            seen += count;
+            (highest_value_in(bucket), seen)
+        })
+    }
+}
+
+/// Instrumentation added up over every thread at one point in time.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct Snapshot {
+    /// Counters of the threads with each label. Threads sharing a name share a label.
+    threads: BTreeMap<String, [u64; COUNTER_COUNT]>,
+    histograms: [HistogramSnapshot; DISTRIBUTION_COUNT],
+    /// Instructions and cycles of each CPU, up to the last CPU that did any work.
+    cpus: Vec<(u64, u64)>,
+}
+
+impl Snapshot {
+    const fn new() -> Snapshot {
+        Snapshot {
+            threads: BTreeMap::new(),
+            histograms: [const { HistogramSnapshot::new() }; DISTRIBUTION_COUNT],
+            cpus: Vec::new(),
+        }
+    }
+
+    fn add(&mut self, shard: &Shard) {
+        let totals = self.threads.entry(shard.label.clone()).or_insert([0; COUNTER_COUNT]);
+        for (total, counter) in totals.iter_mut().zip(&shard.counters.0) {
+            *total += counter.load(Ordering::Relaxed);
+        }
+
+        for (histogram, buckets) in self.histograms.iter_mut().zip(&shard.histograms) {
+            if let Some(buckets) = buckets.get() {
+                histogram.add(buckets);
+            }
+        }
+
+        if let Some(cpus) = shard.cpus.get() {
+            let counts: Vec<_> = cpus.chunks(2).map(|cpu| (cpu[0].load(Ordering::Relaxed), cpu[1].load(Ordering::Relaxed))).collect();
+            let len = counts.iter().rposition(|&counts| counts != (0, 0)).map_or(0, |cpu| cpu + 1);
+
+            if self.cpus.len() < len {
+                self.cpus.resize(len, (0, 0));
+            }
+            for (total, counts) in self.cpus.iter_mut().zip(&counts[..len]) {
+                *total = (total.0 + counts.0, total.1 + counts.1);
+            }
+        }
+    }
+
+    pub fn get_counter(&self, counter: Counter) -> u64 {
+        self.threads.values().map(|counters| counters[counter as usize]).sum()
+    }
+
+    /// A counter of the threads named `label`.
+    pub fn get_thread_counter(&self, label: &str, counter: Counter) -> u64 {
+        self.threads.get(label).map_or(0, |counters| counters[counter as usize])
+    }
+
+    pub fn get_histogram(&self, distribution: Distribution) -> &HistogramSnapshot {
+        &self.histograms[distribution as usize]
+    }
+
+    /// Instructions and cycles of a CPU.
+    pub fn get_cpu(&self, cpu: usize) -> (u64, u64) {
+        self.cpus.get(cpu).copied().unwrap_or((0, 0))
+    }
+
+    pub fn write_json<W: Write>(&self, writer: &mut W) -> io::Result<()> {
+        writeln!(writer, "{{")?;
+
+        writeln!(writer, "  \"counters\": {{")?;
+        for (idx, counter) in Counter::ALL.into_iter().enumerate() {
+            let threads: Vec<_> = self.threads.iter()
+                .map(|(label, counters)| format!("\"{}\": {}", escape_json(label), counters[counter as usize]))
+                .collect();
+            writeln!(writer, "    \"{}\": {{\"total\": {}, \"threads\": {{{}}}}}{}",
+                     counter.name(), self.get_counter(counter), threads.join(", "), separator(idx, COUNTER_COUNT))?;
+        }
+        writeln!(writer, "  }},")?;
+
+        writeln!(writer, "  \"histograms\": {{")?;
+        for (idx, distribution) in Distribution::ALL.into_iter().enumerate() {
+            let histogram = self.get_histogram(distribution);
+            let buckets: Vec<_> = histogram.cumulative_buckets().map(|(le, count)| format!("[{}, {}]", le, count)).collect();
+            writeln!(writer, "    \"{}\": {{\"count\": {}, \"sum\": {}, \"max\": {}, \"p50\": {}, \"p90\": {}, \"p99\": {}, \"p999\": {}, \"buckets\": [{}]}}{}",
+                     distribution.name(), histogram.count, histogram.sum, histogram.max,
+                     histogram.get_value_at(50.0), histogram.get_value_at(90.0), histogram.get_value_at(99.0), histogram.get_value_at(99.9),
+                     buckets.join(", "), separator(idx, DISTRIBUTION_COUNT))?;
+        }
+        writeln!(writer, "  }},")?;
+
+        writeln!(writer, "  \"cpus\": [")?;
+        for (cpu, &(instructions, cycles)) in self.cpus.iter().enumerate() {
+            writeln!(writer, "    {{\"cpu\": {}, \"instructions\": {}, \"cycles\": {}}}{}", cpu, instructions, cycles, separator(cpu, self.cpus.len()))?;
+        }
+        writeln!(writer, "  ]")?;
+
+        writeln!(writer, "}}")
+    }
+
+    /// Writes the Prometheus text exposition format, for the node exporter's textfile collector
+    /// among others.
+    pub fn write_prometheus<W: Write>(&self, writer: &mut W) -> io::Result<()> {
+        for counter in Counter::ALL {
+            let name = format!("os_simulator_{}_total", counter.name());
+            writeln!(writer, "# TYPE {} counter", name)?;
+            for (label, counters) in &self.threads {
+                writeln!(writer, "{}{{thread=\"{}\"}} {}", name, escape_json(label), counters[counter as usize])?;
+            }
+        }
+
+        for distribution in Distribution::ALL {
+            let name = format!("os_simulator_{}", distribution.name());
+            let histogram = self.get_histogram(distribution);
+
+            writeln!(writer, "# TYPE {} histogram", name)?;
+            for (le, count) in histogram.cumulative_buckets() {
+                writeln!(writer, "{}_bucket{{le=\"{}\"}} {}", name, le, count)?;
+            }
+            writeln!(writer, "{}_bucket{{le=\"+Inf\"}} {}", name, histogram.count)?;
+            writeln!(writer, "{}_sum {}", name, histogram.sum)?;
+            writeln!(writer, "{}_count {}", name, histogram.count)?;
+        }
+
+        for (name, field) in [("instructions", 0), ("cycles", 1)] {
+            writeln!(writer, "# TYPE os_simulator_cpu_{}_total counter", name)?;
+            for (cpu, counts) in self.cpus.iter().enumerate() {
+                writeln!(writer, "os_simulator_cpu_{}_total{{cpu=\"{}\"}} {}", name, cpu, if field == 0 { counts.0 } else { counts.1 })?;
+            }
+        }
+
+        Ok(())
+    }
+}
+
+fn separator(idx: usize, len: usize) -> &'static str {
+    if idx + 1 < len { "," } else { "" }
+}
+
+/// Escapes a label for a JSON string or a Prometheus label value, which escape the same way.
+fn escape_json(label: &str) -> String {
+    let mut escaped = String::with_capacity(label.len());
+    for c in label.chars() {
+        match c {
+            '"' => escaped.push_str("\\\""),
+            '\\' => escaped.push_str("\\\\"),
+            '\n' => escaped.push_str("\\n"),
+            _ => escaped.push(c),
+        }
+    }
+
+    escaped
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// Runs `record` on a thread of its own, so the counts are not mixed with other tests'.
+    fn record_on_thread(label: &str, record: impl FnOnce() + Send + 'static) {
+        thread::Builder::new().name(label.to_string()).spawn(record).unwrap().join().unwrap();
+    }
+
+    #[test]
+    fn test_histogram_buckets() {
+        for value in [0, 1, 31, 32, 33, 63, 64, 65, 1000, 123_456_789, (1 << VALUE_BITS) - 1] {
+            let bucket = bucket_of(value);
+            assert!(lowest_value_in(bucket) <= value && value <= highest_value_in(bucket), "{} in bucket {}", value, bucket);
+            assert!(highest_value_in(bucket) - lowest_value_in(bucket) <= value / SUB_BUCKETS as u64);
+        }
+
+        assert_eq!(bucket_of(u64::MAX), BUCKET_COUNT - 1);
+        assert_eq!(highest_value_in(BUCKET_COUNT - 1), (1 << VALUE_BITS) - 1);
+
+        let buckets = Buckets::new();
+        (1..=1000).for_each(|value| buckets.record(value));
+
+        let mut histogram = HistogramSnapshot::new();
+        histogram.add(&buckets);
+
+        assert_eq!((histogram.get_count(), histogram.get_sum(), histogram.get_max()), (1000, 500_500, 1000));
+        assert_eq!(histogram.get_value_at(0.0), 1);
+        assert!((496..=516).contains(&histogram.get_value_at(50.0)));
+        assert!((990..=1000).contains(&histogram.get_value_at(99.0)));
+        assert_eq!(histogram.get_value_at(100.0), 1000);
+        assert_eq!(HistogramSnapshot::new().get_value_at(50.0), 0);
+    }
+
+    #[test]
+    fn test_counters_survive_their_thread() {
+        record_on_thread("test-counters-retired", || {
+            add(Counter::DiskReads, 2);
+            add(Counter::DiskReadWords, 40);
+        });
+        record_on_thread("test-counters-retired", || add(Counter::DiskReads, 1));
+
+        let snapshot = snapshot();
+        assert_eq!(snapshot.get_thread_counter("test-counters-retired", Counter::DiskReads), 3);
+        assert_eq!(snapshot.get_thread_counter("test-counters-retired", Counter::DiskReadWords), 40);
+        assert_eq!(snapshot.get_thread_counter("test-counters-retired", Counter::DiskWrites), 0);
+        assert!(snapshot.get_counter(Counter::DiskReads) >= 3);
+    }
+
+    #[test]
+    fn test_snapshot_reads_live_threads() {
+        let (recorded_sender, recorded) = std::sync::mpsc::channel();
+        let (done, done_receiver) = std::sync::mpsc::channel::<()>();
+
+        let worker = thread::Builder::new().name("test-counters-live".to_string()).spawn(move || {
+            add(Counter::MemoryWriteWords, 7);
+            record_cpu(MAX_CPUS - 1, 5, 9);
+            record_cpu(MAX_CPUS, 1, 1);
+            recorded_sender.send(()).unwrap();
+            done_receiver.recv().unwrap();
+        }).unwrap();
+
+        recorded.recv().unwrap();
+        let snapshot = snapshot();
+        done.send(()).unwrap();
+        worker.join().unwrap();
+
+        assert_eq!(snapshot.get_thread_counter("test-counters-live", Counter::MemoryWriteWords), 7);
+        assert_eq!(snapshot.get_cpu(MAX_CPUS - 1), (5, 9));
+        assert_eq!(snapshot.get_cpu(MAX_CPUS), (0, 0));
+    }
+
+    #[test]
+    fn test_snapshot_exports() {
+        let before = snapshot();
+        record_on_thread("test \"exports\"", || {
+            add(Counter::MemoryLockWaits, 1);
+            record(Distribution::ReadyQueueDepth, 3);
+        });
+
+        // Other tests record into the global histograms concurrently, so only a lower bound holds.
+        let snapshot = snapshot();
+        assert!(snapshot.get_histogram(Distribution::ReadyQueueDepth).get_count()
+                >= before.get_histogram(Distribution::ReadyQueueDepth).get_count() + 1);
+
+        let mut json = Vec::new();
+        snapshot.write_json(&mut json).unwrap();
+        let json = String::from_utf8(json).unwrap();
+
+        assert!(json.contains("\"test \\\"exports\\\"\": 1"));
+        assert!(json.contains("\"ready_queue_depth\": {\"count\": "));
+        assert_eq!(json.matches('{').count(), json.matches('}').count());
+        assert_eq!(json.matches('[').count(), json.matches(']').count());
+
+        let mut prometheus = Vec::new();
+        snapshot.write_prometheus(&mut prometheus).unwrap();
+        let prometheus = String::from_utf8(prometheus).unwrap();
+
+        assert!(prometheus.contains("os_simulator_memory_lock_waits_total{thread=\"test \\\"exports\\\"\"} 1\n"));
+        assert!(prometheus.contains("# TYPE os_simulator_ready_queue_depth histogram\n"));
+        assert!(prometheus.contains("os_simulator_ready_queue_depth_bucket{le=\"3\"} "));
+    }
+}
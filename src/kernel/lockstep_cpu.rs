@@ -0,0 +1,349 @@
+use std::collections::HashMap;
+use std::sync::Arc;
+
+use super::{Memory, ProcessControlBlock};
+use super::instrumentation;
+use super::cpu::{self, ExecutionStats, Instruction, Opcode, REGISTER_COUNT, WORD_SIZE};
+use super::paging::Access;
+
+/// Number of processes run side by side. Eight 32-bit lanes fill one 256-bit vector register.
+pub const LANES: usize = 8;
+
+type Mask = [bool; LANES];
+type LaneRegister = [u32; LANES];
+
+/// Runs processes that share an instruction buffer in lockstep. Each instruction is fetched and
+/// decoded once and applied to every lane whose program counter points at it. Lanes that branch
+/// apart are stepped separately, lowest program counter first, so they reconverge at loop exits.
+pub struct LockstepCPU {
+    registers: [LaneRegister; REGISTER_COUNT],
+    program_counters: [usize; LANES],
+    active: Mask,
+    results: [Result<(), &'static str>; LANES],
+    stats: [ExecutionStats; LANES],
+    lane_count: usize,
+    issued_cycles: u64,
+}
+
+impl LockstepCPU {
+    pub fn new() -> LockstepCPU {
+        LockstepCPU {
+            registers: [[0; LANES]; REGISTER_COUNT],
+            program_counters: [0; LANES],
+            active: [false; LANES],
+            results: [Ok(()); LANES],
+            stats: [ExecutionStats::default(); LANES],
+            lane_count: 0,
+            issued_cycles: 0,
+        }
+    }
+
+    /// Runs up to `LANES` processes with identical instructions until each halts or faults.
+    /// Results are returned in the same order as `pcbs`.
+    pub fn execute(&mut self, pcbs: &[Arc<ProcessControlBlock>], memory: &Memory) -> Vec<Result<(), &'static str>> {
+        if pcbs.is_empty() || pcbs.len() > LANES {
+            panic!("Lockstep batch must contain between 1 and {} processes", LANES);
+        }
+
+        self.registers = [[0; LANES]; REGISTER_COUNT];
+        self.active = [false; LANES];
+        self.results = [Ok(()); LANES];
+        self.stats = [ExecutionStats::default(); LANES];
+        self.lane_count = pcbs.len();
+        self.issued_cycles = 0;
+
+        for (lane, pcb) in pcbs.iter().enumerate() {
+            self.active[lane] = true;
+            self.program_counters[lane] = pcb.program_counter;
+        }
+
+        while let Some(program_counter) = self.lowest_program_counter() {
+            let mut mask = [false; LANES];
+            for lane in 0..LANES {
+                mask[lane] = self.active[lane] && self.program_counters[lane] == program_counter;
+            }
+
+            let leader = mask.iter().position(|&in_mask| in_mask).unwrap();
+
+            match cpu::fetch(&pcbs[leader], memory, program_counter) {
+                Ok(instruction) => self.step(instruction, mask, pcbs, memory),
+                Err(err) => lanes(mask).for_each(|lane| self.fault(lane, err)),
+            }
+        }
+
+        // Counted as CPU 0, the only CPU of the lockstep mode.
+        let instructions = self.get_stats().iter().map(|stats| stats.cycles).sum();
+        instrumentation::record_cpu(0, instructions, self.issued_cycles);
+
+        self.results[..pcbs.len()].to_vec()
+    }
+
+    /// Per process stats of the most recent `execute` call, in the same order as its `pcbs`.
+    pub fn get_stats(&self) -> &[ExecutionStats] {
+        &self.stats[..self.lane_count]
+    }
+
+    /// Number of instructions issued by the most recent `execute` call. Every issue steps all
+    /// lanes in its mask at once, so this is the time the whole batch took.
+    pub fn get_issued_cycles(&self) -> u64 {
+        self.issued_cycles
+    }
+
+    fn lowest_program_counter(&self) -> Option<usize> {
+        lanes(self.active).map(|lane| self.program_counters[lane]).min()
+    }
+
+    fn fault(&mut self, lane: usize, err: &'static str) {
+        self.active[lane] = false;
+        self.results[lane] = Err(err);
+    }
+
+    /// Executes one instruction on every lane in the mask.
+    fn step(&mut self, instruction: Instruction, mut mask: Mask, pcbs: &[Arc<ProcessControlBlock>], memory: &Memory) {
+        use Opcode::*;
+
+        let Instruction { opcode, reg_1, reg_2, reg_3, address } = instruction;
+        let immediate = [address as u32; LANES];
+        let target = address / WORD_SIZE;
+
+        let mut next_program_counters = self.program_counters;
+        for lane in lanes(mask) {
+            next_program_counters[lane] += 1;
+            self.stats[lane].cycles += 1;
+            if opcode == Rd || opcode == Wr {
+                self.stats[lane].io_operations += 1;
+            }
+        }
+        self.issued_cycles += 1;
+
+        match opcode {
+            Rd | Wr | St | Lw => {
+                for lane in lanes(mask) {
+                    if let Err(err) = self.access_memory(lane, instruction, &pcbs[lane], memory) {
+                        self.fault(lane, err);
+                    }
+                }
+            }
+            Mov => {
+                let source = self.registers[reg_2];
+                select(mask, &mut self.registers[reg_1], source);
+            }
+            Add => self.alu(mask, reg_3, self.registers[reg_1], self.registers[reg_2], u32::wrapping_add),
+            Sub => self.alu(mask, reg_3, self.registers[reg_1], self.registers[reg_2], u32::wrapping_sub),
+            Mul => self.alu(mask, reg_3, self.registers[reg_1], self.registers[reg_2], u32::wrapping_mul),
+            Div => {
+                self.fault_on_zero(&mut mask, self.registers[reg_2]);
+                self.alu(mask, reg_3, self.registers[reg_1], self.registers[reg_2], |a, b| a.checked_div(b).unwrap_or(0));
+            }
+            And => self.alu(mask, reg_3, self.registers[reg_1], self.registers[reg_2], |a, b| a & b),
+            Or => self.alu(mask, reg_3, self.registers[reg_1], self.registers[reg_2], |a, b| a | b),
+            Movi | Ldi => select(mask, &mut self.registers[reg_2], immediate),
+            Addi => self.alu(mask, reg_2, self.registers[reg_2], immediate, u32::wrapping_add),
+            Muli => self.alu(mask, reg_2, self.registers[reg_2], immediate, u32::wrapping_mul),
+            Divi => {
+                self.fault_on_zero(&mut mask, immediate);
+                self.alu(mask, reg_2, self.registers[reg_2], immediate, |a, b| a.checked_div(b).unwrap_or(0));
+            }
+            Slt => self.alu(mask, reg_3, self.registers[reg_1], self.registers[reg_2], |a, b| ((a as i32) < (b as i32)) as u32),
+            Slti => self.alu(mask, reg_2, self.registers[reg_1], immediate, |a, b| ((a as i32) < (b as i32)) as u32),
+            Hlt => lanes(mask).for_each(|lane| self.active[lane] = false),
+            Nop => {}
+            Jmp => lanes(mask).for_each(|lane| next_program_counters[lane] = target),
+            Beq | Bne | Bez | Bnz | Bgz | Blz => {
+                for lane in lanes(mask) {
+                    if cpu::branch_taken(opcode, self.registers[reg_1][lane], self.registers[reg_2][lane]) {
+                        next_program_counters[lane] = target;
+                    }
+                }
+            }
+        }
+
+        self.program_counters = next_program_counters;
+    }
+
+    fn access_memory(&mut self, lane: usize, instruction: Instruction, pcb: &ProcessControlBlock, memory: &Memory) -> Result<(), &'static str> {
+        let Instruction { opcode, reg_1, reg_2, address, .. } = instruction;
+        let registers = &mut self.registers;
+
+        match opcode {
+            Opcode::Rd => {
+                let source = if address != 0 { address } else { registers[reg_2][lane] as usize };
+                registers[reg_1][lane] = memory.read_from(cpu::translate(pcb, source, Access::Read)?);
+            }
+            Opcode::Wr => {
+                let destination = if address != 0 { address } else { registers[reg_2][lane] as usize };
+                memory.write_to(cpu::translate(pcb, destination, Access::Write)?, registers[reg_1][lane]);
+            }
+            Opcode::St => memory.write_to(cpu::translate(pcb, registers[reg_2][lane] as usize + address, Access::Write)?, registers[reg_1][lane]),
+            Opcode::Lw => registers[reg_2][lane] = memory.read_from(cpu::translate(pcb, registers[reg_1][lane] as usize + address, Access::Read)?),
+            _ => unreachable!(),
+        }
+
+        Ok(())
+    }
+
+    /// Applies `op` to all lanes and keeps the results for the masked ones. Written branch free
+    /// over whole lane arrays so the compiler can lower it to vector instructions.
+    #[inline(always)]
+    fn alu(&mut self, mask: Mask, destination: usize, a: LaneRegister, b: LaneRegister, op: impl Fn(u32, u32) -> u32) {
+        let mut result = [0; LANES];
+        for lane in 0..LANES {
+            result[lane] = op(a[lane], b[lane]);
+        }
+
+        select(mask, &mut self.registers[destination], result);
+    }
+
+    fn fault_on_zero(&mut self, mask: &mut Mask, divisors: LaneRegister) {
+        for lane in lanes(*mask) {
+            if divisors[lane] == 0 {
+                mask[lane] = false;
+                self.fault(lane, "Division by zero");
+            }
+        }
+    }
+}
+
+fn lanes(mask: Mask) -> impl Iterator<Item = usize> {
+    (0..LANES).filter(move |&lane| mask[lane])
+}
+
+fn select(mask: Mask, destination: &mut LaneRegister, values: LaneRegister) {
+    for lane in 0..LANES {
+        if mask[lane] {
+            destination[lane] = values[lane];
+        }
+    }
+}
+
+/// Groups processes with identical instruction buffers into batches of at most `LANES`,
+/// keeping the order in which each group was first seen.
+pub fn group_by_instructions(pcbs: &[Arc<ProcessControlBlock>], memory: &Memory) -> Vec<Vec<Arc<ProcessControlBlock>>> {
+    let mut group_idx_map: HashMap<Vec<u32>, usize> = HashMap::new();
+    let mut groups: Vec<Vec<Arc<ProcessControlBlock>>> = Vec::new();
+
+    for pcb in pcbs {
+        let start_address = pcb.get_mem_start_address();
+        let instructions = memory.read_block(start_address, start_address + pcb.instruction_buffer_size);
+
+        // Instructions are only copied out of memory for the first process of each group.
+        let group_idx = match group_idx_map.get(&*instructions) {
+            Some(&group_idx) => group_idx,
+            None => {
+                groups.push(Vec::new());
+                group_idx_map.insert(instructions.to_vec(), groups.len() - 1);
+                groups.len() - 1
+            }
+        };
+
+        groups[group_idx].push(pcb.clone());
+    }
+
+    groups.iter()
+        .flat_map(|group| group.chunks(LANES).map(|batch| batch.to_vec()))
+        .collect()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    use crate::io::{Disk, ProgramInfo, loader};
+    use crate::kernel::{CPU, LongTermScheduler};
+
+    // RD r5 <- 0x1C, MOVI r1 0, ADDI r6 1, SLT r6 r5 r8, BNE r8 r1 -> 0x08, WR r6 -> 0x20, HLT
+    const COUNT_TO_INPUT: [u32; 7] = [0xC050001C, 0x4B010000, 0x4C060001, 0x10658000, 0x56810008, 0xC1600020, 0x92000000];
+    // RD r5 <- 0x14, MOVI r6 12, DIV r6 r5 r6, WR r6 -> 0x18, HLT
+    const DIVIDE_BY_INPUT: [u32; 5] = [0xC0500014, 0x4B06000C, 0x08656000, 0xC1600018, 0x92000000];
+
+    fn create_process(memory: &Memory, id: u32, instructions: &[u32], input: u32) -> Arc<ProcessControlBlock> {
+        let program_info = ProgramInfo {
+            id,
+            priority: 1,
+            instruction_buffer_size: instructions.len(),
+            in_buffer_size: 1,
+            out_buffer_size: 1,
+            temp_buffer_size: 0,
+            data_start_idx: 0,
+        };
+        let mut program_data = instructions.to_vec();
+        program_data.extend([input, 0]);
+
+        memory.create_process(&program_info, &program_data);
+        memory.get_pcb_for(id)
+    }
+
+    #[test]
+    fn test_lockstep_cpu_divergent_loop_counts() {
+        let memory = Memory::new();
+        let pcbs: Vec<_> = (1..=3).map(|id| create_process(&memory, id, &COUNT_TO_INPUT, id * 2)).collect();
+
+        let results = LockstepCPU::new().execute(&pcbs, &memory);
+
+        assert_eq!(results, vec![Ok(()); 3]);
+        for (pcb, expected) in pcbs.iter().zip([2, 4, 6]) {
+            assert_eq!(memory.read_from(pcb.get_mem_end_address() - 1), expected);
+        }
+    }
+
+    #[test]
+    fn test_lockstep_cpu_fault_is_isolated_to_lane() {
+        let memory = Memory::new();
+        let pcbs = vec![
+            create_process(&memory, 1, &DIVIDE_BY_INPUT, 3),
+            create_process(&memory, 2, &DIVIDE_BY_INPUT, 0),
+        ];
+
+        let results = LockstepCPU::new().execute(&pcbs, &memory);
+
+        assert_eq!(results, vec![Ok(()), Err("Division by zero")]);
+        assert_eq!(memory.read_from(pcbs[0].get_mem_end_address() - 1), 4);
+    }
+
+    #[test]
+    fn test_group_by_instructions() {
+        let memory = Memory::new();
+        let mut pcbs: Vec<_> = (0..LANES as u32 + 1).map(|id| create_process(&memory, id, &COUNT_TO_INPUT, 1)).collect();
+        pcbs.insert(1, create_process(&memory, 100, &DIVIDE_BY_INPUT, 1));
+
+        let groups = group_by_instructions(&pcbs, &memory);
+
+        let group_ids: Vec<Vec<u32>> = groups.iter().map(|group| group.iter().map(|pcb| pcb.id).collect()).collect();
+        assert_eq!(group_ids, vec![(0..LANES as u32).collect(), vec![LANES as u32], vec![100]]);
+    }
+
+    #[test]
+    fn test_lockstep_cpu_matches_scalar_cpu_on_program_file() {
+        let mut disk = Disk::new();
+        let program_ids = loader::load_programs_into_disk(&mut disk).unwrap();
+
+        let scalar_memory = Memory::new();
+        let lockstep_memory = Memory::new();
+        let mut process_ids = Vec::new();
+        for memory in [&scalar_memory, &lockstep_memory] {
+            let mut lts = LongTermScheduler::new();
+            lts.enqueue_programs(&disk, memory, program_ids.clone());
+            process_ids = lts.batch_step(&mut disk, memory).iter().map(|pcb| pcb.id).collect();
+        }
+
+        let mut cpu = CPU::new();
+        let scalar_pcbs: Vec<_> = process_ids.iter().map(|&id| scalar_memory.get_pcb_for(id)).collect();
+        let scalar_results: Vec<_> = scalar_pcbs.iter().map(|pcb| (cpu.execute(pcb, &scalar_memory), cpu.get_stats())).collect();
+
+        let lockstep_pcbs: Vec<_> = process_ids.iter().map(|&id| lockstep_memory.get_pcb_for(id)).collect();
+        let mut lockstep_cpu = LockstepCPU::new();
+        for batch in group_by_instructions(&lockstep_pcbs, &lockstep_memory) {
+            let results = lockstep_cpu.execute(&batch, &lockstep_memory);
+
+            for ((pcb, result), &stats) in batch.iter().zip(results).zip(lockstep_cpu.get_stats()) {
+                let idx = process_ids.iter().position(|&id| id == pcb.id).unwrap();
+                assert_eq!((result, stats), scalar_results[idx]);
+            }
+        }
+
+        for pcb in scalar_pcbs {
+            assert_eq!(scalar_memory.read_block_from(pcb.get_mem_start_address(), pcb.get_mem_end_address()),
+                       lockstep_memory.read_block_from(pcb.get_mem_start_address(), pcb.get_mem_end_address()));
+        }
+    }
+}
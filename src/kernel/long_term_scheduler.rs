@@ -1,51 +1,214 @@
-use std::collections::VecDeque;
+use std::collections::BTreeSet;
+use std::sync::Arc;
 
-use super::Memory;
+use super::{Memory, ProcessControlBlock};
 
 use crate::io::Disk;
 
-pub(crate) struct LongTermScheduler {
-    program_queue: VecDeque<u32>,
+/// How many programs may be admitted ahead of the oldest waiting one before admission waits for it.
+pub const DEFAULT_STARVATION_WINDOW: usize = 16;
+
+/// Selects which waiting program the long term scheduler admits next.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum AdmissionPolicy {
+    /// Arrival order. A program that does not fit blocks everything behind it.
+    Fifo,
+    /// The oldest program that fits.
+    FirstFit,
+    /// The largest program that fits, leaving the smallest gap behind.
+    BestFit,
+    /// The smallest program.
+    SmallestFirst,
+}
+
+/// Minimum program size over ranges of arrival slots, so the oldest program no larger than a
+/// limit is found by walking a single path from the root.
+struct MinSizeTree {
+    leaf_count: usize,
+    nodes: Vec<usize>,
+}
+
+impl MinSizeTree {
+    fn new(leaf_count: usize) -> MinSizeTree {
+        let leaf_count = leaf_count.next_power_of_two();
+
+        MinSizeTree {
+            leaf_count,
+            nodes: vec![usize::MAX; 2 * leaf_count],
+        }
+    }
+
+    fn set(&mut self, slot: usize, size: usize) {
+        let mut node = self.leaf_count + slot;
+        self.nodes[node] = size;
+
+        while node > 1 {
+            node /= 2;
+            self.nodes[node] = self.nodes[2 * node].min(self.nodes[2 * node + 1]);
+        }
+    }
+
+    fn leftmost_at_most(&self, limit: usize) -> Option<usize> {
+        if self.nodes[1] > limit {
+            return None;
+        }
+
+        let mut node = 1;
+        while node < self.leaf_count {
+            node = if self.nodes[2 * node] <= limit { 2 * node } else { 2 * node + 1 };
+        }
+
+        Some(node - self.leaf_count)
+    }
+}
+
+pub struct LongTermScheduler {
+    policy: AdmissionPolicy,
+    starvation_window: usize,
+    /// Waiting programs and their sizes, by arrival slot. A slot is emptied once admitted.
+    slots: Vec<Option<(u32, usize)>>,
+    oldest_slot: usize,
+    pending_count: usize,
+    sizes_by_arrival: MinSizeTree,
+    slots_by_size: BTreeSet<(usize, usize)>,
+    bypass_count: usize,
 }
 
 impl LongTermScheduler {
     pub fn new() -> LongTermScheduler {
+        LongTermScheduler::with_policy(AdmissionPolicy::Fifo, 0)
+    }
+
+    pub fn with_policy(policy: AdmissionPolicy, starvation_window: usize) -> LongTermScheduler {
         LongTermScheduler {
-            program_queue: VecDeque::new(),
+            policy,
+            starvation_window,
+            slots: Vec::new(),
+            oldest_slot: 0,
+            pending_count: 0,
+            sizes_by_arrival: MinSizeTree::new(1),
+            slots_by_size: BTreeSet::new(),
+            bypass_count: 0,
         }
     }
 
-    pub fn enqueue_programs(&mut self, program_ids: Vec<u32>) {
-        self.program_queue.extend(program_ids);
+    /// Queues programs for admission, indexed by the memory each takes when admitted.
+    pub fn enqueue_programs(&mut self, disk: &Disk, memory: &Memory, program_ids: Vec<u32>) {
+        if self.slots.len() + program_ids.len() > self.sizes_by_arrival.leaf_count {
+            self.sizes_by_arrival = MinSizeTree::new(self.slots.len() + program_ids.len());
+
+            for (slot, pending) in self.slots.iter().enumerate() {
+                if let Some((_, size)) = pending {
+                    self.sizes_by_arrival.set(slot, *size);
+                }
+            }
+        }
+
+        for program_id in program_ids {
+            let size = memory.get_admission_size(disk.get_info_for(program_id).get_size());
+            let slot = self.slots.len();
+
+            self.slots.push(Some((program_id, size)));
+            self.sizes_by_arrival.set(slot, size);
+            self.slots_by_size.insert((size, slot));
+            self.pending_count += 1;
+        }
     }
 
-    pub fn step(&mut self, disk: &mut Disk, memory: &mut Memory) -> Result<u32, &'static str> {
-        let program_id = *self.program_queue.front().ok_or("No programs in queue")?;
-        
-        let program_info = disk.get_info_for(program_id);
-        let program_data = disk.read_data_for(&program_info);
+    pub fn get_pending_count(&self) -> usize {
+        self.pending_count
+    }
 
-        if memory.get_remaining_memory() < program_data.len() {
-            return Err("Not enough memory to load program");
+    /// The program that has waited longest for admission.
+    pub fn get_oldest_pending(&self) -> Option<u32> {
+        (self.pending_count > 0).then(|| self.slots[self.oldest_slot].unwrap().0)
+    }
+
+    pub fn step(&mut self, disk: &Disk, memory: &Memory) -> Result<u32, &'static str> {
+        if self.pending_count == 0 {
+            return Err("No programs in queue");
         }
 
-        self.program_queue.pop_front();
-        memory.create_process(program_info, program_data);
+        let (bank, slot) = (0..memory.get_bank_count())
+            .find_map(|bank| Some((bank, self.select(memory.get_remaining_memory_in(bank))?)))
+            .ok_or("Not enough memory to load program")?;
+        let (program_id, _) = self.remove(slot);
+
+        let program_info = disk.get_info_for(program_id);
+        memory.create_processes_in(bank, &[(program_info, disk.read_data_for(program_info))]);
 
         Ok(program_id)
     }
 
-    pub fn batch_step(&mut self, disk: &mut Disk, memory: &mut Memory) -> Vec<u32> {
+    /// Admits every program that fits, and returns the new processes in admission order. Memory
+    /// banks are filled in turn, and each bank's share of the round is chosen first and then
+    /// copied into memory in one bulk admission.
+    pub fn batch_step(&mut self, disk: &Disk, memory: &Memory) -> Vec<Arc<ProcessControlBlock>> {
+        let mut pcbs = Vec::new();
         let mut process_ids = Vec::new();
 
-        while !self.program_queue.is_empty() {
-            match self.step(disk, memory) {
-                Ok(process_id) => process_ids.push(process_id),
-                Err(_) => break
+        for bank in 0..memory.get_bank_count() {
+            process_ids.clear();
+            let mut free_words = memory.get_remaining_memory_in(bank);
+
+            while self.pending_count > 0 {
+                let Some(slot) = self.select(free_words) else { break };
+                let (program_id, size) = self.remove(slot);
+
+                free_words -= size;
+                process_ids.push(program_id);
+            }
+
+            let programs: Vec<_> = process_ids.iter()
+                .map(|&program_id| {
+                    let program_info = disk.get_info_for(program_id);
+                    (program_info, disk.read_data_for(program_info))
+                })
+                .collect();
+            pcbs.extend(memory.create_processes_in(bank, &programs));
+        }
+
+        pcbs
+    }
+
+    /// Picks the slot to admit into `free_words` of memory, counting every program that overtakes
+    /// the oldest one against the starvation window.
+    fn select(&mut self, free_words: usize) -> Option<usize> {
+        let oldest_slot = self.oldest_slot;
+
+        let slot = if self.policy == AdmissionPolicy::Fifo || self.bypass_count >= self.starvation_window {
+            self.slots[oldest_slot].filter(|&(_, size)| size <= free_words).map(|_| oldest_slot)
+        } else {
+            match self.policy {
+                AdmissionPolicy::FirstFit => self.sizes_by_arrival.leftmost_at_most(free_words),
+                AdmissionPolicy::BestFit => self.slots_by_size.range(..(free_words + 1, 0)).next_back().map(|&(_, slot)| slot),
+                AdmissionPolicy::SmallestFirst => self.slots_by_size.first().filter(|&&(size, _)| size <= free_words).map(|&(_, slot)| slot),
+                AdmissionPolicy::Fifo => unreachable!(),
+            }
+        }?;
+
+        self.bypass_count = if slot == oldest_slot { 0 } else { self.bypass_count + 1 };
+
+        Some(slot)
+    }
+
+    fn remove(&mut self, slot: usize) -> (u32, usize) {
+        let (program_id, size) = self.slots[slot].take().unwrap();
+
+        self.sizes_by_arrival.set(slot, usize::MAX);
+        self.slots_by_size.remove(&(size, slot));
+        self.pending_count -= 1;
+
+        if self.pending_count == 0 {
+            self.slots.clear();
+            self.oldest_slot = 0;
+        } else {
+            while self.slots[self.oldest_slot].is_none() {
+                self.oldest_slot += 1;
             }
         }
 
-        process_ids
+        (program_id, size)
     }
 }
 
@@ -54,17 +217,122 @@ mod tests {
     use std::vec;
 
     use super::*;
+    use crate::kernel::memory::MemoryConfig;
+    use crate::kernel::paging::{PAGE_SIZE, RESERVED_PAGES};
+
+    /// Writes programs of the given sizes to disk, with ids counting up from 1.
+    fn disk_with_program_sizes(sizes: &[usize]) -> Disk {
+        let mut disk = Disk::new();
+        for (idx, &size) in sizes.iter().enumerate() {
+            disk.write_program(idx as u32 + 1, 1, size - 3, 1, 1, 1, &vec![1; size]);
+        }
+
+        disk
+    }
+
+    /// Fills memory so that exactly `free_words` remain.
+    fn memory_with_free_words(free_words: usize) -> Memory {
+        let memory = Memory::new();
+        let mut disk = Disk::new();
+        let size = memory.get_remaining_memory() - free_words;
+
+        disk.write_program(1000, 1, size - 3, 1, 1, 1, &vec![1; size]);
+        memory.create_process(disk.get_info_for(1000), disk.read_data_for(disk.get_info_for(1000)));
+
+        memory
+    }
+
+    fn batch_step_ids(lts: &mut LongTermScheduler, disk: &Disk, memory: &Memory) -> Vec<u32> {
+        lts.batch_step(disk, memory).iter().map(|pcb| pcb.id).collect()
+    }
+
+    fn admit_with(policy: AdmissionPolicy, sizes: &[usize], free_words: usize) -> Vec<u32> {
+        let mut lts = LongTermScheduler::with_policy(policy, DEFAULT_STARVATION_WINDOW);
+        let mut disk = disk_with_program_sizes(sizes);
+        let memory = memory_with_free_words(free_words);
+
+        lts.enqueue_programs(&disk, &memory, (1..=sizes.len() as u32).collect());
+        batch_step_ids(&mut lts, &mut disk, &memory)
+    }
+
+    #[test]
+    fn test_long_term_scheduler_admission_policies() {
+        let sizes = [50, 20, 30, 10];
+
+        assert_eq!(admit_with(AdmissionPolicy::Fifo, &sizes, 40), vec![]);
+        assert_eq!(admit_with(AdmissionPolicy::FirstFit, &sizes, 40), vec![2, 4]);
+        assert_eq!(admit_with(AdmissionPolicy::BestFit, &sizes, 40), vec![3, 4]);
+        assert_eq!(admit_with(AdmissionPolicy::SmallestFirst, &sizes, 40), vec![4, 2]);
+    }
+
+    #[test]
+    fn test_long_term_scheduler_starvation_window() {
+        let mut lts = LongTermScheduler::with_policy(AdmissionPolicy::SmallestFirst, 2);
+        let mut disk = disk_with_program_sizes(&[100, 10, 10, 10]);
+        let memory = memory_with_free_words(50);
+
+        lts.enqueue_programs(&disk, &memory, vec![1, 2, 3, 4]);
+        let process_ids = batch_step_ids(&mut lts, &mut disk, &memory);
+
+        assert_eq!(process_ids, vec![2, 3]);
+        assert_eq!(lts.get_pending_count(), 2);
+    }
+
+    #[test]
+    fn test_long_term_scheduler_enqueue_grows_index() {
+        let mut lts = LongTermScheduler::with_policy(AdmissionPolicy::FirstFit, DEFAULT_STARVATION_WINDOW);
+        let mut disk = disk_with_program_sizes(&[200, 200, 200, 10, 10]);
+        let memory = memory_with_free_words(100);
+
+        lts.enqueue_programs(&disk, &memory, vec![1, 2, 3]);
+        lts.enqueue_programs(&disk, &memory, vec![4, 5]);
+        let process_ids = batch_step_ids(&mut lts, &mut disk, &memory);
+
+        assert_eq!(process_ids, vec![4, 5]);
+        assert_eq!(lts.get_pending_count(), 3);
+    }
+
+    #[test]
+    fn test_long_term_scheduler_demand_paged_admission() {
+        let mut lts = LongTermScheduler::new();
+        let disk = disk_with_program_sizes(&[100; 25]);
+        let memory = Memory::with_demand_paging();
+
+        lts.enqueue_programs(&disk, &memory, (1..=25).collect());
+        let process_ids = batch_step_ids(&mut lts, &disk, &memory);
+
+        assert_eq!(process_ids.len(), memory.get_memory_size() / (PAGE_SIZE * RESERVED_PAGES));
+        assert_eq!(memory.get_used_memory(), process_ids.len() * PAGE_SIZE);
+    }
+
+    #[test]
+    fn test_long_term_scheduler_banked_admission() {
+        let mut lts = LongTermScheduler::new();
+        let disk = disk_with_program_sizes(&[200; 5]);
+        let memory = Memory::with_config(MemoryConfig { bank_count: 4, ..MemoryConfig::default() });
+
+        lts.enqueue_programs(&disk, &memory, (1..=5).collect());
+        let process_ids = batch_step_ids(&mut lts, &disk, &memory);
+
+        assert_eq!(process_ids, vec![1, 2, 3, 4]);
+        assert_eq!((1..=4).map(|id| memory.get_pcb_for(id).bank).collect::<Vec<_>>(), vec![0, 1, 2, 3]);
+        assert_eq!(lts.step(&disk, &memory), Err("Not enough memory to load program"));
+
+        memory.free_process(3);
+        assert_eq!(lts.step(&disk, &memory), Ok(5));
+        assert_eq!(memory.get_pcb_for(5).bank, 2);
+    }
 
     #[test]
     fn test_long_term_scheduler_enqueue_then_step() {
         let mut lts = LongTermScheduler::new();
         let mut disk = Disk::new();
-        let mut memory = Memory::new();
+        let memory = Memory::new();
 
         disk.write_program(20, 1, 1, 1, 1, 2, &[1, 2, 3, 4, 5]);
 
-        lts.enqueue_programs(vec![20]);
-        let process_id = lts.step(&mut disk, &mut memory).unwrap();
+        lts.enqueue_programs(&disk, &memory, vec![20]);
+        let process_id = lts.step(&mut disk, &memory).unwrap();
 
         assert_eq!(process_id, 20);
     }
@@ -73,31 +341,32 @@ mod tests {
     fn test_long_term_scheduler_enqueue_then_batch_step() {
         let mut lts = LongTermScheduler::new();
         let mut disk = Disk::new();
-        let mut memory = Memory::new();
+        let memory = Memory::new();
 
         disk.write_program(20, 1, 1, 1, 1, 2, &[1, 2, 3, 4, 5]);
         disk.write_program(21, 1, 1, 1, 1, 2, &[1, 2, 3, 4, 5]);
 
-        lts.enqueue_programs(vec![20, 21]);
-        let process_ids = lts.batch_step(&mut disk, &mut memory);
+        lts.enqueue_programs(&disk, &memory, vec![20, 21]);
+        let pcbs = lts.batch_step(&mut disk, &memory);
 
-        assert_eq!(process_ids, vec![20, 21]);
+        assert_eq!(pcbs.iter().map(|pcb| pcb.id).collect::<Vec<_>>(), vec![20, 21]);
+        assert!(pcbs.iter().all(|pcb| Arc::ptr_eq(pcb, &memory.get_pcb_for(pcb.id))));
     }
 
     #[test]
     fn test_long_term_scheduler_step_not_enough_memory() {
         let mut lts = LongTermScheduler::new();
         let mut disk = Disk::new();
-        let mut memory = Memory::new();
+        let memory = Memory::new();
 
         let program_data = vec![1; memory.get_remaining_memory() - 1];
 
         disk.write_program(1, 1, program_data.len() - 3, 1, 1, 1, &program_data.as_slice());
         disk.write_program(2, 1, 1, 1, 1, 2, &[1, 2, 3, 4, 5]);
 
-        lts.enqueue_programs(vec![1, 2]);
-        let _ = lts.step(&mut disk, &mut memory);
-        let result = lts.step(&mut disk, &mut memory);
+        lts.enqueue_programs(&disk, &memory, vec![1, 2]);
+        let _ = lts.step(&mut disk, &memory);
+        let result = lts.step(&mut disk, &memory);
 
         assert_eq!(result, Err("Not enough memory to load program"));
     }
@@ -106,9 +375,9 @@ mod tests {
     fn test_long_term_scheduler_step_no_programs_in_queue() {
         let mut lts = LongTermScheduler::new();
         let mut disk = Disk::new();
-        let mut memory = Memory::new();
+        let memory = Memory::new();
 
-        let result = lts.step(&mut disk, &mut memory);
+        let result = lts.step(&mut disk, &memory);
 
         assert_eq!(result, Err("No programs in queue"));
     }
@@ -117,20 +386,20 @@ mod tests {
     fn test_long_term_scheduler_batch_step_not_enough_memory() {
         let mut lts = LongTermScheduler::new();
         let mut disk = Disk::new();
-        let mut memory = Memory::new();
+        let memory = Memory::new();
 
         let program_data = vec![1; memory.get_remaining_memory() - 1];
 
         disk.write_program(1, 1, program_data.len() - 3, 1, 1, 1, &program_data.as_slice());
         disk.write_program(2, 1, 1, 1, 1, 2, &[1, 2, 3, 4, 5]);
 
-        lts.enqueue_programs(vec![1, 2]);
-        let process_ids = lts.batch_step(&mut disk, &mut memory);
+        lts.enqueue_programs(&disk, &memory, vec![1, 2]);
+        let process_ids = batch_step_ids(&mut lts, &mut disk, &memory);
 
         assert_eq!(process_ids, vec![1]);
 
         memory.core_dump();
-        let process_ids = lts.batch_step(&mut disk, &mut memory);
+        let process_ids = batch_step_ids(&mut lts, &mut disk, &memory);
 
         assert_eq!(process_ids, vec![2]);
     }
@@ -0,0 +1,351 @@
+use std::cmp::Reverse;
+use std::collections::BTreeSet;
+use std::sync::Arc;
+use std::time::Instant;
+
+use super::{Memory, MetricsTable, ProcessControlBlock, ShortTermScheduler};
+use super::process_control_block::{Context, CONTEXT_WORDS};
+
+use crate::io::Disk;
+
+/// Sits between the long and short term schedulers. When the oldest waiting program outranks
+/// ready processes holding memory it does not fit in, those processes are suspended whole to the
+/// swap area on disk, and brought back once nothing waiting outranks them.
+pub struct MediumTermScheduler {
+    /// Processes holding memory, by priority then id.
+    resident: BTreeSet<(u32, u32)>,
+    /// Processes suspended to disk, by priority then id.
+    swapped: BTreeSet<(u32, u32)>,
+    swap_buffer: Vec<u32>,
+    swap_outs: u64,
+    swap_ins: u64,
+    swapped_out_words: u64,
+    swapped_in_words: u64,
+    inversion_cycles: u64,
+    inverted: bool,
+    observed_at: u64,
+}
+
+impl MediumTermScheduler {
+    pub fn new() -> MediumTermScheduler {
+        MediumTermScheduler {
+            resident: BTreeSet::new(),
+            swapped: BTreeSet::new(),
+            swap_buffer: Vec::new(),
+            swap_outs: 0,
+            swap_ins: 0,
+            swapped_out_words: 0,
+            swapped_in_words: 0,
+            inversion_cycles: 0,
+            inverted: false,
+            observed_at: 0,
+        }
+    }
+
+    pub fn record_admission(&mut self, pcb: &ProcessControlBlock) {
+        self.resident.insert((pcb.priority, pcb.id));
+    }
+
+    pub fn record_exit(&mut self, pcb: &ProcessControlBlock) {
+        self.resident.remove(&(pcb.priority, pcb.id));
+    }
+
+    /// Accumulates priority inversion: time during which the oldest waiting program outranked a
+    /// process holding memory. Called after every admission round with that program's priority.
+    pub fn observe(&mut self, now: u64, waiting_priority: Option<u32>) {
+        if self.inverted {
+            self.inversion_cycles += now - self.observed_at;
+        }
+
+        self.inverted = match (waiting_priority, self.resident.first()) {
+            (Some(waiting_priority), Some(&(lowest_priority, _))) => lowest_priority < waiting_priority,
+            _ => false,
+        };
+        self.observed_at = now;
+    }
+
+    /// Swaps in suspended processes, highest priority first, while they fit and nothing waiting
+    /// outranks them. Once no process holds memory they return regardless, so none is stranded.
+    pub fn swap_in(&mut self, disk: &mut Disk, memory: &Memory, waiting_priority: Option<u32>) -> Vec<Arc<ProcessControlBlock>> {
+        let mut pcbs = Vec::new();
+
+        while let Some(&(priority, process_id)) = self.swapped.last() {
+            if waiting_priority.is_some_and(|waiting_priority| priority < waiting_priority) && !self.resident.is_empty() {
+                break;
+            }
+
+            let image = disk.read_swap(process_id);
+            let size = image.len() - CONTEXT_WORDS;
+            if !(0..memory.get_bank_count()).any(|bank| memory.get_remaining_memory_in(bank) >= size) {
+                break;
+            }
+
+            let pcb = memory.create_process(disk.get_info_for(process_id), &image[CONTEXT_WORDS..]);
+            *pcb.context.lock().unwrap() = Context::from_words(image);
+
+            self.swap_ins += 1;
+            self.swapped_in_words += image.len() as u64;
+            disk.free_swap(process_id);
+
+            self.swapped.pop_last();
+            self.record_admission(&pcb);
+            pcbs.push(pcb);
+        }
+
+        pcbs
+    }
+
+    /// Swaps out ready processes of lower priority than a waiting program of `size` words until
+    /// it fits. With `compaction` on they go lowest priority first and memory is compacted after
+    /// each, recording the pause there; without it only processes at the top of a bank free any
+    /// room, so the bank whose top lower priority processes make enough room is emptied from the
+    /// top down. Does nothing when even all of them would not make room.
+    pub fn make_room(&mut self, disk: &mut Disk, memory: &Memory, sts: &mut ShortTermScheduler, compaction: Option<&MetricsTable>,
+                     priority: u32, size: usize) {
+        let fits = |memory: &Memory| (0..memory.get_bank_count()).any(|bank| memory.get_remaining_memory_in(bank) >= size);
+        if fits(memory) {
+            return;
+        }
+
+        let candidates = match compaction {
+            Some(_) => {
+                let candidates: Vec<_> = self.resident.range(..(priority, 0)).map(|&(_, process_id)| memory.get_pcb_for(process_id)).collect();
+                let reclaimable: usize = candidates.iter().map(|pcb| pcb.get_resident_words()).sum();
+                if memory.get_remaining_memory() + memory.get_fragmented_memory() + reclaimable < size {
+                    return;
+                }
+                candidates
+            }
+            None => match self.top_of_bank_candidates(memory, priority, size) {
+                Some(candidates) => candidates,
+                None => return,
+            },
+        };
+
+        for pcb in candidates {
+            // Only a process still in the ready queue can be suspended; one on a CPU runs on.
+            let Some(pcb) = sts.unschedule_process(pcb.id) else {
+                if compaction.is_some() {
+                    continue;
+                }
+                // The processes below it stay covered, so swapping them out would gain nothing.
+                break;
+            };
+
+            if self.swap_out(disk, memory, &pcb).is_err() {
+                sts.schedule_process(pcb);
+                break;
+            }
+
+            if let Some(metrics) = compaction {
+                let started_at = Instant::now();
+                let stats = memory.compact();
+                metrics.record_compaction(started_at.elapsed(), stats);
+            }
+            if fits(memory) {
+                break;
+            }
+        }
+    }
+
+    /// Finds the first bank where swapping out lower priority processes from its top down frees
+    /// `size` words above whatever stays, and returns those processes topmost first.
+    fn top_of_bank_candidates(&self, memory: &Memory, priority: u32, size: usize) -> Option<Vec<Arc<ProcessControlBlock>>> {
+        let bank_size = memory.get_bank_size();
+
+        (0..memory.get_bank_count()).find_map(|bank| {
+            let mut in_bank: Vec<_> = self.resident.iter()
+                .map(|&(priority, process_id)| (priority, memory.get_pcb_for(process_id)))
+                .filter(|(_, pcb)| pcb.bank == bank)
+                .collect();
+            in_bank.sort_by_key(|(_, pcb)| Reverse(pcb.get_mem_start_address()));
+
+            let mut candidates = Vec::new();
+            for (idx, (process_priority, pcb)) in in_bank.iter().enumerate() {
+                if *process_priority >= priority {
+                    return None;
+                }
+                candidates.push(pcb.clone());
+
+                let top = in_bank.get(idx + 1).map_or(bank * bank_size, |(_, below)| below.get_mem_end_address());
+                if (bank + 1) * bank_size - top >= size {
+                    return Some(candidates);
+                }
+            }
+            None
+        })
+    }
+
+    /// Writes a process's context and memory image to swap and frees its memory.
+    fn swap_out(&mut self, disk: &mut Disk, memory: &Memory, pcb: &ProcessControlBlock) -> Result<(), &'static str> {
+        {
+            let context = pcb.context.lock().unwrap();
+
+            self.swap_buffer.clear();
+            self.swap_buffer.extend_from_slice(&context.to_words());
+            self.swap_buffer.extend_from_slice(&memory.read_block(pcb.get_mem_start_address(), pcb.get_mem_end_address()));
+            disk.write_swap(pcb.id, &self.swap_buffer)?;
+        }
+
+        memory.free_process(pcb.id);
+        self.record_exit(pcb);
+        self.swapped.insert((pcb.priority, pcb.id));
+
+        self.swap_outs += 1;
+        self.swapped_out_words += self.swap_buffer.len() as u64;
+
+        Ok(())
+    }
+
+    pub fn get_swapped_count(&self) -> usize {
+        self.swapped.len()
+    }
+
+    pub fn get_swap_outs(&self) -> u64 {
+        self.swap_outs
+    }
+
+    pub fn get_swap_ins(&self) -> u64 {
+        self.swap_ins
+    }
+
+    /// Words written to and read from the swap area.
+    pub fn get_swap_io_words(&self) -> (u64, u64) {
+        (self.swapped_out_words, self.swapped_in_words)
+    }
+
+    pub fn get_inversion_cycles(&self) -> u64 {
+        self.inversion_cycles
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    use crate::io::disk::{DISK_SIZE, SWAP_RATIO, SWAP_SIZE};
+    use crate::kernel::{FifoQueue, MemoryConfig};
+
+    fn create_process(disk: &mut Disk, memory: &Memory, id: u32, priority: u32) -> Arc<ProcessControlBlock> {
+        create_sized_process(disk, memory, id, priority, 10)
+    }
+
+    fn create_sized_process(disk: &mut Disk, memory: &Memory, id: u32, priority: u32, size: usize) -> Arc<ProcessControlBlock> {
+        disk.write_program(id, priority, 2, 0, 0, size - 2, &vec![id; size]);
+        memory.create_process(disk.get_info_for(id), disk.read_data_for(disk.get_info_for(id)));
+
+        memory.get_pcb_for(id)
+    }
+
+    /// Admits 10 word processes of the given priorities bottom up into a 40 word memory and
+    /// queues them all as ready.
+    fn fill_memory(disk: &mut Disk, priorities: &[u32]) -> (Memory, MediumTermScheduler, ShortTermScheduler) {
+        let memory = Memory::with_config(MemoryConfig { size: 40, ..MemoryConfig::default() });
+        let mut mts = MediumTermScheduler::new();
+        let mut sts = ShortTermScheduler::without_dispatcher(Box::new(FifoQueue::new()));
+
+        for (idx, &priority) in priorities.iter().enumerate() {
+            let pcb = create_process(disk, &memory, idx as u32 + 1, priority);
+            mts.record_admission(&pcb);
+            sts.schedule_process(pcb);
+        }
+
+        (memory, mts, sts)
+    }
+
+    #[test]
+    fn test_medium_term_scheduler_swap_out_then_in() {
+        let mut disk = Disk::new();
+        let memory = Memory::new();
+        let mut mts = MediumTermScheduler::new();
+
+        let pcbs: Vec<_> = [(1, 5), (2, 1), (3, 9)].iter().map(|&(id, priority)| create_process(&mut disk, &memory, id, priority)).collect();
+        for pcb in &pcbs {
+            mts.record_admission(pcb);
+        }
+
+        memory.write_to(pcbs[1].get_mem_start_address() + 9, 42);
+        pcbs[1].context.lock().unwrap().registers[4] = 7;
+
+        mts.swap_out(&mut disk, &memory, &pcbs[1]).unwrap();
+        mts.swap_out(&mut disk, &memory, &pcbs[0]).unwrap();
+        assert_eq!(mts.get_swapped_count(), 2);
+        assert_eq!(memory.get_fragmented_memory(), 20);
+
+        // A waiting program of priority 3 keeps process 2 out, but not process 1.
+        let swapped_in = mts.swap_in(&mut disk, &memory, Some(3));
+        assert_eq!(swapped_in.iter().map(|pcb| pcb.id).collect::<Vec<_>>(), vec![1]);
+
+        let swapped_in = mts.swap_in(&mut disk, &memory, None);
+        let pcb = &swapped_in[0];
+        assert_eq!(pcb.id, 2);
+        assert_eq!(memory.read_from(pcb.get_mem_start_address() + 9), 42);
+        assert_eq!(pcb.context.lock().unwrap().registers[4], 7);
+
+        assert_eq!((mts.get_swap_outs(), mts.get_swap_ins()), (2, 2));
+        assert_eq!(mts.get_swap_io_words(), (2 * (CONTEXT_WORDS as u64 + 10), 2 * (CONTEXT_WORDS as u64 + 10)));
+        assert_eq!(disk.get_used_swap(), 0);
+    }
+
+    #[test]
+    fn test_medium_term_scheduler_make_room_without_compaction_swaps_from_the_top() {
+        let mut disk = Disk::new();
+        let (memory, mut mts, mut sts) = fill_memory(&mut disk, &[5, 1, 2]);
+
+        // Processes 3 and 2 sit on top and rank below the waiting program, so both go and no compaction is needed.
+        mts.make_room(&mut disk, &memory, &mut sts, None, 3, 25);
+        assert_eq!(mts.get_swapped_count(), 2);
+        assert_eq!(memory.get_remaining_memory_in(0), 30);
+        assert_eq!(memory.get_fragmented_memory(), 0);
+
+        // Process 2 ranks below the waiting program, but process 3 above it keeps its memory covered.
+        let mut disk = Disk::new();
+        let (memory, mut mts, mut sts) = fill_memory(&mut disk, &[5, 1, 2]);
+        mts.make_room(&mut disk, &memory, &mut sts, None, 2, 25);
+        assert_eq!(mts.get_swapped_count(), 0);
+        assert_eq!(memory.get_remaining_memory_in(0), 10);
+    }
+
+    #[test]
+    fn test_medium_term_scheduler_make_room_records_compactions() {
+        let mut disk = Disk::new();
+        let (memory, mut mts, mut sts) = fill_memory(&mut disk, &[1, 5, 5]);
+        let metrics = MetricsTable::new(4, memory.get_memory_size());
+
+        mts.make_room(&mut disk, &memory, &mut sts, Some(&metrics), 3, 20);
+        assert_eq!(mts.get_swapped_count(), 1);
+        assert_eq!(memory.get_remaining_memory_in(0), 20);
+        assert_eq!(metrics.get_compactions(), 1);
+    }
+
+    #[test]
+    fn test_medium_term_scheduler_swap_out_larger_than_default_swap() {
+        let size = SWAP_SIZE + 100;
+        let mut disk = Disk::with_swap_capacity(DISK_SIZE.max(size), SWAP_RATIO * 2 * size);
+        let memory = Memory::with_config(MemoryConfig { size: 2 * size, ..MemoryConfig::default() });
+        let mut mts = MediumTermScheduler::new();
+
+        let pcb = create_sized_process(&mut disk, &memory, 1, 5, size);
+        mts.record_admission(&pcb);
+        mts.swap_out(&mut disk, &memory, &pcb).unwrap();
+        assert_eq!(disk.get_used_swap(), CONTEXT_WORDS + size);
+
+        let swapped_in = mts.swap_in(&mut disk, &memory, None);
+        assert_eq!(memory.read_from(swapped_in[0].get_mem_start_address() + size - 1), 1);
+    }
+
+    #[test]
+    fn test_medium_term_scheduler_priority_inversion() {
+        let mut disk = Disk::new();
+        let memory = Memory::new();
+        let mut mts = MediumTermScheduler::new();
+        mts.record_admission(&create_process(&mut disk, &memory, 1, 5));
+
+        mts.observe(10, Some(3));
+        mts.observe(20, Some(8));
+        mts.observe(50, None);
+        mts.observe(70, Some(8));
+
+        assert_eq!(mts.get_inversion_cycles(), 30);
+    }
+}
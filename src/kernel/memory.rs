@@ -1,93 +1,672 @@
 use std::collections::HashMap;
-use std::sync::{Arc, RwLock};
+use std::ops::{Deref, Range};
+use std::sync::{Arc, Mutex, RwLock, RwLockReadGuard, RwLockWriteGuard, TryLockError, atomic::{AtomicU64, AtomicUsize, Ordering}};
+use std::time::Instant;
 
-use super::ProcessControlBlock;
+use super::{PageTable, ProcessControlBlock};
+use super::instrumentation::{self, Counter};
+use super::paging::{PAGE_SIZE, RESERVED_PAGES};
 
 use crate::io::ProgramInfo;
 
-const MEMORY_SIZE: usize = 1024;
+pub const DEFAULT_MEMORY_SIZE: usize = 1024;
 
-pub(crate) struct Memory {
-    pcb_map: HashMap<u32, Arc<ProcessControlBlock>>,
-    data: RwLock<[u32; MEMORY_SIZE]>,
-    current_data_idx: usize,
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub struct MemoryConfig {
+    /// Words of physical memory.
+    pub size: usize,
+    /// Equal slices the memory is split into, each with its own lock and allocator.
+    pub bank_count: usize,
+    /// Admit processes with only their first page resident and load the rest as it faults in.
+    pub demand_paging: bool,
+}
+
+impl Default for MemoryConfig {
+    fn default() -> MemoryConfig {
+        MemoryConfig {
+            size: DEFAULT_MEMORY_SIZE,
+            bank_count: 1,
+            demand_paging: false,
+        }
+    }
+}
+
+/// The work done by one compaction.
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub struct CompactionStats {
+    pub moved_processes: usize,
+    pub moved_words: usize,
+    /// Words returned to admission.
+    pub reclaimed_words: usize,
+}
+
+/// The page held by a frame of a demand paged memory.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub struct FrameOwner {
+    pub process_id: u32,
+    pub page: usize,
+    /// Orders frames by when they were filled.
+    pub loaded_at: u64,
+}
+
+/// The frames of one bank. Frame numbers are global across the memory.
+struct FrameTable {
+    first_frame: usize,
+    free_frames: Vec<usize>,
+    owners: Box<[Option<FrameOwner>]>,
+    /// The process each frame in use belongs to, so the pager need not look it up.
+    pcbs: Box<[Option<Arc<ProcessControlBlock>>]>,
+    reserved_frames: usize,
+}
+
+impl FrameTable {
+    fn new(first_frame: usize, frame_count: usize) -> FrameTable {
+        FrameTable {
+            first_frame,
+            free_frames: (first_frame..first_frame + frame_count).rev().collect(),
+            owners: vec![None; frame_count].into_boxed_slice(),
+            pcbs: vec![None; frame_count].into_boxed_slice(),
+            reserved_frames: 0,
+        }
+    }
+}
+
+/// Frames in use across every bank, oldest load first. They are linked through each frame, so
+/// loading and releasing one costs the same however many frames there are.
+struct LoadOrder {
+    /// The frames loaded just before and just after each frame in use.
+    links: Box<[(Option<usize>, Option<usize>)]>,
+    oldest: Option<usize>,
+    newest: Option<usize>,
+}
+
+impl LoadOrder {
+    fn new(frame_count: usize) -> LoadOrder {
+        LoadOrder {
+            links: vec![(None, None); frame_count].into_boxed_slice(),
+            oldest: None,
+            newest: None,
+        }
+    }
+
+    fn push(&mut self, frame: usize) {
+        self.links[frame] = (self.newest, None);
+        match self.newest {
+            Some(newest) => self.links[newest].1 = Some(frame),
+            None => self.oldest = Some(frame),
+        }
+        self.newest = Some(frame);
+    }
+
+    fn remove(&mut self, frame: usize) {
+        let (previous, next) = std::mem::take(&mut self.links[frame]);
+        match previous {
+            Some(previous) => self.links[previous].1 = next,
+            None => self.oldest = next,
+        }
+        match next {
+            Some(next) => self.links[next].0 = previous,
+            None => self.newest = previous,
+        }
+    }
+}
+
+fn reserved_frames_for(page_count: usize) -> usize {
+    page_count.min(RESERVED_PAGES)
+}
+
+/// A slice of physical memory. Processes are allocated within a single bank, so CPUs working in
+/// different banks never wait on each other's locks.
+struct Bank {
+    start_address: usize,
+    data: RwLock<Box<[u32]>>,
+    /// Bank relative top of the used region.
+    current_data_idx: AtomicUsize,
+    /// Present when processes are demand paged rather than loaded whole.
+    frame_table: Option<Mutex<FrameTable>>,
+}
+
+impl Bank {
+    fn new(start_address: usize, size: usize, demand_paging: bool) -> Bank {
+        Bank {
+            start_address,
+            data: RwLock::new(vec![0; size].into_boxed_slice()),
+            current_data_idx: AtomicUsize::new(0),
+            frame_table: demand_paging.then(|| Mutex::new(FrameTable::new(start_address / PAGE_SIZE, size / PAGE_SIZE))),
+        }
+    }
+
+    /// Read locks the bank's data. Only an access that finds it locked reads the clock, to time
+    /// its wait.
+    fn read_data(&self) -> RwLockReadGuard<'_, Box<[u32]>> {
+        match self.data.try_read() {
+            Ok(data) => data,
+            Err(TryLockError::WouldBlock) => {
+                let started_at = Instant::now();
+                let data = self.data.read().unwrap();
+                instrumentation::record_lock_wait(started_at.elapsed());
+                data
+            }
+            Err(TryLockError::Poisoned(err)) => panic!("{}", err),
+        }
+    }
+
+    fn write_data(&self) -> RwLockWriteGuard<'_, Box<[u32]>> {
+        match self.data.try_write() {
+            Ok(data) => data,
+            Err(TryLockError::WouldBlock) => {
+                let started_at = Instant::now();
+                let data = self.data.write().unwrap();
+                instrumentation::record_lock_wait(started_at.elapsed());
+                data
+            }
+            Err(TryLockError::Poisoned(err)) => panic!("{}", err),
+        }
+    }
+}
+
+/// A block of memory borrowed in place, holding its bank's read lock.
+pub struct MemoryBlock<'a> {
+    data: RwLockReadGuard<'a, Box<[u32]>>,
+    range: Range<usize>,
+}
+
+impl Deref for MemoryBlock<'_> {
+    type Target = [u32];
+
+    fn deref(&self) -> &[u32] {
+        &self.data[self.range.clone()]
+    }
+}
+
+/// Shared between the long term scheduler, which creates processes, and the CPUs that run them,
+/// so every method takes `&self` and synchronizes internally.
+pub struct Memory {
+    pcb_map: RwLock<HashMap<u32, Arc<ProcessControlBlock>>>,
+    banks: Box<[Bank]>,
+    bank_size: usize,
+    /// Orders frame loads across every bank.
+    load_count: AtomicU64,
+    load_order: Mutex<LoadOrder>,
 }
 
 impl Memory {
     pub fn new() -> Memory {
+        Memory::with_config(MemoryConfig::default())
+    }
+
+    /// Creates a memory that admits processes with only their first page resident. The rest is
+    /// loaded by the pager as it faults in.
+    pub fn with_demand_paging() -> Memory {
+        Memory::with_config(MemoryConfig { demand_paging: true, ..MemoryConfig::default() })
+    }
+
+    pub fn with_config(config: MemoryConfig) -> Memory {
+        if config.bank_count == 0 || config.size % config.bank_count != 0 {
+            panic!("Memory size {} does not split into {} equal banks", config.size, config.bank_count);
+        }
+
+        let bank_size = config.size / config.bank_count;
+        if bank_size == 0 || (config.demand_paging && bank_size % PAGE_SIZE != 0) {
+            panic!("Bank size {} is not a whole number of pages", bank_size);
+        }
+
         Memory {
-            pcb_map: HashMap::new(),
-            data: RwLock::new([0; MEMORY_SIZE]),
-            current_data_idx: 0,
+            pcb_map: RwLock::new(HashMap::new()),
+            banks: (0..config.bank_count).map(|bank| Bank::new(bank * bank_size, bank_size, config.demand_paging)).collect(),
+            bank_size,
+            load_count: AtomicU64::new(0),
+            load_order: Mutex::new(LoadOrder::new(if config.demand_paging { config.size / PAGE_SIZE } else { 0 })),
         }
     }
 
+    pub fn is_demand_paged(&self) -> bool {
+        self.banks[0].frame_table.is_some()
+    }
+
     pub fn read_from(&self, address: usize) -> u32 {
-        if address >= MEMORY_SIZE {
+        if address >= self.get_memory_size() {
             panic!("Out of bounds memory access. Address is greater than memory size");
         }
 
-        self.data.read().unwrap()[address]
+        let bank = &self.banks[address / self.bank_size];
+        instrumentation::add(Counter::MemoryReadWords, 1);
+        bank.read_data()[address - bank.start_address]
     }
 
+    /// Copies a block into a new vector. Use `read_block` or `read_block_into` on hot paths.
     pub fn read_block_from(&self, start_address: usize, end_address: usize) -> Vec<u32> {
-        if start_address >= MEMORY_SIZE || end_address >= MEMORY_SIZE {
+        self.check_block(start_address, end_address);
+
+        instrumentation::add(Counter::MemoryReadWords, (end_address - start_address) as u64);
+        let mut block = Vec::with_capacity(end_address - start_address);
+        for (bank, range) in self.split_by_bank(start_address..end_address) {
+            block.extend_from_slice(&bank.read_data()[range]);
+        }
+
+        block
+    }
+
+    /// Borrows a block in place. Its bank stays read locked until the block is dropped, so the
+    /// block must lie within a single bank, as every process and page does.
+    pub fn read_block(&self, start_address: usize, end_address: usize) -> MemoryBlock<'_> {
+        self.check_block(start_address, end_address);
+
+        let bank = &self.banks[(start_address / self.bank_size).min(self.banks.len() - 1)];
+        if end_address > bank.start_address + self.bank_size {
+            panic!("Invalid memory range. Block spans more than one bank");
+        }
+
+        instrumentation::add(Counter::MemoryReadWords, (end_address - start_address) as u64);
+        MemoryBlock {
+            data: bank.read_data(),
+            range: start_address - bank.start_address..end_address - bank.start_address,
+        }
+    }
+
+    /// Copies the block starting at `start_address` into `buffer`, filling it.
+    pub fn read_block_into(&self, start_address: usize, buffer: &mut [u32]) {
+        let end_address = start_address + buffer.len();
+        self.check_block(start_address, end_address);
+        instrumentation::add(Counter::MemoryReadWords, buffer.len() as u64);
+
+        let mut remaining = buffer;
+        for (bank, range) in self.split_by_bank(start_address..end_address) {
+            let (head, tail) = remaining.split_at_mut(range.len());
+            head.copy_from_slice(&bank.read_data()[range]);
+            remaining = tail;
+        }
+    }
+
+    fn check_block(&self, start_address: usize, end_address: usize) {
+        if end_address > self.get_memory_size() {
             panic!("Out of bounds memory access. Start or end address is greater than memory size");
         } else if start_address > end_address {
             panic!("Invalid memory range. Start address is greater than end address");
         }
-
-        self.data.read().unwrap()[start_address..end_address].to_vec()
     }
 
-    pub fn write_to(&mut self, address: usize, value: u32) {
-        if address >= MEMORY_SIZE {
+    pub fn write_to(&self, address: usize, value: u32) {
+        if address >= self.get_memory_size() {
             panic!("Out of bounds memory access");
         }
 
-        self.data.write().unwrap()[address] = value;
+        let bank = &self.banks[address / self.bank_size];
+        instrumentation::add(Counter::MemoryWriteWords, 1);
+        bank.write_data()[address - bank.start_address] = value;
     }
 
-    pub fn write_block_to(&mut self, address: usize, data: &[u32]) {
+    pub fn write_block_to(&self, address: usize, data: &[u32]) {
         let start_address = address;
         let end_address = address + data.len();
 
-        if end_address > MEMORY_SIZE {
+        if end_address > self.get_memory_size() {
+            panic!("Out of bounds memory access");
+        }
+
+        instrumentation::add(Counter::MemoryWriteWords, data.len() as u64);
+        if let Some(bank) = self.banks.get(start_address / self.bank_size).filter(|bank| end_address <= bank.start_address + self.bank_size) {
+            bank.write_data()[start_address - bank.start_address..end_address - bank.start_address].copy_from_slice(data);
+            return;
+        }
+
+        let mut remaining = data;
+        for (bank, range) in self.split_by_bank(start_address..end_address) {
+            let (head, tail) = remaining.split_at(range.len());
+            bank.write_data()[range].copy_from_slice(head);
+            remaining = tail;
+        }
+    }
+
+    /// Splits an address range into the bank relative ranges it covers in each bank.
+    fn split_by_bank(&self, addresses: Range<usize>) -> impl Iterator<Item = (&Bank, Range<usize>)> {
+        let bank_size = self.bank_size;
+        let first_bank = addresses.start / bank_size;
+        let last_bank = addresses.end.div_ceil(bank_size);
+
+        self.banks[first_bank..last_bank].iter().map(move |bank| {
+            let start = addresses.start.max(bank.start_address) - bank.start_address;
+            let end = addresses.end.min(bank.start_address + bank_size) - bank.start_address;
+            (bank, start..end)
+        })
+    }
+
+    pub fn create_process(&self, program_info: &ProgramInfo, program_data: &[u32]) -> Arc<ProcessControlBlock> {
+        self.create_processes(&[(program_info, program_data)]).pop().unwrap()
+    }
+
+    /// Admits several programs at once into the bank with the most room.
+    pub fn create_processes(&self, programs: &[(&ProgramInfo, &[u32])]) -> Vec<Arc<ProcessControlBlock>> {
+        let bank = (0..self.banks.len()).rev().max_by_key(|&bank| self.get_remaining_memory_in(bank)).unwrap();
+        self.create_processes_in(bank, programs)
+    }
+
+    /// Admits several programs at once into one bank, and returns their PCBs in the same order.
+    /// Their ranges are reserved together, and all the data and PCBs go in under a single
+    /// acquisition of each lock.
+    pub fn create_processes_in(&self, bank_idx: usize, programs: &[(&ProgramInfo, &[u32])]) -> Vec<Arc<ProcessControlBlock>> {
+        if self.is_demand_paged() {
+            return self.create_paged_processes_in(bank_idx, programs);
+        }
+
+        let bank = &self.banks[bank_idx];
+        let total_size: usize = programs.iter().map(|(_, program_data)| program_data.len()).sum();
+        let mut start_idx = bank.current_data_idx.fetch_add(total_size, Ordering::AcqRel);
+
+        if start_idx + total_size > self.bank_size {
             panic!("Out of bounds memory access");
         }
 
-        self.data.write().unwrap()[start_address..end_address].copy_from_slice(data);
+        instrumentation::add(Counter::MemoryWriteWords, total_size as u64);
+        let mut pcbs = Vec::with_capacity(programs.len());
+        {
+            let mut data = bank.write_data();
+
+            for &(program_info, program_data) in programs {
+                let end_idx = start_idx + program_data.len();
+                data[start_idx..end_idx].copy_from_slice(program_data);
+
+                pcbs.push(Arc::new(ProcessControlBlock {
+                    bank: bank_idx,
+                    ..ProcessControlBlock::new(program_info, bank.start_address + start_idx, bank.start_address + end_idx)
+                }));
+                start_idx = end_idx;
+            }
+        }
+
+        let mut pcb_map = self.pcb_map.write().unwrap();
+        for pcb in &pcbs {
+            pcb_map.insert(pcb.id, pcb.clone());
+        }
+
+        pcbs
+    }
+
+    fn create_paged_processes_in(&self, bank_idx: usize, programs: &[(&ProgramInfo, &[u32])]) -> Vec<Arc<ProcessControlBlock>> {
+        let mut pcb_map = self.pcb_map.write().unwrap();
+
+        programs.iter().map(|&(program_info, program_data)| {
+            let pcb = Arc::new(ProcessControlBlock {
+                bank: bank_idx,
+                ..ProcessControlBlock::with_page_table(program_info, PageTable::new(program_data.len()))
+            });
+            self.banks[bank_idx].frame_table.as_ref().unwrap().lock().unwrap().reserved_frames += reserved_frames_for(pcb.page_table.as_ref().unwrap().get_page_count());
+
+            // Pages beyond the reservations of older processes can hold every frame. The first
+            // page then faults in like any other.
+            if let Some(frame) = self.allocate_frame(&pcb, 0) {
+                self.page_in(&pcb, 0, frame, &program_data[..program_data.len().min(PAGE_SIZE)]);
+            }
+            pcb_map.insert(pcb.id, pcb.clone());
+
+            pcb
+        }).collect()
+    }
+
+    /// Takes a free frame for `page` of a process, if any is left. Frames in the process's own
+    /// bank are preferred.
+    pub fn allocate_frame(&self, pcb: &Arc<ProcessControlBlock>, page: usize) -> Option<usize> {
+        let bank_count = self.banks.len();
+
+        (0..bank_count).find_map(|offset| {
+            let mut frame_table = self.banks[(pcb.bank + offset) % bank_count].frame_table.as_ref()?.lock().unwrap();
+
+            let frame = frame_table.free_frames.pop()?;
+            let loaded_at = self.load_count.fetch_add(1, Ordering::Relaxed) + 1;
+            let first_frame = frame_table.first_frame;
+            frame_table.owners[frame - first_frame] = Some(FrameOwner { process_id: pcb.id, page, loaded_at });
+            frame_table.pcbs[frame - first_frame] = Some(pcb.clone());
+            self.load_order.lock().unwrap().push(frame);
+
+            Some(frame)
+        })
+    }
+
+    pub fn release_frame(&self, frame: usize) {
+        let bank = &self.banks[frame * PAGE_SIZE / self.bank_size];
+        let mut frame_table = bank.frame_table.as_ref().expect("Memory is not demand paged").lock().unwrap();
+        let first_frame = frame_table.first_frame;
+
+        if frame_table.owners[frame - first_frame].take().is_some() {
+            frame_table.pcbs[frame - first_frame] = None;
+            frame_table.free_frames.push(frame);
+            self.load_order.lock().unwrap().remove(frame);
+        }
+    }
+
+    /// Frames in use and the pages they hold, in frame order.
+    pub fn get_frame_owners(&self) -> Vec<(usize, FrameOwner)> {
+        let mut frame_owners = Vec::new();
+        self.visit_frame_owners(|frame, owner, _| frame_owners.push((frame, owner)));
+
+        frame_owners
+    }
+
+    /// Calls `visit` with every frame in use, the page it holds and that page's process, in
+    /// frame order. Each bank's frame table stays locked while its frames are visited.
+    pub fn visit_frame_owners(&self, mut visit: impl FnMut(usize, FrameOwner, &Arc<ProcessControlBlock>)) {
+        for frame_table in self.banks.iter().filter_map(|bank| bank.frame_table.as_ref()) {
+            let frame_table = frame_table.lock().unwrap();
+
+            for (idx, owner) in frame_table.owners.iter().enumerate() {
+                if let (Some(owner), Some(pcb)) = (owner, &frame_table.pcbs[idx]) {
+                    visit(frame_table.first_frame + idx, *owner, pcb);
+                }
+            }
+        }
+    }
+
+    /// The page `frame` holds and its process, if the frame is in use.
+    pub fn get_frame_owner(&self, frame: usize) -> Option<(FrameOwner, Arc<ProcessControlBlock>)> {
+        let bank = &self.banks[frame * PAGE_SIZE / self.bank_size];
+        let frame_table = bank.frame_table.as_ref().expect("Memory is not demand paged").lock().unwrap();
+        let idx = frame - frame_table.first_frame;
+
+        Some((frame_table.owners[idx]?, frame_table.pcbs[idx].clone()?))
+    }
+
+    /// The frame in use loaded next after `frame`, or the oldest loaded one when `frame` is None.
+    pub fn get_next_loaded_frame(&self, frame: Option<usize>) -> Option<usize> {
+        let load_order = self.load_order.lock().unwrap();
+
+        match frame {
+            Some(frame) => load_order.links[frame].1,
+            None => load_order.oldest,
+        }
+    }
+
+    pub fn get_frame_count(&self) -> usize {
+        self.banks.len() * self.bank_size / PAGE_SIZE
     }
 
-    pub fn create_process(&mut self, program_info: &ProgramInfo, program_data: &[u32]) {
-        let start_address = self.current_data_idx;
-        let end_address = start_address + program_data.len();
-        self.current_data_idx = end_address;
+    /// Copies a page into `frame` and maps it into the process.
+    pub fn page_in(&self, pcb: &ProcessControlBlock, page: usize, frame: usize, page_data: &[u32]) {
+        let page_table = pcb.page_table.as_ref().expect("Process is not demand paged");
 
-        self.write_block_to(start_address, program_data);
+        self.write_block_to(frame * PAGE_SIZE, page_data);
+        page_table.map(page, frame);
+    }
+
+    /// Unmaps a resident page and copies its words into `buffer`. Returns the frame it held.
+    pub fn page_out(&self, pcb: &ProcessControlBlock, page: usize, buffer: &mut [u32]) -> usize {
+        let page_table = pcb.page_table.as_ref().expect("Process is not demand paged");
+        let frame = match page_table.unmap(page) {
+            Some(frame) => frame,
+            _ => panic!("Page {} of process {} is not resident", page, pcb.id),
+        };
 
-        let pcb = Arc::from(ProcessControlBlock::new(program_info, start_address, end_address));
-        self.pcb_map.insert(pcb.id, pcb);
+        self.read_block_into(frame * PAGE_SIZE, buffer);
+
+        frame
     }
 
     pub fn get_pcb_for(&self, process_id: u32) -> Arc<ProcessControlBlock> {
-        match self.pcb_map.get(&process_id) {
+        match self.pcb_map.read().unwrap().get(&process_id) {
             Some(pcb) => pcb.clone(),
             _ => panic!("No process found for id: {}", process_id)
         }
     }
 
-    pub fn core_dump(&mut self) {
+    /// Removes a finished process. Its words are reclaimed once no live process in its bank sits
+    /// above them, since allocation only ever grows from the top of the bank's used region.
+    pub fn free_process(&self, process_id: u32) {
+        let mut pcb_map = self.pcb_map.write().unwrap();
+
+        let pcb = match pcb_map.remove(&process_id) {
+            Some(pcb) => pcb,
+            _ => panic!("No process found for id: {}", process_id),
+        };
+        let bank = &self.banks[pcb.bank];
+
+        if let Some(page_table) = &pcb.page_table {
+            bank.frame_table.as_ref().unwrap().lock().unwrap().reserved_frames -= reserved_frames_for(page_table.get_page_count());
+
+            for page in 0..page_table.get_page_count() {
+                if let Some(frame) = page_table.unmap(page) {
+                    self.release_frame(frame);
+                }
+            }
+
+            return;
+        }
+
+        // Only freeing the topmost process lowers the top of the bank.
+        if pcb.get_mem_end_address() - bank.start_address < bank.current_data_idx.load(Ordering::Acquire) {
+            return;
+        }
+
+        let top = pcb_map.values()
+            .filter(|other| other.bank == pcb.bank)
+            .map(|other| other.get_mem_end_address() - bank.start_address)
+            .max()
+            .unwrap_or(0);
+        bank.current_data_idx.store(top, Ordering::Release);
+    }
+
+    /// Slides the processes of every bank down over the holes finished processes left, updating
+    /// their addresses. A process whose context is locked is running and stays where it is; the
+    /// ones above it pack against it instead. Each move write locks its bank for a single copy,
+    /// so CPUs keep running in between. Like `free_process`, this must be called from the thread
+    /// that admits processes.
+    pub fn compact(&self) -> CompactionStats {
+        let mut stats = CompactionStats::default();
+        if self.is_demand_paged() {
+            return stats;
+        }
+
+        let pcb_map = self.pcb_map.write().unwrap();
+
+        for (bank_idx, bank) in self.banks.iter().enumerate() {
+            let mut pcbs: Vec<_> = pcb_map.values().filter(|pcb| pcb.bank == bank_idx).collect();
+            pcbs.sort_unstable_by_key(|pcb| pcb.get_mem_start_address());
+
+            let mut next_address = bank.start_address;
+            for pcb in pcbs {
+                let (start_address, end_address) = (pcb.get_mem_start_address(), pcb.get_mem_end_address());
+
+                if start_address > next_address {
+                    if let Ok(_context) = pcb.context.try_lock() {
+                        let range = start_address - bank.start_address..end_address - bank.start_address;
+                        bank.write_data().copy_within(range, next_address - bank.start_address);
+                        pcb.relocate(next_address);
+
+                        stats.moved_processes += 1;
+                        stats.moved_words += end_address - start_address;
+                    }
+                }
+
+                next_address = pcb.get_mem_end_address();
+            }
+
+            let top = next_address - bank.start_address;
+            stats.reclaimed_words += bank.current_data_idx.swap(top, Ordering::AcqRel) - top;
+        }
+
+        stats
+    }
+
+    /// Words below the top of each bank's used region that no process holds. Only compaction
+    /// makes them available for admission.
+    pub fn get_fragmented_memory(&self) -> usize {
+        if self.is_demand_paged() {
+            return 0;
+        }
+
+        let resident_words: usize = self.pcb_map.read().unwrap().values().map(|pcb| pcb.get_resident_words()).sum();
+        self.get_used_memory() - resident_words
+    }
+
+    pub fn core_dump(&self) {
         // TODO: Implement writing mem to file.
 
-        self.pcb_map.clear();
-        let empty_data = [0; MEMORY_SIZE];
-        self.write_block_to(0, &empty_data);
-        self.current_data_idx = 0;
+        self.pcb_map.write().unwrap().clear();
+        self.load_count.store(0, Ordering::Relaxed);
+
+        for bank in self.banks.iter() {
+            bank.write_data().fill(0);
+            bank.current_data_idx.store(0, Ordering::Release);
+
+            if let Some(frame_table) = &bank.frame_table {
+                *frame_table.lock().unwrap() = FrameTable::new(bank.start_address / PAGE_SIZE, self.bank_size / PAGE_SIZE);
+            }
+        }
     }
 
+    /// Words left for admission. With demand paging this excludes frames reserved for resident
+    /// processes even when they are still free.
     pub fn get_remaining_memory(&self) -> usize {
-        MEMORY_SIZE - self.current_data_idx
+        (0..self.banks.len()).map(|bank| self.get_remaining_memory_in(bank)).sum()
+    }
+
+    /// Words left for admission in one bank. A process must fit in a single bank.
+    pub fn get_remaining_memory_in(&self, bank_idx: usize) -> usize {
+        let bank = &self.banks[bank_idx];
+
+        match &bank.frame_table {
+            Some(frame_table) => self.bank_size.saturating_sub(frame_table.lock().unwrap().reserved_frames * PAGE_SIZE),
+            None => self.bank_size - bank.current_data_idx.load(Ordering::Acquire),
+        }
+    }
+
+    pub fn get_used_memory(&self) -> usize {
+        self.banks.iter()
+            .map(|bank| match &bank.frame_table {
+                Some(frame_table) => self.bank_size - frame_table.lock().unwrap().free_frames.len() * PAGE_SIZE,
+                None => bank.current_data_idx.load(Ordering::Acquire),
+            })
+            .sum()
+    }
+
+    /// Words of admission capacity a program of `program_size` words takes.
+    pub fn get_admission_size(&self, program_size: usize) -> usize {
+        if self.is_demand_paged() {
+            reserved_frames_for(program_size.div_ceil(PAGE_SIZE)) * PAGE_SIZE
+        } else {
+            program_size
+        }
+    }
+
+    pub fn get_memory_size(&self) -> usize {
+        self.banks.len() * self.bank_size
+    }
+
+    pub fn get_bank_count(&self) -> usize {
+        self.banks.len()
+    }
+
+    pub fn get_bank_size(&self) -> usize {
+        self.bank_size
+    }
+
+    /// The bank holding a physical address.
+    pub fn get_bank_for(&self, address: usize) -> usize {
+        address / self.bank_size
+    }
+
+    /// The bank CPU `cpu` runs processes from when it has the choice, spreading the CPUs evenly
+    /// over the banks.
+    pub fn get_bank_for_cpu(&self, cpu: usize) -> usize {
+        cpu % self.banks.len()
     }
 }
 
@@ -95,6 +674,8 @@ impl Memory {
 mod tests {
     use super::*;
 
+    use crate::kernel::allocation_counter::count_allocations;
+
     #[test]
     fn test_memory_read_from() {
         let memory = Memory::new();
@@ -110,7 +691,7 @@ mod tests {
 
     #[test]
     fn test_memory_write_to() {
-        let mut memory = Memory::new();
+        let memory = Memory::new();
         memory.write_to(0, 10);
         assert_eq!(memory.read_from(0), 10);
     }
@@ -118,7 +699,7 @@ mod tests {
     #[test]
     #[should_panic]
     fn test_memory_out_of_bounds_write_to() {
-        let mut memory = Memory::new();
+        let memory = Memory::new();
         memory.write_to(1024, 10);
     }
 
@@ -129,11 +710,83 @@ mod tests {
         assert_eq!(block, &[0, 0, 0, 0, 0]);
     }
 
+    #[test]
+    fn test_memory_read_block_from_whole_memory() {
+        let memory = Memory::new();
+        memory.write_to(1023, 9);
+
+        let block = memory.read_block_from(0, 1024);
+        assert_eq!(block.len(), 1024);
+        assert_eq!(block[1023], 9);
+        assert_eq!(memory.read_block_from(1024, 1024), vec![]);
+    }
+
     #[test]
     #[should_panic]
     fn test_memory_out_of_bounds_read_block_from() {
         let memory = Memory::new();
-        memory.read_block_from(0, 1024);
+        memory.read_block_from(0, 1025);
+    }
+
+    #[test]
+    fn test_memory_read_block_and_read_block_into() {
+        let memory = Memory::with_config(MemoryConfig { size: 2048, bank_count: 2, demand_paging: false });
+        memory.write_block_to(1020, &[1, 2, 3, 4, 5, 6, 7, 8]);
+
+        assert_eq!(&*memory.read_block(1020, 1024), &[1, 2, 3, 4]);
+        assert_eq!(&*memory.read_block(2048, 2048), &[] as &[u32]);
+
+        let mut buffer = [0; 8];
+        memory.read_block_into(1020, &mut buffer);
+        assert_eq!(buffer, [1, 2, 3, 4, 5, 6, 7, 8]);
+    }
+
+    #[test]
+    #[should_panic]
+    fn test_memory_read_block_across_banks() {
+        let memory = Memory::with_config(MemoryConfig { size: 2048, bank_count: 2, demand_paging: false });
+        memory.read_block(1020, 1028);
+    }
+
+    #[test]
+    fn test_memory_block_reads_do_not_allocate() {
+        let memory = Memory::with_config(MemoryConfig { size: 2048, bank_count: 2, demand_paging: false });
+        let mut buffer = vec![0; 1024];
+        // The first access on a thread registers its instrumentation.
+        memory.read_from(0);
+
+        assert_eq!(count_allocations(|| {
+            assert_eq!(memory.read_block(0, 1024).len(), 1024);
+            memory.read_block_into(512, &mut buffer);
+            memory.read_block_into(1024, &mut buffer);
+            memory.core_dump();
+        }), 0);
+        assert!(count_allocations(|| { memory.read_block_from(0, 16); }) > 0);
+    }
+
+    #[test]
+    fn test_memory_counts_lock_waits() {
+        let memory = Memory::new();
+        let block = memory.read_block(0, 4);
+        let (writing_sender, writing) = std::sync::mpsc::channel();
+
+        std::thread::scope(|scope| {
+            let writer = std::thread::Builder::new().name("test-memory-lock-waits".to_string()).spawn_scoped(scope, || {
+                writing_sender.send(()).unwrap();
+                memory.write_to(1, 9);
+            }).unwrap();
+
+            writing.recv().unwrap();
+            std::thread::sleep(std::time::Duration::from_millis(20));
+            drop(block);
+            writer.join().unwrap();
+        });
+
+        let snapshot = instrumentation::snapshot();
+        assert_eq!(snapshot.get_thread_counter("test-memory-lock-waits", Counter::MemoryLockWaits), 1);
+        assert!(snapshot.get_thread_counter("test-memory-lock-waits", Counter::MemoryLockWaitNanos) > 0);
+        assert_eq!(snapshot.get_thread_counter("test-memory-lock-waits", Counter::MemoryWriteWords), 1);
+        assert_eq!(memory.read_from(1), 9);
     }
 
     #[test]
@@ -145,7 +798,7 @@ mod tests {
 
     #[test]
     fn test_memory_write_block_to() {
-        let mut memory = Memory::new();
+        let memory = Memory::new();
         let block = [1, 2, 3, 4, 5];
         memory.write_block_to(0, &block);
         let block = memory.read_block_from(0, 5);
@@ -155,14 +808,14 @@ mod tests {
     #[test]
     #[should_panic]
     fn test_memory_out_of_bounds_write_block_to() {
-        let mut memory = Memory::new();
+        let memory = Memory::new();
         let block = [1, 2, 3, 4, 5];
         memory.write_block_to(1020, &block);
     }
 
     #[test]
     fn test_memory_create_process_then_get_pcb_for() {
-        let mut memory = Memory::new();
+        let memory = Memory::new();
         let program_info = ProgramInfo {
             id: 1,
             priority: 1,
@@ -177,8 +830,33 @@ mod tests {
         let pcb = memory.get_pcb_for(1);
         assert_eq!(pcb.id, 1);
         assert_eq!(pcb.priority, 1);
-        assert_eq!(pcb.mem_start_address, 0);
-        assert_eq!(pcb.mem_end_address, 5);
+        assert_eq!(pcb.get_mem_start_address(), 0);
+        assert_eq!(pcb.get_mem_end_address(), 5);
+    }
+
+    #[test]
+    fn test_memory_create_processes() {
+        let memory = Memory::new();
+        let program_infos: Vec<_> = (1..=3)
+            .map(|id| ProgramInfo {
+                id,
+                priority: 1,
+                instruction_buffer_size: 1,
+                in_buffer_size: 1,
+                out_buffer_size: 1,
+                temp_buffer_size: id as usize,
+                data_start_idx: 0
+            })
+            .collect();
+        let program_data = [7; 6];
+        let programs: Vec<_> = program_infos.iter().map(|info| (info, &program_data[..3 + info.id as usize])).collect();
+
+        memory.create_processes(&programs);
+
+        assert_eq!(memory.get_used_memory(), 15);
+        assert_eq!(memory.get_pcb_for(2).get_mem_start_address(), 4);
+        assert_eq!(memory.get_pcb_for(3).get_mem_end_address(), 15);
+        assert_eq!(memory.read_block_from(0, 15), vec![7; 15]);
     }
 
     #[test]
@@ -190,7 +868,7 @@ mod tests {
 
     #[test]
     fn test_memory_core_dump() {
-        let mut memory = Memory::new();
+        let memory = Memory::new();
         let program_info = ProgramInfo {
             id: 1,
             priority: 1,
@@ -203,13 +881,214 @@ mod tests {
         let program_data = [1, 2, 3, 4, 5];
         memory.create_process(&program_info, &program_data);
         memory.core_dump();
-        assert_eq!(memory.pcb_map.len(), 0);
+        assert_eq!(memory.pcb_map.read().unwrap().len(), 0);
         assert_eq!(memory.read_from(0), 0);
     }
 
+    #[test]
+    fn test_memory_free_process_reclaims_top() {
+        let memory = Memory::new();
+        for id in 1..=2 {
+            let program_info = ProgramInfo {
+                id,
+                priority: 1,
+                instruction_buffer_size: 1,
+                in_buffer_size: 1,
+                out_buffer_size: 1,
+                temp_buffer_size: 2,
+                data_start_idx: 0
+            };
+            memory.create_process(&program_info, &[1, 2, 3, 4, 5]);
+        }
+
+        memory.free_process(1);
+        assert_eq!(memory.get_used_memory(), 10);
+
+        memory.free_process(2);
+        assert_eq!(memory.get_used_memory(), 0);
+    }
+
+    #[test]
+    #[should_panic]
+    fn test_memory_free_process_invalid_id() {
+        let memory = Memory::new();
+        memory.free_process(1);
+    }
+
+    #[test]
+    fn test_memory_demand_paged_create_process() {
+        let memory = Memory::with_demand_paging();
+        let program_info = ProgramInfo {
+            id: 1,
+            priority: 1,
+            instruction_buffer_size: 20,
+            in_buffer_size: 10,
+            out_buffer_size: 0,
+            temp_buffer_size: 10,
+            data_start_idx: 0
+        };
+        let program_data: Vec<u32> = (0..40).collect();
+        memory.create_process(&program_info, &program_data);
+
+        let pcb = memory.get_pcb_for(1);
+        let page_table = pcb.page_table.as_ref().unwrap();
+        let frame = page_table.get_frame_for(0).unwrap();
+
+        assert_eq!(page_table.get_page_count(), 3);
+        assert_eq!(page_table.get_resident_count(), 1);
+        assert_eq!(memory.read_from(frame * PAGE_SIZE + 5), 5);
+        assert_eq!(memory.get_used_memory(), PAGE_SIZE);
+        assert_eq!(memory.get_remaining_memory(), memory.get_memory_size() - 3 * PAGE_SIZE);
+
+        memory.free_process(1);
+        assert_eq!(memory.get_used_memory(), 0);
+        assert_eq!(memory.get_remaining_memory(), memory.get_memory_size());
+        assert_eq!(memory.get_frame_owners(), vec![]);
+    }
+
+    #[test]
+    fn test_memory_page_out_then_page_in() {
+        let memory = Memory::with_demand_paging();
+        let program_info = ProgramInfo {
+            id: 1,
+            priority: 1,
+            instruction_buffer_size: 4,
+            in_buffer_size: 0,
+            out_buffer_size: 0,
+            temp_buffer_size: 0,
+            data_start_idx: 0
+        };
+        memory.create_process(&program_info, &[1, 2, 3, 4]);
+        let pcb = memory.get_pcb_for(1);
+
+        let mut page = [0; 4];
+        let frame = memory.page_out(&pcb, 0, &mut page);
+        memory.release_frame(frame);
+
+        assert_eq!(page, [1, 2, 3, 4]);
+        assert_eq!(pcb.get_resident_words(), 0);
+
+        let frame = memory.allocate_frame(&pcb, 0).unwrap();
+        memory.page_in(&pcb, 0, frame, &page);
+
+        assert_eq!(memory.get_frame_owners()[0].1.loaded_at, 2);
+        assert_eq!(pcb.get_resident_words(), PAGE_SIZE);
+    }
+
+    #[test]
+    fn test_memory_banks() {
+        let memory = Memory::with_config(MemoryConfig { size: 4096, bank_count: 4, demand_paging: false });
+        let program_infos: Vec<_> = (1..=3)
+            .map(|id| ProgramInfo {
+                id,
+                priority: 1,
+                instruction_buffer_size: 1,
+                in_buffer_size: 1,
+                out_buffer_size: 1,
+                temp_buffer_size: 97,
+                data_start_idx: 0
+            })
+            .collect();
+        let program_data = [7; 100];
+
+        memory.create_processes_in(2, &[(&program_infos[0], &program_data), (&program_infos[1], &program_data)]);
+        memory.create_process(&program_infos[2], &program_data);
+
+        assert_eq!(memory.get_bank_size(), 1024);
+        assert_eq!(memory.get_pcb_for(2).get_mem_start_address(), 2148);
+        assert_eq!(memory.get_bank_for(memory.get_pcb_for(2).get_mem_start_address()), 2);
+        assert_eq!(memory.get_pcb_for(3).bank, 0);
+        assert_eq!(memory.get_remaining_memory_in(2), 824);
+        assert_eq!(memory.get_used_memory(), 300);
+
+        memory.write_block_to(1020, &[1, 2, 3, 4, 5, 6, 7, 8]);
+        assert_eq!(memory.read_block_from(1020, 1028), vec![1, 2, 3, 4, 5, 6, 7, 8]);
+
+        memory.free_process(2);
+        memory.free_process(3);
+        assert_eq!(memory.get_remaining_memory_in(0), 1024);
+        assert_eq!(memory.get_remaining_memory_in(2), 924);
+    }
+
+    #[test]
+    fn test_memory_demand_paged_banks_prefer_local_frames() {
+        let memory = Memory::with_config(MemoryConfig { size: 6 * PAGE_SIZE, bank_count: 2, demand_paging: true });
+        let program_info = ProgramInfo {
+            id: 1,
+            priority: 1,
+            instruction_buffer_size: 4 * PAGE_SIZE,
+            in_buffer_size: 0,
+            out_buffer_size: 0,
+            temp_buffer_size: 0,
+            data_start_idx: 0
+        };
+        memory.create_processes_in(1, &[(&program_info, &[5; 4 * PAGE_SIZE])]);
+        let pcb = memory.get_pcb_for(1);
+
+        assert_eq!(pcb.page_table.as_ref().unwrap().get_frame_for(0), Some(3));
+        assert_eq!((1..4).map(|page| memory.allocate_frame(&pcb, page)).collect::<Vec<_>>(), vec![Some(4), Some(5), Some(0)]);
+        assert_eq!(memory.get_remaining_memory_in(0), 3 * PAGE_SIZE);
+        assert_eq!(memory.get_remaining_memory_in(1), 0);
+
+        // Load order spans the banks, and a reloaded frame moves to the back.
+        let load_order = || std::iter::successors(memory.get_next_loaded_frame(None), |&frame| memory.get_next_loaded_frame(Some(frame))).collect::<Vec<_>>();
+        assert_eq!(load_order(), vec![3, 4, 5, 0]);
+        memory.release_frame(4);
+        memory.release_frame(0);
+        assert_eq!(load_order(), vec![3, 5]);
+        assert_eq!(memory.allocate_frame(&pcb, 1), Some(4));
+        assert_eq!(load_order(), vec![3, 5, 4]);
+        assert_eq!(memory.get_frame_owner(4).map(|(owner, pcb)| (owner.page, pcb.id)), Some((1, 1)));
+        assert!(memory.get_frame_owner(0).is_none());
+    }
+
+    #[test]
+    #[should_panic]
+    fn test_memory_uneven_banks() {
+        Memory::with_config(MemoryConfig { size: 1000, bank_count: 3, demand_paging: false });
+    }
+
+    #[test]
+    fn test_memory_compact() {
+        let memory = Memory::new();
+        let program_infos: Vec<_> = (1..=4)
+            .map(|id| ProgramInfo {
+                id,
+                priority: 1,
+                instruction_buffer_size: 1,
+                in_buffer_size: 1,
+                out_buffer_size: 1,
+                temp_buffer_size: 7,
+                data_start_idx: 0
+            })
+            .collect();
+        for info in &program_infos {
+            memory.create_process(info, &[info.id; 10]);
+        }
+
+        memory.free_process(1);
+        memory.free_process(3);
+        assert_eq!(memory.get_fragmented_memory(), 20);
+
+        // Process 4 is running, so only process 2 moves.
+        let pcb = memory.get_pcb_for(4);
+        let context = pcb.context.lock().unwrap();
+        assert_eq!(memory.compact(), CompactionStats { moved_processes: 1, moved_words: 10, reclaimed_words: 0 });
+        assert_eq!(memory.get_pcb_for(2).get_mem_start_address(), 0);
+        assert_eq!(memory.read_block_from(0, 10), vec![2; 10]);
+        assert_eq!(memory.get_fragmented_memory(), 20);
+        drop(context);
+
+        assert_eq!(memory.compact(), CompactionStats { moved_processes: 1, moved_words: 10, reclaimed_words: 20 });
+        assert_eq!((pcb.get_mem_start_address(), pcb.get_mem_end_address()), (10, 20));
+        assert_eq!(memory.read_block_from(10, 20), vec![4; 10]);
+        assert_eq!(memory.get_fragmented_memory(), 0);
+        assert_eq!(memory.get_remaining_memory(), 1004);
+    }
+
     #[test]
     fn test_memory_get_remaining_memory() {
-        let mut memory = Memory::new();
+        let memory = Memory::new();
         let program_info = ProgramInfo {
             id: 1,
             priority: 1,
@@ -0,0 +1,279 @@
+use std::io::Write;
+use std::sync::atomic::{AtomicBool, AtomicU64, AtomicUsize, Ordering};
+use std::time::Duration;
+
+use super::cpu::ExecutionStats;
+use super::memory::CompactionStats;
+
+/// Larger runs only print the totals; the per job rows are still written by `write_csv`.
+const SUMMARY_ROW_LIMIT: usize = 64;
+
+#[derive(Default)]
+struct JobMetrics {
+    admitted_at: AtomicU64,
+    ready_at: AtomicU64,
+    /// When the job last joined the ready queue.
+    queued_at: AtomicU64,
+    /// Time spent in the ready queue over every dispatch.
+    wait_cycles: AtomicU64,
+    dispatched_at: AtomicU64,
+    completed_at: AtomicU64,
+    cpu_cycles: AtomicU64,
+    io_operations: AtomicU64,
+    ram_words: AtomicU64,
+    page_faults: AtomicU64,
+    dispatched: AtomicBool,
+    faulted: AtomicBool,
+}
+
+/// A copy of one job's metrics. Times are in clock cycles.
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub struct JobSnapshot {
+    pub admitted_at: u64,
+    /// When the job first became ready, and first ran.
+    pub ready_at: u64,
+    pub dispatched_at: u64,
+    pub completed_at: u64,
+    pub cpu_cycles: u64,
+    pub io_operations: u64,
+    pub ram_words: u64,
+    pub page_faults: u64,
+    pub wait_cycles: u64,
+    pub faulted: bool,
+}
+
+impl JobSnapshot {
+    /// Time spent in the ready queue, including every return to it after a page fault or swap.
+    pub fn wait_time(&self) -> u64 {
+        self.wait_cycles
+    }
+
+    /// Time from admission to completion.
+    pub fn turnaround_time(&self) -> u64 {
+        self.completed_at - self.admitted_at
+    }
+}
+
+/// Per job metrics indexed by process id. Every slot is allocated up front so recording a state
+/// transition is a few relaxed atomic stores and never allocates.
+pub struct MetricsTable {
+    jobs: Box<[JobMetrics]>,
+    memory_size: usize,
+    peak_ram_words: AtomicUsize,
+    compactions: AtomicU64,
+    compaction_pause_nanos: AtomicU64,
+    longest_compaction_pause_nanos: AtomicU64,
+    compaction_reclaimed_words: AtomicU64,
+}
+
+impl MetricsTable {
+    pub fn new(capacity: usize, memory_size: usize) -> MetricsTable {
+        MetricsTable {
+            jobs: (0..capacity).map(|_| JobMetrics::default()).collect(),
+            memory_size,
+            peak_ram_words: AtomicUsize::new(0),
+            compactions: AtomicU64::new(0),
+            compaction_pause_nanos: AtomicU64::new(0),
+            longest_compaction_pause_nanos: AtomicU64::new(0),
+            compaction_reclaimed_words: AtomicU64::new(0),
+        }
+    }
+
+    fn slot(&self, process_id: u32) -> &JobMetrics {
+        match self.jobs.get(process_id as usize) {
+            Some(job) => job,
+            _ => panic!("Process id {} exceeds metrics table capacity", process_id),
+        }
+    }
+
+    pub fn record_admission(&self, process_id: u32, now: u64, ram_words: usize, used_memory: usize) {
+        let job = self.slot(process_id);
+        job.admitted_at.store(now, Ordering::Relaxed);
+        job.ram_words.store(ram_words as u64, Ordering::Relaxed);
+
+        self.peak_ram_words.fetch_max(used_memory, Ordering::Relaxed);
+    }
+
+    /// Notes memory use outside admission, such as pages loaded on a fault.
+    pub fn record_memory_usage(&self, used_memory: usize) {
+        self.peak_ram_words.fetch_max(used_memory, Ordering::Relaxed);
+    }
+
+    /// Notes a memory compaction and the wall clock time it held up admission for.
+    pub fn record_compaction(&self, pause: Duration, stats: CompactionStats) {
+        let pause_nanos = pause.as_nanos() as u64;
+
+        self.compactions.fetch_add(1, Ordering::Relaxed);
+        self.compaction_pause_nanos.fetch_add(pause_nanos, Ordering::Relaxed);
+        self.longest_compaction_pause_nanos.fetch_max(pause_nanos, Ordering::Relaxed);
+        self.compaction_reclaimed_words.fetch_add(stats.reclaimed_words as u64, Ordering::Relaxed);
+    }
+
+    pub fn get_compactions(&self) -> u64 {
+        self.compactions.load(Ordering::Relaxed)
+    }
+
+    /// Notes the job joining the ready queue, on admission or on its way back to a CPU.
+    pub fn record_ready(&self, process_id: u32, now: u64) {
+        let job = self.slot(process_id);
+        job.queued_at.store(now, Ordering::Relaxed);
+
+        if !job.dispatched.load(Ordering::Relaxed) {
+            job.ready_at.store(now, Ordering::Relaxed);
+        }
+    }
+
+    /// Adds the time since the job last became ready to its wait. Only the first dispatch is
+    /// kept as its dispatch time.
+    pub fn record_dispatch(&self, process_id: u32, now: u64) {
+        let job = self.slot(process_id);
+        job.wait_cycles.fetch_add(now.saturating_sub(job.queued_at.load(Ordering::Relaxed)), Ordering::Relaxed);
+
+        if !job.dispatched.swap(true, Ordering::Relaxed) {
+            job.dispatched_at.store(now, Ordering::Relaxed);
+        }
+    }
+
+    pub fn record_page_fault(&self, process_id: u32) {
+        self.slot(process_id).page_faults.fetch_add(1, Ordering::Relaxed);
+    }
+
+    pub fn record_completion(&self, process_id: u32, now: u64, stats: ExecutionStats, faulted: bool) {
+        let job = self.slot(process_id);
+        job.completed_at.store(now, Ordering::Relaxed);
+        job.cpu_cycles.store(stats.cycles, Ordering::Relaxed);
+        job.io_operations.store(stats.io_operations, Ordering::Relaxed);
+        job.faulted.store(faulted, Ordering::Relaxed);
+    }
+
+    pub fn snapshot(&self, process_id: u32) -> JobSnapshot {
+        let job = self.slot(process_id);
+
+        JobSnapshot {
+            admitted_at: job.admitted_at.load(Ordering::Relaxed),
+            ready_at: job.ready_at.load(Ordering::Relaxed),
+            dispatched_at: job.dispatched_at.load(Ordering::Relaxed),
+            completed_at: job.completed_at.load(Ordering::Relaxed),
+            cpu_cycles: job.cpu_cycles.load(Ordering::Relaxed),
+            io_operations: job.io_operations.load(Ordering::Relaxed),
+            ram_words: job.ram_words.load(Ordering::Relaxed),
+            page_faults: job.page_faults.load(Ordering::Relaxed),
+            wait_cycles: job.wait_cycles.load(Ordering::Relaxed),
+            faulted: job.faulted.load(Ordering::Relaxed),
+        }
+    }
+
+    pub fn print_summary(&self, process_ids: &[u32]) {
+        let print_rows = process_ids.len() <= SUMMARY_ROW_LIMIT;
+        if print_rows {
+            println!("{:>6} {:>8} {:>10} {:>8} {:>6} {:>6}", "Job", "Wait", "Complete", "Cycles", "I/O", "RAM");
+        }
+
+        let mut total_wait = 0;
+        let mut total_turnaround = 0;
+        let mut makespan = 0;
+        let mut total_page_faults = 0;
+
+        for &process_id in process_ids {
+            let job = self.snapshot(process_id);
+            let status = if job.faulted { " faulted" } else { "" };
+
+            if print_rows {
+                println!("{:>6} {:>8} {:>10} {:>8} {:>6} {:>6}{}",
+                         process_id, job.wait_time(), job.completed_at, job.cpu_cycles, job.io_operations, job.ram_words, status);
+            }
+
+            total_wait += job.wait_time();
+            total_turnaround += job.turnaround_time();
+            makespan = makespan.max(job.completed_at);
+            total_page_faults += job.page_faults;
+        }
+
+        let job_count = process_ids.len().max(1) as u64;
+        let peak_ram_words = self.peak_ram_words.load(Ordering::Relaxed);
+
+        println!("Jobs: {}, makespan: {} cycles, average wait: {} cycles, average turnaround: {} cycles",
+                 process_ids.len(), makespan, total_wait / job_count, total_turnaround / job_count);
+        println!("Peak RAM usage: {}/{} words ({:.1}%)",
+                 peak_ram_words, self.memory_size, 100.0 * peak_ram_words as f64 / self.memory_size as f64);
+
+        if total_page_faults > 0 {
+            println!("Page faults: {}, {:.1} per job", total_page_faults, total_page_faults as f64 / job_count as f64);
+        }
+
+        let compactions = self.compactions.load(Ordering::Relaxed);
+        if compactions > 0 {
+            println!("Compactions: {}, average pause: {:.1} us, longest pause: {:.1} us, {} words reclaimed",
+                     compactions,
+                     self.compaction_pause_nanos.load(Ordering::Relaxed) as f64 / compactions as f64 / 1e3,
+                     self.longest_compaction_pause_nanos.load(Ordering::Relaxed) as f64 / 1e3,
+                     self.compaction_reclaimed_words.load(Ordering::Relaxed));
+        }
+    }
+
+    pub fn write_csv<W: Write>(&self, writer: &mut W, process_ids: &[u32]) -> std::io::Result<()> {
+        writeln!(writer, "job,admitted_at,ready_at,dispatched_at,completed_at,wait_time,turnaround_time,cpu_cycles,io_operations,ram_words,page_faults,faulted")?;
+
+        for &process_id in process_ids {
+            let job = self.snapshot(process_id);
+
+            writeln!(writer, "{},{},{},{},{},{},{},{},{},{},{},{}",
+                     process_id, job.admitted_at, job.ready_at, job.dispatched_at, job.completed_at,
+                     job.wait_time(), job.turnaround_time(), job.cpu_cycles, job.io_operations, job.ram_words,
+                     job.page_faults, job.faulted)?;
+        }
+
+        Ok(())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn record_job(metrics: &MetricsTable) {
+        metrics.record_admission(1, 2, 10, 10);
+        metrics.record_ready(1, 3);
+        metrics.record_dispatch(1, 7);
+        metrics.record_page_fault(1);
+        metrics.record_ready(1, 10);
+        metrics.record_dispatch(1, 12);
+        metrics.record_completion(1, 20, ExecutionStats { cycles: 13, io_operations: 4 }, false);
+    }
+
+    #[test]
+    fn test_metrics_table_record_then_snapshot() {
+        let metrics = MetricsTable::new(4, 1024);
+        record_job(&metrics);
+
+        let job = metrics.snapshot(1);
+
+        // Waited 4 cycles before the first dispatch and 2 after the page fault.
+        assert_eq!(job.wait_time(), 6);
+        assert_eq!((job.ready_at, job.dispatched_at), (3, 7));
+        assert_eq!(job.turnaround_time(), 18);
+        assert_eq!(job.cpu_cycles, 13);
+        assert_eq!(job.io_operations, 4);
+        assert_eq!(job.ram_words, 10);
+        assert!(!job.faulted);
+    }
+
+    #[test]
+    fn test_metrics_table_write_csv() {
+        let metrics = MetricsTable::new(4, 1024);
+        record_job(&metrics);
+
+        let mut csv = Vec::new();
+        metrics.write_csv(&mut csv, &[1]).unwrap();
+        let csv = String::from_utf8(csv).unwrap();
+
+        assert_eq!(csv.lines().nth(1), Some("1,2,3,7,20,6,18,13,4,10,1,false"));
+    }
+
+    #[test]
+    #[should_panic]
+    fn test_metrics_table_out_of_capacity() {
+        let metrics = MetricsTable::new(4, 1024);
+        metrics.record_ready(4, 0);
+    }
+}
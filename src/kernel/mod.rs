@@ -1,13 +1,37 @@
-mod long_term_scheduler;
-mod memory;
-mod process_control_block;
-mod short_term_scheduler;
+pub mod affinity;
+#[cfg(test)]
+mod allocation_counter;
+pub mod clock;
+pub mod cpu;
+pub mod executor;
+pub mod instrumentation;
+pub mod lockstep_cpu;
+pub mod long_term_scheduler;
+pub mod medium_term_scheduler;
+pub mod memory;
+pub mod metrics;
+pub mod pager;
+pub mod paging;
+pub mod process_control_block;
+pub mod profiler;
+pub mod short_term_scheduler;
+pub mod timing_wheel;
+pub mod tracer;
 
-use long_term_scheduler::LongTermScheduler;
-use memory::Memory;
-use process_control_block::ProcessControlBlock;
-use short_term_scheduler::{FifoQueue, PriorityQueue, ShortTermScheduler};
+pub use affinity::Affinity;
+pub use clock::Clock;
+pub use cpu::CPU;
+pub use lockstep_cpu::LockstepCPU;
+pub use long_term_scheduler::{AdmissionPolicy, LongTermScheduler};
+pub use medium_term_scheduler::MediumTermScheduler;
+pub use memory::{CompactionStats, Memory, MemoryConfig};
+pub use metrics::MetricsTable;
+pub use pager::{Pager, PageReplacement, ReplacementPolicy};
+pub use paging::PageTable;
+pub use process_control_block::ProcessControlBlock;
+pub use short_term_scheduler::{FifoQueue, IdleStrategy, PriorityQueue, SchedulerQueue, ShortTermScheduler, Termination};
+pub use timing_wheel::TimingWheel;
 
 pub mod driver;
 
-pub use driver::Driver;
\ No newline at end of file
+pub use driver::{Driver, DriverConfig, Engine, ExecutionMode};
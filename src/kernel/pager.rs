@@ -0,0 +1,353 @@
+use std::sync::Arc;
+
+use super::{Memory, ProcessControlBlock};
+use super::memory::FrameOwner;
+use super::paging::PAGE_SIZE;
+
+use crate::io::Disk;
+
+/// Cycles a faulted page takes to come in from disk, a little less than a typical job runs for.
+pub const DEFAULT_PAGE_IN_CYCLES: u64 = 100;
+
+/// Selects the replacement policy the pager evicts pages with.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum PageReplacement {
+    Fifo,
+    Lru,
+    Clock,
+}
+
+impl PageReplacement {
+    pub fn create_policy(self) -> Box<dyn ReplacementPolicy> {
+        match self {
+            PageReplacement::Fifo => Box::new(FifoReplacement::new()),
+            PageReplacement::Lru => Box::new(LruReplacement::new()),
+            PageReplacement::Clock => Box::new(ClockReplacement::new()),
+        }
+    }
+}
+
+/// A page resident in memory, offered to a replacement policy as a possible victim.
+pub struct ResidentPage {
+    pub frame: usize,
+    pub owner: FrameOwner,
+    pub pcb: Arc<ProcessControlBlock>,
+}
+
+impl ResidentPage {
+    fn of_frame(memory: &Memory, frame: usize) -> Option<ResidentPage> {
+        let (owner, pcb) = memory.get_frame_owner(frame)?;
+        Some(ResidentPage { frame, owner, pcb })
+    }
+
+    /// Returns and clears the page's referenced bit.
+    pub fn take_referenced(&self) -> bool {
+        self.pcb.page_table.as_ref().unwrap().take_referenced(self.owner.page)
+    }
+}
+
+/// Chooses which page to evict when a page fault finds no free frame.
+pub trait ReplacementPolicy {
+    /// Returns the page of `memory` to evict. Pages for which `pinned` is true belong to a
+    /// running process and must not be chosen.
+    fn choose_victim(&mut self, memory: &Memory, pinned: &dyn Fn(&ResidentPage) -> bool) -> Option<ResidentPage>;
+}
+
+/// Evicts the page that has been resident the longest. The memory keeps its frames in load
+/// order, so this walks only past the pinned pages at the front.
+pub struct FifoReplacement;
+
+impl FifoReplacement {
+    pub fn new() -> FifoReplacement {
+        FifoReplacement
+    }
+}
+
+impl ReplacementPolicy for FifoReplacement {
+    fn choose_victim(&mut self, memory: &Memory, pinned: &dyn Fn(&ResidentPage) -> bool) -> Option<ResidentPage> {
+        let mut frame = memory.get_next_loaded_frame(None);
+
+        while let Some(page) = frame.and_then(|frame| ResidentPage::of_frame(memory, frame)) {
+            if !pinned(&page) {
+                return Some(page);
+            }
+            frame = memory.get_next_loaded_frame(Some(page.frame));
+        }
+
+        None
+    }
+}
+
+/// Approximates least recently used with aging. Every eviction shifts each page's referenced bit
+/// into the top of an 8-bit age, and the page with the lowest age goes. Unlike the other
+/// policies it visits every resident page on each eviction.
+pub struct LruReplacement {
+    /// Age of each frame, tagged with the load it belongs to so a reused frame starts over.
+    ages: Vec<(u64, u8)>,
+}
+
+impl LruReplacement {
+    pub fn new() -> LruReplacement {
+        LruReplacement {
+            ages: Vec::new(),
+        }
+    }
+}
+
+impl ReplacementPolicy for LruReplacement {
+    fn choose_victim(&mut self, memory: &Memory, pinned: &dyn Fn(&ResidentPage) -> bool) -> Option<ResidentPage> {
+        let frame_count = memory.get_frame_count();
+        if self.ages.len() < frame_count {
+            self.ages.resize(frame_count, (0, 0));
+        }
+
+        let mut victim: Option<((u8, u64), ResidentPage)> = None;
+        memory.visit_frame_owners(|frame, owner, pcb| {
+            let (loaded_at, age) = &mut self.ages[frame];
+            if *loaded_at != owner.loaded_at {
+                *loaded_at = owner.loaded_at;
+                *age = 0;
+            }
+
+            let referenced = pcb.page_table.as_ref().unwrap().take_referenced(owner.page);
+            *age = (*age >> 1) | ((referenced as u8) << 7);
+
+            // Only a page that would beat the current victim is worth checking for a pin.
+            let key = (*age, owner.loaded_at);
+            if victim.as_ref().is_some_and(|(victim_key, _)| *victim_key < key) {
+                return;
+            }
+
+            let page = ResidentPage { frame, owner, pcb: pcb.clone() };
+            if !pinned(&page) {
+                victim = Some((key, page));
+            }
+        });
+
+        victim.map(|(_, page)| page)
+    }
+}
+
+/// Second chance replacement. A hand sweeps the frames in order, clearing referenced bits, and
+/// evicts the first page found unreferenced.
+pub struct ClockReplacement {
+    hand: usize,
+}
+
+impl ClockReplacement {
+    pub fn new() -> ClockReplacement {
+        ClockReplacement {
+            hand: 0,
+        }
+    }
+}
+
+impl ReplacementPolicy for ClockReplacement {
+    fn choose_victim(&mut self, memory: &Memory, pinned: &dyn Fn(&ResidentPage) -> bool) -> Option<ResidentPage> {
+        let frame_count = memory.get_frame_count();
+
+        // Two sweeps suffice: the first clears every referenced bit it passes.
+        for step in 0..2 * frame_count {
+            let Some(page) = ResidentPage::of_frame(memory, (self.hand + step) % frame_count) else { continue };
+
+            if pinned(&page) || page.take_referenced() {
+                continue;
+            }
+
+            self.hand = page.frame + 1;
+            return Some(page);
+        }
+
+        None
+    }
+}
+
+/// Services page faults of demand paged processes by copying the missing page in from disk.
+/// When no frame is free, the replacement policy picks a page to evict, which is written back to
+/// its process's disk extent if it was modified.
+pub struct Pager {
+    policy: Box<dyn ReplacementPolicy>,
+    page_buffer: [u32; PAGE_SIZE],
+    evictions: u64,
+    write_backs: u64,
+}
+
+impl Pager {
+    pub fn new(policy: Box<dyn ReplacementPolicy>) -> Pager {
+        Pager {
+            policy,
+            page_buffer: [0; PAGE_SIZE],
+            evictions: 0,
+            write_backs: 0,
+        }
+    }
+
+    pub fn get_evictions(&self) -> u64 {
+        self.evictions
+    }
+
+    pub fn get_write_backs(&self) -> u64 {
+        self.write_backs
+    }
+
+    /// Loads the page the process faulted on. Fails when every frame belongs to a process that
+    /// is running, in which case the fault should be retried after the next termination.
+    pub fn handle_page_fault(&mut self, disk: &mut Disk, memory: &Memory, pcb: &Arc<ProcessControlBlock>) -> Result<(), &'static str> {
+        let page_table = pcb.page_table.as_ref().ok_or("Process is not demand paged")?;
+        let page = page_table.get_faulted_page();
+
+        let frame = match memory.allocate_frame(pcb, page) {
+            Some(frame) => frame,
+            None => {
+                self.evict(disk, memory)?;
+                memory.allocate_frame(pcb, page).ok_or("No frame available")?
+            }
+        };
+
+        let page_start = page * PAGE_SIZE;
+        let program_data = disk.read_data_for(disk.get_info_for(pcb.id));
+        memory.page_in(pcb, page, frame, &program_data[page_start..page_start + page_table.get_page_length(page)]);
+
+        Ok(())
+    }
+
+    fn evict(&mut self, disk: &mut Disk, memory: &Memory) -> Result<(), &'static str> {
+        // A running process holds its context lock, and its pages must stay where they are.
+        let pinned = |page: &ResidentPage| page.pcb.context.try_lock().is_err();
+        let victim = self.policy.choose_victim(memory, &pinned).ok_or("No frame available")?;
+        let Ok(_context) = victim.pcb.context.try_lock() else { return Err("No frame available") };
+
+        let page_table = victim.pcb.page_table.as_ref().unwrap();
+        let page_data = &mut self.page_buffer[..page_table.get_page_length(victim.owner.page)];
+
+        memory.page_out(&victim.pcb, victim.owner.page, page_data);
+        memory.release_frame(victim.frame);
+        self.evictions += 1;
+
+        if page_table.take_dirty(victim.owner.page) {
+            disk.write_data_for(victim.owner.process_id, victim.owner.page * PAGE_SIZE, page_data);
+            self.write_backs += 1;
+        }
+
+        Ok(())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::kernel::allocation_counter::count_allocations;
+    use crate::kernel::paging::Access;
+
+    fn create_paged_process(disk: &mut Disk, memory: &Memory, id: u32, word_count: usize) -> Arc<ProcessControlBlock> {
+        let program_data: Vec<u32> = (0..word_count as u32).map(|word| id * 1000 + word).collect();
+        disk.write_program(id, 1, word_count, 0, 0, 0, &program_data);
+        memory.create_process(disk.get_info_for(id), disk.read_data_for(disk.get_info_for(id)));
+
+        memory.get_pcb_for(id)
+    }
+
+    /// Fills every frame with the first page of a two page process.
+    fn fill_memory(disk: &mut Disk, memory: &Memory) -> Vec<Arc<ProcessControlBlock>> {
+        let frame_count = memory.get_memory_size() / PAGE_SIZE;
+        (1..=frame_count as u32).map(|id| create_paged_process(disk, memory, id, 2 * PAGE_SIZE)).collect()
+    }
+
+    fn fault_on(pager: &mut Pager, disk: &mut Disk, memory: &Memory, pcb: &Arc<ProcessControlBlock>, word_address: usize) -> Result<(), &'static str> {
+        assert!(pcb.page_table.as_ref().unwrap().translate(word_address, Access::Read).is_err());
+        pager.handle_page_fault(disk, memory, pcb)
+    }
+
+    fn resident(pcb: &ProcessControlBlock, page: usize) -> bool {
+        pcb.page_table.as_ref().unwrap().get_frame_for(page).is_some()
+    }
+
+    #[test]
+    fn test_pager_handle_page_fault() {
+        let mut disk = Disk::new();
+        let memory = Memory::with_demand_paging();
+        let pcb = create_paged_process(&mut disk, &memory, 1, 2 * PAGE_SIZE);
+        let page_table = pcb.page_table.as_ref().unwrap();
+
+        fault_on(&mut Pager::new(Box::new(FifoReplacement::new())), &mut disk, &memory, &pcb, PAGE_SIZE + 1).unwrap();
+
+        assert_eq!(memory.read_from(page_table.translate(PAGE_SIZE + 1, Access::Read).unwrap()), 1000 + PAGE_SIZE as u32 + 1);
+    }
+
+    #[test]
+    fn test_pager_writes_back_only_dirty_pages() {
+        let mut disk = Disk::new();
+        let memory = Memory::with_demand_paging();
+        let pcbs = fill_memory(&mut disk, &memory);
+        let mut pager = Pager::new(Box::new(FifoReplacement::new()));
+
+        let first_page = pcbs[0].page_table.as_ref().unwrap();
+        memory.write_to(first_page.translate(0, Access::Write).unwrap(), 7);
+
+        fault_on(&mut pager, &mut disk, &memory, &pcbs[0], PAGE_SIZE).unwrap();
+        fault_on(&mut pager, &mut disk, &memory, &pcbs[1], PAGE_SIZE).unwrap();
+
+        assert!(!resident(&pcbs[0], 0) && !resident(&pcbs[1], 0));
+        assert_eq!((pager.get_evictions(), pager.get_write_backs()), (2, 1));
+        assert_eq!(disk.read_data_for(disk.get_info_for(1))[0], 7);
+        assert_eq!(disk.read_data_for(disk.get_info_for(2))[0], 2000);
+    }
+
+    #[test]
+    fn test_pager_replacement_policies() {
+        let mut victims = Vec::new();
+        for replacement in [PageReplacement::Fifo, PageReplacement::Lru, PageReplacement::Clock] {
+            let mut disk = Disk::new();
+            let memory = Memory::with_demand_paging();
+            let pcbs = fill_memory(&mut disk, &memory);
+            let mut pager = Pager::new(replacement.create_policy());
+
+            // Clear every referenced bit, then touch the first process's page again.
+            for pcb in &pcbs {
+                pcb.page_table.as_ref().unwrap().take_referenced(0);
+            }
+            pcbs[0].page_table.as_ref().unwrap().translate(0, Access::Read).unwrap();
+
+            fault_on(&mut pager, &mut disk, &memory, &pcbs[2], PAGE_SIZE).unwrap();
+            victims.push(pcbs.iter().position(|pcb| !resident(pcb, 0)));
+        }
+
+        // FIFO ignores the reference and evicts the oldest page. LRU and Clock spare it.
+        assert_eq!(victims, vec![Some(0), Some(1), Some(1)]);
+    }
+
+    #[test]
+    fn test_pager_evictions_do_not_allocate() {
+        for replacement in [PageReplacement::Fifo, PageReplacement::Lru, PageReplacement::Clock] {
+            let mut disk = Disk::new();
+            let memory = Memory::with_demand_paging();
+            let pcbs = fill_memory(&mut disk, &memory);
+            let mut pager = Pager::new(replacement.create_policy());
+
+            // The first fault sizes the policy's state and registers the thread's instrumentation.
+            fault_on(&mut pager, &mut disk, &memory, &pcbs[0], PAGE_SIZE).unwrap();
+
+            assert_eq!(count_allocations(|| {
+                for pcb in &pcbs[1..] {
+                    fault_on(&mut pager, &mut disk, &memory, pcb, PAGE_SIZE).unwrap();
+                }
+            }), 0, "{:?}", replacement);
+            assert_eq!(pager.get_evictions(), pcbs.len() as u64);
+        }
+    }
+
+    #[test]
+    fn test_pager_skips_running_processes() {
+        let mut disk = Disk::new();
+        let memory = Memory::with_demand_paging();
+        let pcbs = fill_memory(&mut disk, &memory);
+        let _running: Vec<_> = pcbs[1..].iter().map(|pcb| pcb.context.lock().unwrap()).collect();
+        let mut pager = Pager::new(Box::new(ClockReplacement::new()));
+
+        fault_on(&mut pager, &mut disk, &memory, &pcbs[0], PAGE_SIZE).unwrap();
+        assert!(!resident(&pcbs[0], 0) && resident(&pcbs[0], 1));
+
+        let _first = pcbs[0].context.lock().unwrap();
+        assert_eq!(fault_on(&mut pager, &mut disk, &memory, &pcbs[0], 0), Err("No frame available"));
+    }
+}
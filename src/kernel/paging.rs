@@ -0,0 +1,176 @@
+use std::sync::atomic::{AtomicBool, AtomicUsize, Ordering};
+
+/// Words per page, and per frame of physical memory.
+pub const PAGE_SIZE: usize = 16;
+
+/// Frames set aside for each demand paged process when it is admitted. Admission stops once every
+/// frame is spoken for, leaving each resident process room for its working set. Without this,
+/// memory fills with first pages and replacement evicts pages before their process runs again.
+pub const RESERVED_PAGES: usize = 3;
+
+/// Returned by address translation when the page is not resident. The CPU saves the process's
+/// context so it can resume once the page is loaded.
+pub const PAGE_FAULT: &str = "Page fault";
+
+const NOT_RESIDENT: usize = usize::MAX;
+
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum Access {
+    Read,
+    Write,
+}
+
+/// Maps the pages of a demand paged process to frames of physical memory. Entries are atomic so
+/// the pager can map and unmap pages while the process control block is shared. Like hardware
+/// page table entries, each page has a referenced bit set on every access and a dirty bit set
+/// on every write.
+pub struct PageTable {
+    frames: Box<[AtomicUsize]>,
+    referenced: Box<[AtomicBool]>,
+    dirty: Box<[AtomicBool]>,
+    word_count: usize,
+    faulted_page: AtomicUsize,
+}
+
+impl PageTable {
+    pub fn new(word_count: usize) -> PageTable {
+        let page_count = word_count.div_ceil(PAGE_SIZE);
+
+        PageTable {
+            frames: (0..page_count).map(|_| AtomicUsize::new(NOT_RESIDENT)).collect(),
+            referenced: (0..page_count).map(|_| AtomicBool::new(false)).collect(),
+            dirty: (0..page_count).map(|_| AtomicBool::new(false)).collect(),
+            word_count,
+            faulted_page: AtomicUsize::new(0),
+        }
+    }
+
+    /// Translates a program relative word address into a physical one, noting the page on a fault.
+    pub fn translate(&self, word_address: usize, access: Access) -> Result<usize, &'static str> {
+        if word_address >= self.word_count {
+            return Err("Out of bounds memory access");
+        }
+
+        let page = word_address / PAGE_SIZE;
+        let frame = self.frames[page].load(Ordering::Acquire);
+
+        if frame == NOT_RESIDENT {
+            self.faulted_page.store(page, Ordering::Relaxed);
+            return Err(PAGE_FAULT);
+        }
+
+        // Checked first so repeated accesses to a page only read the shared flag.
+        if !self.referenced[page].load(Ordering::Relaxed) {
+            self.referenced[page].store(true, Ordering::Relaxed);
+        }
+        if access == Access::Write && !self.dirty[page].load(Ordering::Relaxed) {
+            self.dirty[page].store(true, Ordering::Relaxed);
+        }
+
+        Ok(frame * PAGE_SIZE + word_address % PAGE_SIZE)
+    }
+
+    /// Returns and clears the referenced bit of a page.
+    pub fn take_referenced(&self, page: usize) -> bool {
+        self.referenced[page].swap(false, Ordering::Relaxed)
+    }
+
+    /// Returns and clears the dirty bit of a page.
+    pub fn take_dirty(&self, page: usize) -> bool {
+        self.dirty[page].swap(false, Ordering::Relaxed)
+    }
+
+    /// The page missing at the most recent page fault.
+    pub fn get_faulted_page(&self) -> usize {
+        self.faulted_page.load(Ordering::Relaxed)
+    }
+
+    pub fn get_frame_for(&self, page: usize) -> Option<usize> {
+        match self.frames[page].load(Ordering::Acquire) {
+            NOT_RESIDENT => None,
+            frame => Some(frame),
+        }
+    }
+
+    /// Number of words of the program held by `page`. Only the last page can be partial.
+    pub fn get_page_length(&self, page: usize) -> usize {
+        (self.word_count - page * PAGE_SIZE).min(PAGE_SIZE)
+    }
+
+    pub fn get_page_count(&self) -> usize {
+        self.frames.len()
+    }
+
+    pub fn get_resident_count(&self) -> usize {
+        (0..self.frames.len()).filter(|&page| self.get_frame_for(page).is_some()).count()
+    }
+
+    /// A freshly loaded page counts as referenced and matches its copy on disk.
+    pub(crate) fn map(&self, page: usize, frame: usize) {
+        self.referenced[page].store(true, Ordering::Relaxed);
+        self.dirty[page].store(false, Ordering::Relaxed);
+        self.frames[page].store(frame, Ordering::Release);
+    }
+
+    pub(crate) fn unmap(&self, page: usize) -> Option<usize> {
+        match self.frames[page].swap(NOT_RESIDENT, Ordering::AcqRel) {
+            NOT_RESIDENT => None,
+            frame => Some(frame),
+        }
+    }
+}
+
+impl PartialEq for PageTable {
+    fn eq(&self, other: &Self) -> bool {
+        self.word_count == other.word_count &&
+            (0..self.frames.len()).all(|page| self.get_frame_for(page) == other.get_frame_for(page))
+    }
+}
+
+impl Eq for PageTable {}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_page_table_translate() {
+        let page_table = PageTable::new(PAGE_SIZE + 4);
+        page_table.map(1, 7);
+
+        assert_eq!(page_table.get_page_count(), 2);
+        assert_eq!(page_table.get_page_length(1), 4);
+        assert_eq!(page_table.translate(PAGE_SIZE + 2, Access::Read), Ok(7 * PAGE_SIZE + 2));
+        assert_eq!(page_table.translate(3, Access::Read), Err(PAGE_FAULT));
+        assert_eq!(page_table.get_faulted_page(), 0);
+        assert_eq!(page_table.translate(PAGE_SIZE + 4, Access::Read), Err("Out of bounds memory access"));
+    }
+
+    #[test]
+    fn test_page_table_referenced_and_dirty_bits() {
+        let page_table = PageTable::new(PAGE_SIZE);
+        page_table.map(0, 0);
+
+        assert!(page_table.take_referenced(0));
+        assert!(!page_table.take_dirty(0));
+
+        page_table.translate(1, Access::Read).unwrap();
+        assert!(page_table.take_referenced(0));
+        assert!(!page_table.take_referenced(0));
+        assert!(!page_table.take_dirty(0));
+
+        page_table.translate(1, Access::Write).unwrap();
+        assert!(page_table.take_dirty(0));
+    }
+
+    #[test]
+    fn test_page_table_unmap() {
+        let page_table = PageTable::new(PAGE_SIZE);
+        page_table.map(0, 3);
+
+        assert_eq!(page_table.get_resident_count(), 1);
+        assert_eq!(page_table.unmap(0), Some(3));
+        assert_eq!(page_table.unmap(0), None);
+        assert_eq!(page_table.get_resident_count(), 0);
+    }
+}
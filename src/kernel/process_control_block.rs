@@ -1,29 +1,141 @@
 use std::cmp::Ordering;
+use std::sync::{Mutex, atomic::{AtomicU64, AtomicUsize, Ordering as AtomicOrdering}};
+
+use super::cpu::{ExecutionStats, REGISTER_COUNT};
+use super::paging::{PageTable, PAGE_SIZE};
 
 use crate::io::ProgramInfo;
 
-#[derive(Eq, PartialEq)]
-pub(crate) struct ProcessControlBlock {
+/// CPU state saved when a process leaves a CPU before it halts.
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub struct Context {
+    pub registers: [u32; REGISTER_COUNT],
+    pub program_counter: usize,
+    pub stats: ExecutionStats,
+}
+
+/// Words a context takes when written out, as when the process is swapped to disk.
+pub const CONTEXT_WORDS: usize = REGISTER_COUNT + 5;
+
+impl Context {
+    pub fn to_words(&self) -> [u32; CONTEXT_WORDS] {
+        let mut words = [0; CONTEXT_WORDS];
+        let (registers, rest) = words.split_at_mut(REGISTER_COUNT);
+
+        registers.copy_from_slice(&self.registers);
+        rest[0] = self.program_counter as u32;
+        rest[1..3].copy_from_slice(&split_u64(self.stats.cycles));
+        rest[3..5].copy_from_slice(&split_u64(self.stats.io_operations));
+
+        words
+    }
+
+    pub fn from_words(words: &[u32]) -> Context {
+        let (registers, rest) = words[..CONTEXT_WORDS].split_at(REGISTER_COUNT);
+
+        Context {
+            registers: registers.try_into().unwrap(),
+            program_counter: rest[0] as usize,
+            stats: ExecutionStats {
+                cycles: join_u64(&rest[1..3]),
+                io_operations: join_u64(&rest[3..5]),
+            },
+        }
+    }
+}
+
+fn split_u64(value: u64) -> [u32; 2] {
+    [value as u32, (value >> 32) as u32]
+}
+
+fn join_u64(words: &[u32]) -> u64 {
+    words[0] as u64 | (words[1] as u64) << 32
+}
+
+pub struct ProcessControlBlock {
     pub id: u32,
     pub priority: u32,
 
-    pub mem_start_address: usize,
-    pub mem_end_address: usize,
+    /// Moved by memory compaction, which only relocates processes that are not running.
+    pub(crate) mem_start_address: AtomicUsize,
+    pub(crate) mem_end_address: AtomicUsize,
     pub program_counter: usize,
+    pub instruction_buffer_size: usize,
+    /// The memory bank the process was admitted into.
+    pub bank: usize,
+
+    /// Present when the process is demand paged, in which case the memory addresses are unused.
+    pub page_table: Option<PageTable>,
+    /// Locked by the CPU running the process.
+    pub context: Mutex<Context>,
+    /// When the process last joined the ready queue. A dispatcher CPU that keeps its own time
+    /// starts the process no earlier.
+    pub(crate) ready_at: AtomicU64,
 }
 
 impl ProcessControlBlock {
     pub fn new(program_info: &ProgramInfo, mem_start_address: usize, mem_end_address: usize) -> ProcessControlBlock {
+        let program_counter = 0;
+
         ProcessControlBlock {
             id: program_info.id,
             priority: program_info.priority,
-            mem_start_address,
-            mem_end_address,
-            program_counter: 0,
+            mem_start_address: AtomicUsize::new(mem_start_address),
+            mem_end_address: AtomicUsize::new(mem_end_address),
+            program_counter,
+            instruction_buffer_size: program_info.instruction_buffer_size,
+            bank: 0,
+            page_table: None,
+            context: Mutex::new(Context { program_counter, ..Context::default() }),
+            ready_at: AtomicU64::new(0),
+        }
+    }
+
+    pub fn with_page_table(program_info: &ProgramInfo, page_table: PageTable) -> ProcessControlBlock {
+        ProcessControlBlock {
+            page_table: Some(page_table),
+            ..ProcessControlBlock::new(program_info, 0, 0)
         }
     }
+
+    pub fn get_mem_start_address(&self) -> usize {
+        self.mem_start_address.load(AtomicOrdering::Acquire)
+    }
+
+    pub fn get_mem_end_address(&self) -> usize {
+        self.mem_end_address.load(AtomicOrdering::Acquire)
+    }
+
+    /// Moves the process's region to begin at `mem_start_address`. The caller holds the context
+    /// lock, so no CPU is running the process.
+    pub(crate) fn relocate(&self, mem_start_address: usize) {
+        let size = self.get_mem_end_address() - self.get_mem_start_address();
+
+        self.mem_start_address.store(mem_start_address, AtomicOrdering::Release);
+        self.mem_end_address.store(mem_start_address + size, AtomicOrdering::Release);
+    }
+
+    pub fn get_ready_at(&self) -> u64 {
+        self.ready_at.load(AtomicOrdering::Acquire)
+    }
+
+    /// Words of physical memory the process currently holds.
+    pub fn get_resident_words(&self) -> usize {
+        match &self.page_table {
+            Some(page_table) => page_table.get_resident_count() * PAGE_SIZE,
+            None => self.get_mem_end_address() - self.get_mem_start_address(),
+        }
+    }
+}
+
+impl PartialEq for ProcessControlBlock {
+    fn eq(&self, other: &Self) -> bool {
+        self.id == other.id
+    }
 }
 
+impl Eq for ProcessControlBlock {}
+
 impl Ord for ProcessControlBlock {
     fn cmp(&self, other: &Self) -> Ordering {
         self.priority.cmp(&other.priority)
@@ -34,4 +146,18 @@ impl PartialOrd for ProcessControlBlock {
     fn partial_cmp(&self, other: &Self) -> Option<Ordering> {
         Some(self.cmp(other))
     }
-}
\ No newline at end of file
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_context_words_round_trip() {
+        let mut context = Context { program_counter: 12, ..Context::default() };
+        context.registers[3] = 0xDEADBEEF;
+        context.stats = ExecutionStats { cycles: 1 << 40, io_operations: 7 };
+
+        assert_eq!(Context::from_words(&context.to_words()), context);
+    }
+}
@@ -0,0 +1,343 @@
+use std::cmp::Reverse;
+use std::collections::HashMap;
+use std::io::{self, Write};
+use std::sync::{Mutex, atomic::{AtomicBool, Ordering}};
+
+use super::cpu::{Instruction, Opcode, WORD_SIZE};
+
+/// Rows of each table in the report.
+pub const DEFAULT_REPORT_LENGTH: usize = 20;
+
+const OPCODE_COUNT: usize = Opcode::ALL.len();
+
+/// Executions of the instruction at one program counter of a program.
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub struct InstructionCounts {
+    /// The instruction found there, once it has run.
+    pub instruction: Option<Instruction>,
+    pub executed: u64,
+    /// Executions that branched somewhere other than the next instruction.
+    pub taken: u64,
+}
+
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub struct OpcodeCounts {
+    pub executed: u64,
+    pub taken: u64,
+}
+
+/// Instructions a CPU executed, counted by program and program counter, by opcode, and by
+/// consecutive pairs of opcodes.
+pub struct Profile {
+    programs: HashMap<u32, Vec<InstructionCounts>>,
+    opcodes: [OpcodeCounts; OPCODE_COUNT],
+    /// Executions of an opcode straight after another in the same run, by (first, second).
+    pairs: Box<[[u64; OPCODE_COUNT]; OPCODE_COUNT]>,
+}
+
+impl Profile {
+    pub fn new() -> Profile {
+        Profile {
+            programs: HashMap::new(),
+            opcodes: [OpcodeCounts::default(); OPCODE_COUNT],
+            pairs: Box::new([[0; OPCODE_COUNT]; OPCODE_COUNT]),
+        }
+    }
+
+    /// Counts one run of a program on a CPU. Looks the program up once, so counting each
+    /// instruction is a few increments.
+    pub fn recorder(&mut self, program_id: u32, instruction_count: usize) -> Recorder<'_> {
+        let instructions = self.programs.entry(program_id).or_default();
+        if instructions.len() < instruction_count {
+            instructions.resize(instruction_count, InstructionCounts::default());
+        }
+
+        Recorder { instructions, opcodes: &mut self.opcodes, pairs: &mut self.pairs, previous: None }
+    }
+
+    /// Adds the counts of another CPU's profile.
+    pub fn merge(&mut self, other: Profile) {
+        for (program_id, other_instructions) in other.programs {
+            let instructions = self.programs.entry(program_id).or_default();
+            if instructions.len() < other_instructions.len() {
+                instructions.resize(other_instructions.len(), InstructionCounts::default());
+            }
+
+            for (counts, other_counts) in instructions.iter_mut().zip(other_instructions) {
+                counts.instruction = counts.instruction.or(other_counts.instruction);
+                counts.executed += other_counts.executed;
+                counts.taken += other_counts.taken;
+            }
+        }
+
+        for (counts, other_counts) in self.opcodes.iter_mut().zip(other.opcodes) {
+            counts.executed += other_counts.executed;
+            counts.taken += other_counts.taken;
+        }
+
+        for (row, other_row) in self.pairs.iter_mut().zip(other.pairs.iter()) {
+            for (count, other_count) in row.iter_mut().zip(other_row) {
+                *count += other_count;
+            }
+        }
+    }
+
+    pub fn get_instruction_count(&self) -> u64 {
+        self.opcodes.iter().map(|counts| counts.executed).sum()
+    }
+
+    /// Counts of a program's instructions, indexed by program counter.
+    pub fn get_program(&self, program_id: u32) -> Option<&[InstructionCounts]> {
+        self.programs.get(&program_id).map(Vec::as_slice)
+    }
+
+    pub fn get_opcode(&self, opcode: Opcode) -> OpcodeCounts {
+        self.opcodes[opcode as usize]
+    }
+
+    pub fn get_pair(&self, first: Opcode, second: Opcode) -> u64 {
+        self.pairs[first as usize][second as usize]
+    }
+
+    /// Writes the `length` hottest instructions with their disassembly, the opcode mix, and the
+    /// hottest opcode pairs and instructions across programs, which are where superinstructions
+    /// and specialized handlers would pay off.
+    pub fn write_report<W: Write>(&self, writer: &mut W, length: usize) -> io::Result<()> {
+        let total = self.get_instruction_count();
+        if total == 0 {
+            return writeln!(writer, "Profile: no instructions executed");
+        }
+
+        let share = |count: u64| format!("{:.2}%", 100.0 * count as f64 / total as f64);
+        let taken = |opcode: Opcode, executed: u64, taken: u64| match opcode.is_branch() {
+            true => format!("{:.1}%", 100.0 * taken as f64 / executed.max(1) as f64),
+            false => String::new(),
+        };
+
+        writeln!(writer, "Profile: {} instructions executed by {} programs", total, self.programs.len())?;
+
+        let mut hot_spots: Vec<_> = self.programs.iter()
+            .flat_map(|(&program_id, instructions)| {
+                instructions.iter().enumerate()
+                    .filter_map(move |(program_counter, counts)| Some((program_id, program_counter, counts.instruction?, counts)))
+            })
+            .collect();
+        hot_spots.sort_unstable_by_key(|&(program_id, program_counter, _, counts)| (Reverse(counts.executed), program_id, program_counter));
+
+        writeln!(writer, "\nHot instructions")?;
+        writeln!(writer, "{:>8} {:>12} {:>8} {:>8}  {:<24} {:>7}", "share", "executed", "program", "address", "instruction", "taken")?;
+        for (program_id, program_counter, instruction, counts) in hot_spots.into_iter().take(length) {
+            let row = format!("{:>8} {:>12} {:>8} {:>#8X}  {:<24} {:>7}", share(counts.executed), counts.executed, program_id,
+                              program_counter * WORD_SIZE, instruction.to_string(), taken(instruction.opcode, counts.executed, counts.taken));
+            writeln!(writer, "{}", row.trim_end())?;
+        }
+
+        let mut opcodes: Vec<_> = Opcode::ALL.iter().map(|&opcode| (opcode, self.get_opcode(opcode))).filter(|(_, counts)| counts.executed > 0).collect();
+        opcodes.sort_unstable_by_key(|&(opcode, counts)| (Reverse(counts.executed), opcode as usize));
+
+        writeln!(writer, "\nOpcode mix")?;
+        writeln!(writer, "{:>8} {:>12}  {:<8} {:>7}", "share", "executed", "opcode", "taken")?;
+        for (opcode, counts) in opcodes {
+            let row = format!("{:>8} {:>12}  {:<8} {:>7}", share(counts.executed), counts.executed, opcode.mnemonic(), taken(opcode, counts.executed, counts.taken));
+            writeln!(writer, "{}", row.trim_end())?;
+        }
+
+        let mut pairs: Vec<_> = Opcode::ALL.iter()
+            .flat_map(|&first| Opcode::ALL.iter().map(move |&second| (first, second)))
+            .map(|(first, second)| (first, second, self.get_pair(first, second)))
+            .filter(|&(_, _, count)| count > 0)
+            .collect();
+        pairs.sort_unstable_by_key(|&(first, second, count)| (Reverse(count), first as usize, second as usize));
+
+        writeln!(writer, "\nSuperinstruction candidates (opcode pairs)")?;
+        writeln!(writer, "{:>8} {:>12}  {}", "share", "executed", "pair")?;
+        for (first, second, count) in pairs.into_iter().take(length) {
+            writeln!(writer, "{:>8} {:>12}  {} + {}", share(count), count, first.mnemonic(), second.mnemonic())?;
+        }
+
+        // The same instruction word at many sites, such as a loop counter's ADDI, is worth a
+        // handler with its operands baked in.
+        let mut instructions: HashMap<Instruction, (u64, u64, usize)> = HashMap::new();
+        for counts in self.programs.values().flatten() {
+            if let Some(instruction) = counts.instruction {
+                let (executed, taken, sites) = instructions.entry(instruction).or_default();
+                *executed += counts.executed;
+                *taken += counts.taken;
+                *sites += 1;
+            }
+        }
+        let mut instructions: Vec<_> = instructions.into_iter().collect();
+        instructions.sort_unstable_by_key(|&(instruction, (executed, _, _))| (Reverse(executed), instruction.to_string()));
+
+        writeln!(writer, "\nSpecialization candidates (instruction words at every site)")?;
+        writeln!(writer, "{:>8} {:>12} {:>8}  {:<24} {:>7}", "share", "executed", "sites", "instruction", "taken")?;
+        for (instruction, (executed, taken_count, sites)) in instructions.into_iter().take(length) {
+            let row = format!("{:>8} {:>12} {:>8}  {:<24} {:>7}", share(executed), executed, sites,
+                              instruction.to_string(), taken(instruction.opcode, executed, taken_count));
+            writeln!(writer, "{}", row.trim_end())?;
+        }
+
+        Ok(())
+    }
+}
+
+/// Counts the instructions of one run of a program. Consecutive pairs do not span runs.
+pub struct Recorder<'a> {
+    instructions: &'a mut [InstructionCounts],
+    opcodes: &'a mut [OpcodeCounts; OPCODE_COUNT],
+    pairs: &'a mut [[u64; OPCODE_COUNT]; OPCODE_COUNT],
+    previous: Option<Opcode>,
+}
+
+impl Recorder<'_> {
+    /// Counts an instruction that ran at `program_counter` and moved on to `next_program_counter`.
+    #[inline]
+    pub fn record(&mut self, program_counter: usize, instruction: Instruction, next_program_counter: usize) {
+        let opcode = instruction.opcode;
+        let taken = (opcode.is_branch() && next_program_counter != program_counter + 1) as u64;
+
+        let counts = &mut self.instructions[program_counter];
+        counts.instruction = Some(instruction);
+        counts.executed += 1;
+        counts.taken += taken;
+
+        let opcode_counts = &mut self.opcodes[opcode as usize];
+        opcode_counts.executed += 1;
+        opcode_counts.taken += taken;
+
+        if let Some(previous) = self.previous {
+            self.pairs[previous as usize][opcode as usize] += 1;
+        }
+        self.previous = Some(opcode);
+    }
+}
+
+static ENABLED: AtomicBool = AtomicBool::new(false);
+/// Profiles of the CPUs dropped while profiling, merged.
+static COLLECTED: Mutex<Option<Profile>> = Mutex::new(None);
+
+/// Makes CPUs created from now on profile what they execute.
+pub fn enable() {
+    ENABLED.store(true, Ordering::Relaxed);
+}
+
+pub fn disable() {
+    ENABLED.store(false, Ordering::Relaxed);
+}
+
+pub fn is_enabled() -> bool {
+    ENABLED.load(Ordering::Relaxed)
+}
+
+/// Adds a CPU's profile to the collected one.
+pub fn submit(profile: Profile) {
+    let mut collected = COLLECTED.lock().unwrap();
+    match collected.as_mut() {
+        Some(collected) => collected.merge(profile),
+        None => *collected = Some(profile),
+    }
+}
+
+/// Takes the profiles submitted so far, merged.
+pub fn take() -> Profile {
+    COLLECTED.lock().unwrap().take().unwrap_or_else(Profile::new)
+}
+
+#[cfg(test)]
+mod tests {
+    use std::sync::Arc;
+
+    use super::*;
+
+    use crate::io::ProgramInfo;
+    use crate::kernel::{CPU, Memory, ProcessControlBlock};
+
+    fn create_process(memory: &Memory, id: u32, instructions: &[u32]) -> Arc<ProcessControlBlock> {
+        let program_info = ProgramInfo {
+            id,
+            priority: 1,
+            instruction_buffer_size: instructions.len(),
+            in_buffer_size: 0,
+            out_buffer_size: 0,
+            temp_buffer_size: 0,
+            data_start_idx: 0,
+        };
+
+        memory.create_process(&program_info, instructions);
+        memory.get_pcb_for(id)
+    }
+
+    /// MOVI r5 3, MOVI r1 0, ADDI r6 1, SLT r6 r5 r8, BNE r8 r1 -> 0x08, HLT
+    const LOOP: [u32; 6] = [0x4B050003, 0x4B010000, 0x4C060001, 0x10658000, 0x56810008, 0x92000000];
+
+    #[test]
+    fn test_profile_counts_instructions_and_branches() {
+        let memory = Memory::new();
+        let pcb = create_process(&memory, 1, &LOOP);
+
+        let mut cpu = CPU::new();
+        cpu.enable_profiling();
+        cpu.execute(&pcb, &memory).unwrap();
+        let profile = cpu.take_profile().unwrap();
+
+        let executed: Vec<_> = profile.get_program(1).unwrap().iter().map(|counts| counts.executed).collect();
+        assert_eq!(executed, vec![1, 1, 3, 3, 3, 1]);
+        assert_eq!(profile.get_program(1).unwrap()[4].taken, 2);
+        assert_eq!(profile.get_program(1).unwrap()[2].instruction.unwrap().to_string(), "ADDI r6 1");
+
+        assert_eq!(profile.get_instruction_count(), 12);
+        assert_eq!(profile.get_opcode(Opcode::Bne), OpcodeCounts { executed: 3, taken: 2 });
+        assert_eq!(profile.get_opcode(Opcode::Movi), OpcodeCounts { executed: 2, taken: 0 });
+        assert_eq!(profile.get_pair(Opcode::Slt, Opcode::Bne), 3);
+        assert_eq!(profile.get_pair(Opcode::Bne, Opcode::Addi), 2);
+        assert_eq!(profile.get_pair(Opcode::Bne, Opcode::Hlt), 1);
+    }
+
+    #[test]
+    fn test_profile_pairs_do_not_span_runs() {
+        let memory = Memory::new();
+        let pcb = create_process(&memory, 1, &LOOP);
+
+        let mut cpu = CPU::new();
+        cpu.enable_profiling();
+        while cpu.execute_for(&pcb, &memory, 1).is_err() {}
+        let profile = cpu.take_profile().unwrap();
+
+        assert_eq!(profile.get_instruction_count(), 12);
+        assert_eq!(profile.get_pair(Opcode::Slt, Opcode::Bne), 0);
+    }
+
+    #[test]
+    fn test_profile_merge_and_report() {
+        let memory = Memory::new();
+        let first = create_process(&memory, 1, &LOOP);
+        let second = create_process(&memory, 2, &LOOP);
+
+        let mut profiles = Vec::new();
+        for pcb in [&first, &second] {
+            let mut cpu = CPU::new();
+            cpu.enable_profiling();
+            cpu.execute(pcb, &memory).unwrap();
+            profiles.push(cpu.take_profile().unwrap());
+        }
+
+        let mut profile = Profile::new();
+        for other in profiles {
+            profile.merge(other);
+        }
+
+        assert_eq!(profile.get_instruction_count(), 24);
+        assert_eq!(profile.get_opcode(Opcode::Bne), OpcodeCounts { executed: 6, taken: 4 });
+        assert_eq!(profile.get_program(2).unwrap()[4].executed, 3);
+
+        let mut report = Vec::new();
+        profile.write_report(&mut report, 3).unwrap();
+        let report = String::from_utf8(report).unwrap();
+
+        assert!(report.starts_with("Profile: 24 instructions executed by 2 programs"));
+        assert!(report.contains("BNE r8 r1 -> 0x08"));
+        assert!(report.contains("SLT + BNE"));
+        // Both programs run the same ADDI word, at one site each.
+        assert!(report.lines().any(|line| line.contains("ADDI r6 1") && line.split_whitespace().nth(2) == Some("2")));
+    }
+}
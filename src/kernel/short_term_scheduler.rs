@@ -1,16 +1,31 @@
 use std::collections::{BinaryHeap, VecDeque};
-use std::sync::{Arc, Condvar, Mutex, atomic::{AtomicBool, Ordering}};
-use std::thread;
+use std::sync::{Arc, Condvar, Mutex, atomic::{AtomicBool, AtomicU64, AtomicUsize, Ordering}, mpsc::Sender};
+use std::thread::{self, JoinHandle};
+use std::time::{Duration, Instant};
 
-use super::ProcessControlBlock;
+use super::{affinity, Clock, CPU, Memory, ProcessControlBlock};
+use super::instrumentation::{self, Distribution};
+use super::tracer::{self, EventKind};
+use super::cpu::ExecutionStats;
 
-pub(crate) trait SchedulerQueue {
+pub trait SchedulerQueue {
     fn push(&mut self, pcb: Arc<ProcessControlBlock>);
     fn pop(&mut self) -> Option<Arc<ProcessControlBlock>>;
+    /// Takes the next process for a CPU working from memory bank `bank`. Queues that keep no
+    /// order worth bending take the next process regardless.
+    fn pop_for_bank(&mut self, _bank: usize) -> Option<Arc<ProcessControlBlock>> {
+        self.pop()
+    }
+    /// Takes a process out of the queue before it is dispatched.
+    fn remove(&mut self, process_id: u32) -> Option<Arc<ProcessControlBlock>>;
     fn is_empty(&self) -> bool;
+    fn len(&self) -> usize;
 }
 
-pub(crate) struct FifoQueue {
+/// Processes at the head of a FIFO queue a CPU looks through for one in its own bank.
+const LOCALITY_WINDOW: usize = 4;
+
+pub struct FifoQueue {
     queue: VecDeque<Arc<ProcessControlBlock>>,
 }
 
@@ -31,12 +46,27 @@ impl SchedulerQueue for FifoQueue {
         self.queue.pop_front()
     }
 
+    /// Takes the oldest of the first few processes that lives in `bank`, or the oldest of all.
+    fn pop_for_bank(&mut self, bank: usize) -> Option<Arc<ProcessControlBlock>> {
+        let idx = self.queue.iter().take(LOCALITY_WINDOW).position(|pcb| pcb.bank == bank).unwrap_or(0);
+        self.queue.remove(idx)
+    }
+
+    fn remove(&mut self, process_id: u32) -> Option<Arc<ProcessControlBlock>> {
+        let idx = self.queue.iter().position(|pcb| pcb.id == process_id)?;
+        self.queue.remove(idx)
+    }
+
     fn is_empty(&self) -> bool {
         self.queue.is_empty()
     }
+
+    fn len(&self) -> usize {
+        self.queue.len()
+    }
 }
 
-pub(crate) struct PriorityQueue {
+pub struct PriorityQueue {
     queue: BinaryHeap<Arc<ProcessControlBlock>>,
 }
 
@@ -57,65 +87,643 @@ impl SchedulerQueue for PriorityQueue {
         self.queue.pop()
     }
 
+    fn remove(&mut self, process_id: u32) -> Option<Arc<ProcessControlBlock>> {
+        let mut pcbs = std::mem::take(&mut self.queue).into_vec();
+        let removed = pcbs.iter().position(|pcb| pcb.id == process_id).map(|idx| pcbs.swap_remove(idx));
+
+        self.queue = BinaryHeap::from(pcbs);
+        removed
+    }
+
     fn is_empty(&self) -> bool {
         self.queue.is_empty()
     }
+
+    fn len(&self) -> usize {
+        self.queue.len()
+    }
 }
 
-pub(crate) struct ShortTermScheduler {
-    ready_queue: Arc<Mutex<Box<dyn SchedulerQueue + Send>>>,
-    ready_queue_condvar: Arc<Condvar>,
-    dispatch_kill_flag: Arc<AtomicBool>,
+/// Sent by a CPU when a process stops running: it halted, faulted, or is waiting on a page.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub struct Termination {
+    pub process_id: u32,
+    pub dispatched_at: u64,
+    pub completed_at: u64,
+    pub stats: ExecutionStats,
+    pub result: Result<(), &'static str>,
 }
 
-impl ShortTermScheduler {
-    pub fn new(scheduler_queue: Box<dyn SchedulerQueue + Send>) -> ShortTermScheduler {
-        let ready_queue = Arc::new(Mutex::new(scheduler_queue));
-        let ready_queue_condvar = Arc::new(Condvar::new());
-        let dispatch_kill_flag = Arc::new(AtomicBool::new(false));
-
-        let ready_queue_clone = ready_queue.clone();
-        let ready_queue_condvar_clone = ready_queue_condvar.clone();
-        let dispatch_kill_flag_clone = dispatch_kill_flag.clone();
-
-        thread::spawn(move || {
-            while !dispatch_kill_flag_clone.load(Ordering::Relaxed) {
-                ShortTermScheduler::dispatch(&ready_queue_clone, &ready_queue_condvar_clone);
+/// How a dispatcher with nothing to run waits for the next ready process.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum IdleStrategy {
+    /// Parks on the ready queue straight away. An idle CPU costs no host time, but every wake up
+    /// goes through the kernel on both sides.
+    Park,
+    /// Spins, then yields with growing backoff, for up to the given time before parking.
+    Spin(Duration),
+    /// Spins for about twice the CPU's recent idle gaps, up to the given time, and parks straight
+    /// away while gaps run longer than that.
+    Adaptive(Duration),
+}
+
+/// Spin loop iterations a waiting dispatcher works up to before it starts yielding instead.
+const SPIN_LIMIT: u32 = 64;
+
+/// A dispatcher's record of how long it sits idle between processes.
+struct IdleGaps {
+    /// Moving average of recent gaps, in nanoseconds.
+    average: u64,
+}
+
+impl IdleGaps {
+    fn new(strategy: IdleStrategy) -> IdleGaps {
+        // Starts out expecting gaps short enough to spin through.
+        let average = match strategy {
+            IdleStrategy::Adaptive(spin_limit) => spin_limit.as_nanos() as u64 / 2,
+            IdleStrategy::Park | IdleStrategy::Spin(_) => 0,
+        };
+
+        IdleGaps { average }
+    }
+
+    fn spin_time(&self, strategy: IdleStrategy) -> Duration {
+        match strategy {
+            IdleStrategy::Park => Duration::ZERO,
+            IdleStrategy::Spin(spin_time) => spin_time,
+            IdleStrategy::Adaptive(spin_limit) if Duration::from_nanos(self.average) < spin_limit => {
+                Duration::from_nanos(2 * self.average).min(spin_limit)
+            }
+            IdleStrategy::Adaptive(_) => Duration::ZERO,
+        }
+    }
+
+    fn record(&mut self, gap: Duration) {
+        self.average = self.average - self.average / 8 + gap.as_nanos() as u64 / 8;
+    }
+}
+
+/// A simulated CPU between processes, with the memory bank it works from and its own time.
+struct IdleCpu {
+    cpu: CPU,
+    bank: usize,
+    time: u64,
+}
+
+/// State the dispatchers share with the scheduler.
+struct Dispatch {
+    ready_queue: Mutex<Box<dyn SchedulerQueue + Send>>,
+    /// CPUs not running a process. A dispatcher takes the one whose time is earliest, so a
+    /// process runs when it would on CPUs working side by side, whichever dispatcher threads the
+    /// host happens to run. Only taken with the ready queue locked.
+    idle_cpus: Mutex<Vec<IdleCpu>>,
+    ready_queue_condvar: Condvar,
+    /// Signalled whenever a CPU finishes a process, for `drain`.
+    idle_condvar: Condvar,
+    dispatch_kill_flag: AtomicBool,
+    /// CPUs running a process, CPUs parked on the ready queue, and parked CPUs already signalled
+    /// but not yet awake. Only changed with the ready queue locked.
+    busy_cpus: AtomicUsize,
+    parked_cpus: AtomicUsize,
+    woken_cpus: AtomicUsize,
+    /// Bumped on every schedule, for spinning dispatchers to watch without taking the lock.
+    schedule_count: AtomicU64,
+    /// When the latest process was scheduled, in nanoseconds since `epoch`.
+    scheduled_at: AtomicU64,
+    epoch: Instant,
+}
+
+impl Dispatch {
+    fn elapsed_nanos(&self) -> u64 {
+        self.epoch.elapsed().as_nanos() as u64
+    }
+
+    /// Waits for the next ready process as `strategy` says, and takes the idle CPU with the
+    /// earliest time to run it, preferring a process in that CPU's bank. Along with both comes
+    /// the dispatch latency, if the dispatcher sat idle waiting: the time since the latest process
+    /// was scheduled. Returns None once stopped.
+    fn dispatch(&self, strategy: IdleStrategy, idle_gaps: &mut IdleGaps) -> Option<(IdleCpu, Arc<ProcessControlBlock>, Option<u64>)> {
+        let mut ready_queue = self.ready_queue.lock().unwrap();
+        let mut idle_since = None;
+        let mut backoff = 1;
+
+        loop {
+            if self.dispatch_kill_flag.load(Ordering::Acquire) {
+                return None;
+            }
+
+            if !ready_queue.is_empty() {
+                let cpu = self.take_earliest_cpu();
+                let pcb = ready_queue.pop_for_bank(cpu.bank).expect("A queue that is not empty has a process");
+                self.busy_cpus.fetch_add(1, Ordering::Relaxed);
+
+                let latency = idle_since.map(|idle_since: Instant| {
+                    idle_gaps.record(idle_since.elapsed());
+                    self.elapsed_nanos().saturating_sub(self.scheduled_at.load(Ordering::Relaxed))
+                });
+                return Some((cpu, pcb, latency));
+            }
+
+            let idle_since = *idle_since.get_or_insert_with(Instant::now);
+            let spin_time = idle_gaps.spin_time(strategy);
+
+            if idle_since.elapsed() >= spin_time {
+                self.parked_cpus.fetch_add(1, Ordering::Relaxed);
+                ready_queue = self.ready_queue_condvar.wait(ready_queue).unwrap();
+                self.parked_cpus.fetch_sub(1, Ordering::Relaxed);
+                // A spurious wake up may take the count of another, which then costs a spare signal.
+                let _ = self.woken_cpus.fetch_update(Ordering::Relaxed, Ordering::Relaxed, |woken| woken.checked_sub(1));
+                continue;
             }
-        });
 
+            let schedule_count = self.schedule_count.load(Ordering::Acquire);
+            drop(ready_queue);
+
+            while self.schedule_count.load(Ordering::Acquire) == schedule_count
+                && !self.dispatch_kill_flag.load(Ordering::Acquire)
+                && idle_since.elapsed() < spin_time {
+                if backoff < SPIN_LIMIT {
+                    (0..backoff).for_each(|_| std::hint::spin_loop());
+                    backoff *= 2;
+                } else {
+                    thread::yield_now();
+                }
+            }
+
+            ready_queue = self.ready_queue.lock().unwrap();
+        }
+    }
+
+    /// Takes the idle CPU with the earliest time, the lowest numbered on a tie. There is always
+    /// one, as each dispatcher holds at most one CPU and there are as many CPUs as dispatchers.
+    fn take_earliest_cpu(&self) -> IdleCpu {
+        let mut idle_cpus = self.idle_cpus.lock().unwrap();
+        let idx = (0..idle_cpus.len()).min_by_key(|&idx| (idle_cpus[idx].time, idle_cpus[idx].cpu.get_id()))
+            .expect("Every dispatcher holds at most one CPU");
+
+        idle_cpus.swap_remove(idx)
+    }
+}
+
+pub struct ShortTermScheduler {
+    dispatch: Arc<Dispatch>,
+    /// Present with dispatcher threads: the time to stamp processes with as they become ready.
+    ready_time: Option<u64>,
+    idle_strategy: IdleStrategy,
+    dispatchers: Vec<JoinHandle<Vec<u64>>>,
+    /// Dispatch latencies in nanoseconds of every CPU, sorted, once joined.
+    dispatch_latencies: Vec<u64>,
+}
+
+impl ShortTermScheduler {
+    /// Starts a dispatcher thread for each of `cpu_count` CPUs. Each runs ready processes on
+    /// whichever CPU is free earliest, reports every one on `termination_sender` once it stops,
+    /// and waits for more as `idle_strategy` says. The dispatchers race for the ready queue, so
+    /// which CPU runs which process varies from run to run. Dispatcher i is pinned to
+    /// `host_cores[i]` if listed, while the CPUs move from one dispatcher to the next. The threads
+    /// run until `join`, or until the scheduler is dropped.
+    pub fn new(scheduler_queue: Box<dyn SchedulerQueue + Send>,
+               cpu_count: usize,
+               host_cores: &[usize],
+               idle_strategy: IdleStrategy,
+               memory: Arc<Memory>,
+               clock: Arc<Clock>,
+               termination_sender: Sender<Termination>) -> ShortTermScheduler {
+        let mut sts = ShortTermScheduler::without_dispatcher(scheduler_queue);
+        sts.ready_time = Some(0);
+        sts.idle_strategy = idle_strategy;
+        *sts.dispatch.idle_cpus.lock().unwrap() = (0..cpu_count.max(1)).map(|cpu_idx| IdleCpu {
+            cpu: CPU::with_id(cpu_idx),
+            bank: memory.get_bank_for_cpu(cpu_idx),
+            time: 0,
+        }).collect();
+
+        for dispatcher_idx in 0..cpu_count.max(1) {
+            let dispatch = sts.dispatch.clone();
+            let (memory, clock, termination_sender) = (memory.clone(), clock.clone(), termination_sender.clone());
+            let host_cores = host_cores.to_vec();
+
+            let dispatcher = thread::Builder::new().name(format!("dispatcher{}", dispatcher_idx)).spawn(move || {
+                affinity::pin_cpu_thread(dispatcher_idx, &host_cores);
+                tracer::prepare_thread();
+
+                let mut idle_gaps = IdleGaps::new(idle_strategy);
+                let mut dispatch_latencies = Vec::new();
+
+                while let Some((mut cpu, pcb, latency)) = dispatch.dispatch(idle_strategy, &mut idle_gaps) {
+                    if let Some(latency) = latency {
+                        instrumentation::record(Distribution::DispatchLatency, latency);
+                        dispatch_latencies.push(latency);
+                    }
+
+                    let termination = ShortTermScheduler::run(&mut cpu.cpu, &mut cpu.time, &pcb, &memory, &clock);
+                    let _ = termination_sender.send(termination);
+
+                    // Idle only once the termination is sent, so a drained scheduler has reported everything.
+                    let _ready_queue = dispatch.ready_queue.lock().unwrap();
+                    dispatch.idle_cpus.lock().unwrap().push(cpu);
+                    dispatch.busy_cpus.fetch_sub(1, Ordering::Relaxed);
+                    dispatch.idle_condvar.notify_all();
+                }
+
+                dispatch_latencies
+            });
+
+            sts.dispatchers.push(dispatcher.expect("Failed to start a dispatcher thread"));
+        }
+
+        sts
+    }
+
+    /// Holds ready processes for CPUs run elsewhere, which take them with `try_dispatch`.
+    pub fn without_dispatcher(scheduler_queue: Box<dyn SchedulerQueue + Send>) -> ShortTermScheduler {
         ShortTermScheduler {
-            ready_queue,
-            ready_queue_condvar,
-            dispatch_kill_flag,
+            dispatch: Arc::new(Dispatch {
+                ready_queue: Mutex::new(scheduler_queue),
+                idle_cpus: Mutex::new(Vec::new()),
+                ready_queue_condvar: Condvar::new(),
+                idle_condvar: Condvar::new(),
+                dispatch_kill_flag: AtomicBool::new(false),
+                busy_cpus: AtomicUsize::new(0),
+                parked_cpus: AtomicUsize::new(0),
+                woken_cpus: AtomicUsize::new(0),
+                schedule_count: AtomicU64::new(0),
+                scheduled_at: AtomicU64::new(0),
+                epoch: Instant::now(),
+            }),
+            ready_time: None,
+            idle_strategy: IdleStrategy::Park,
+            dispatchers: Vec::new(),
+            dispatch_latencies: Vec::new(),
+        }
+    }
+
+    /// Waits until the ready queue is empty and every CPU is idle, and returns how long that
+    /// took. Returns at once without running dispatchers, since nothing would empty the queue.
+    pub fn drain(&self) -> Duration {
+        let started = Instant::now();
+        let dispatch = &self.dispatch;
+        let mut ready_queue = dispatch.ready_queue.lock().unwrap();
+
+        while !self.dispatchers.is_empty() && !dispatch.dispatch_kill_flag.load(Ordering::Acquire)
+            && (!ready_queue.is_empty() || dispatch.busy_cpus.load(Ordering::Relaxed) > 0) {
+            ready_queue = dispatch.idle_condvar.wait(ready_queue).unwrap();
+        }
+
+        started.elapsed()
+    }
+
+    /// Tells the dispatchers to exit and wakes those parked on an empty queue. A CPU running a
+    /// process finishes and reports it first. Processes still queued stay there.
+    pub fn stop(&self) {
+        let dispatch = &self.dispatch;
+
+        // Set with the queue locked, so no dispatcher can check the flag and then miss the wake up.
+        let ready_queue = dispatch.ready_queue.lock().unwrap();
+        dispatch.dispatch_kill_flag.store(true, Ordering::Release);
+        drop(ready_queue);
+
+        dispatch.ready_queue_condvar.notify_all();
+        dispatch.idle_condvar.notify_all();
+    }
+
+    /// Stops the dispatchers and waits for their threads to exit. Returns how many were joined.
+    pub fn join(&mut self) -> usize {
+        self.stop();
+
+        let count = self.dispatchers.len();
+        for dispatcher in self.dispatchers.drain(..) {
+            // A dispatcher that panicked has already reported it.
+            if let Ok(dispatch_latencies) = dispatcher.join() {
+                self.dispatch_latencies.extend(dispatch_latencies);
+            }
+        }
+        self.dispatch_latencies.sort_unstable();
+        // Dropping the CPUs hands in what they profiled, as it did when each dispatcher owned one.
+        self.dispatch.idle_cpus.lock().unwrap().clear();
+
+        count
+    }
+
+    pub fn get_idle_strategy(&self) -> IdleStrategy {
+        self.idle_strategy
+    }
+
+    /// Dispatches that found their CPU idle, counted once the dispatchers are joined.
+    pub fn get_dispatch_count(&self) -> usize {
+        self.dispatch_latencies.len()
+    }
+
+    /// The given percentile, from 0 to 100, of the time idle CPUs took to pick up a newly
+    /// scheduled process. Known once the dispatchers are joined.
+    pub fn get_dispatch_latency(&self, percentile: f64) -> Option<Duration> {
+        let latencies = &self.dispatch_latencies;
+        let rank = (percentile / 100.0 * latencies.len() as f64).ceil() as usize;
+
+        latencies.get(rank.clamp(1, latencies.len().max(1)) - 1).map(|&nanos| Duration::from_nanos(nanos))
+    }
+
+    /// Sets the time processes scheduled from here on became ready. Each CPU keeps its own time
+    /// and the clock follows the one furthest ahead, so this is the time of whatever made them
+    /// ready, such as a process leaving its CPU, rather than the clock. Ignored without dispatchers.
+    pub fn set_ready_time(&mut self, now: u64) {
+        if let Some(ready_time) = &mut self.ready_time {
+            *ready_time = now;
         }
     }
 
     pub fn schedule_process(&mut self, pcb: Arc<ProcessControlBlock>) {
-        let queue_lock = &self.ready_queue;
-        let condvar = &self.ready_queue_condvar;
-        
-        let mut ready_queue = queue_lock.lock().unwrap();
+        self.schedule_processes([pcb]);
+    }
 
-        ready_queue.push(pcb);
-        condvar.notify_one();
+    /// Marks a process ready as of `ready_at` rather than the ready time, such as one still
+    /// waiting on a page from disk. No CPU picks it up any earlier. Ignored without dispatchers.
+    pub fn schedule_process_at(&mut self, pcb: Arc<ProcessControlBlock>, ready_at: u64) {
+        let ready_time = self.ready_time;
+        self.set_ready_time(ready_at);
+        self.schedule_process(pcb);
+        self.ready_time = ready_time;
     }
 
-    fn dispatch(ready_queue: &Arc<Mutex<Box<dyn SchedulerQueue + Send>>>, ready_queue_condvar: &Arc<Condvar>) {
-        let mut ready_queue = ready_queue.lock().unwrap();
+    /// Marks a batch of processes ready under one acquisition of the queue lock, then wakes as
+    /// many parked CPUs as there are new processes, or as are parked if fewer. Spinning CPUs see
+    /// the batch on their own.
+    pub fn schedule_processes(&mut self, pcbs: impl IntoIterator<Item = Arc<ProcessControlBlock>>) {
+        let now = self.ready_time;
+        let dispatch = &self.dispatch;
+        let mut ready_queue = dispatch.ready_queue.lock().unwrap();
 
-        while ready_queue.is_empty() {
-            ready_queue = ready_queue_condvar.wait(ready_queue).unwrap();
+        let mut count = 0;
+        for pcb in pcbs {
+            if let Some(now) = now {
+                pcb.ready_at.store(now, Ordering::Release);
+            }
+
+            ready_queue.push(pcb);
+            count += 1;
+        }
+
+        if count == 0 {
+            return;
+        }
+
+        dispatch.scheduled_at.store(dispatch.elapsed_nanos(), Ordering::Relaxed);
+        dispatch.schedule_count.fetch_add(1, Ordering::Release);
+
+        let unsignalled = dispatch.parked_cpus.load(Ordering::Relaxed) - dispatch.woken_cpus.load(Ordering::Relaxed);
+        let wakes = count.min(unsignalled);
+        dispatch.woken_cpus.fetch_add(wakes, Ordering::Relaxed);
+        let depth = ready_queue.len();
+        drop(ready_queue);
+
+        instrumentation::record(Distribution::ReadyQueueDepth, depth as u64);
+
+        for _ in 0..wakes {
+            dispatch.ready_queue_condvar.notify_one();
         }
+    }
+
+    /// Takes a ready process back before a CPU picks it up. Returns None once it is running.
+    pub fn unschedule_process(&mut self, process_id: u32) -> Option<Arc<ProcessControlBlock>> {
+        self.dispatch.ready_queue.lock().unwrap().remove(process_id)
+    }
 
-        let pcb = ready_queue.pop();
+    /// Takes the next ready process for a CPU working from `bank`, if there is one, without waiting.
+    pub fn try_dispatch(&mut self, bank: usize) -> Option<Arc<ProcessControlBlock>> {
+        self.dispatch.ready_queue.lock().unwrap().pop_for_bank(bank)
+    }
 
-        // Send pcb to cpu.
+    pub fn has_ready_processes(&self) -> bool {
+        !self.dispatch.ready_queue.lock().unwrap().is_empty()
+    }
+
+    /// Runs a process to its end on a CPU whose own time is `cpu_time`. The CPU picks it up at
+    /// the later of its own time and the time the process became ready, and moves the shared
+    /// clock on to when it is done.
+    fn run(cpu: &mut CPU, cpu_time: &mut u64, pcb: &ProcessControlBlock, memory: &Memory, clock: &Clock) -> Termination {
+        let dispatched_at = pcb.get_ready_at().max(*cpu_time);
+        let cycles_before = pcb.context.lock().unwrap().stats.cycles;
+        let result = cpu.execute(pcb, memory);
+        let stats = cpu.get_stats();
+
+        *cpu_time = dispatched_at + stats.cycles - cycles_before;
+        clock.advance_to(*cpu_time);
+
+        tracer::record(EventKind::Dispatch, dispatched_at, pcb.id, Some(cpu.get_id()));
+        tracer::record(EventKind::of_exit(result), *cpu_time, pcb.id, Some(cpu.get_id()));
+
+        Termination {
+            process_id: pcb.id,
+            dispatched_at,
+            completed_at: *cpu_time,
+            stats,
+            result,
+        }
     }
 }
 
 impl Drop for ShortTermScheduler {
     fn drop(&mut self) {
-        self.dispatch_kill_flag.store(true, Ordering::Relaxed);
+        self.join();
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::sync::mpsc;
+
+    use super::*;
+
+    use crate::io::ProgramInfo;
+    use crate::kernel::MemoryConfig;
+
+    fn create_processes(memory: &Memory, count: u32) -> Vec<Arc<ProcessControlBlock>> {
+        // MOVI r5 3, MOVI r1 0, ADDI r6 1, SLT r6 r5 r8, BNE r8 r1 -> 0x08, HLT
+        let instructions = [0x4B050003, 0x4B010000, 0x4C060001, 0x10658000, 0x56810008, 0x92000000];
+
+        (1..=count).map(|id| {
+            let program_info = ProgramInfo {
+                id,
+                priority: 1,
+                instruction_buffer_size: instructions.len(),
+                in_buffer_size: 0,
+                out_buffer_size: 0,
+                temp_buffer_size: 0,
+                data_start_idx: 0,
+            };
+            memory.create_process(&program_info, &instructions);
+            memory.get_pcb_for(id)
+        }).collect()
+    }
+
+    #[test]
+    fn test_short_term_scheduler_drain_then_join() {
+        let memory = Arc::new(Memory::new());
+        let (termination_sender, termination_receiver) = mpsc::channel();
+        let mut sts = ShortTermScheduler::new(Box::new(FifoQueue::new()), 4, &[], IdleStrategy::Park, memory.clone(), Arc::new(Clock::new()), termination_sender);
+
+        for pcb in create_processes(&memory, 32) {
+            sts.schedule_process(pcb);
+        }
+
+        sts.drain();
+        assert!(!sts.has_ready_processes());
+        assert_eq!(termination_receiver.try_iter().filter(|termination| termination.result.is_ok()).count(), 32);
+
+        // Every dispatcher has exited and let go of the queue and the termination channel.
+        assert_eq!(sts.join(), 4);
+        assert_eq!(Arc::strong_count(&sts.dispatch), 1);
+        assert!(termination_receiver.recv().is_err());
     }
-}
\ No newline at end of file
+
+    #[test]
+    fn test_short_term_scheduler_stop_leaves_queue() {
+        let memory = Arc::new(Memory::new());
+        let (termination_sender, _termination_receiver) = mpsc::channel();
+        let mut sts = ShortTermScheduler::new(Box::new(FifoQueue::new()), 2, &[], IdleStrategy::Park, memory.clone(), Arc::new(Clock::new()), termination_sender);
+
+        sts.stop();
+        for pcb in create_processes(&memory, 3) {
+            sts.schedule_process(pcb);
+        }
+
+        // A stopped scheduler has nothing to drain into, so drain must not wait.
+        sts.drain();
+        assert_eq!(sts.join(), 2);
+        assert_eq!(sts.try_dispatch(0).map(|pcb| pcb.id), Some(1));
+    }
+
+    #[test]
+    fn test_short_term_scheduler_dispatch_prefers_cpu_bank() {
+        let memory = Memory::with_config(MemoryConfig { size: 2048, bank_count: 2, demand_paging: false });
+        let mut sts = ShortTermScheduler::without_dispatcher(Box::new(FifoQueue::new()));
+
+        for (id, bank) in [(1, 0), (2, 0), (3, 1), (4, 1), (5, 0), (6, 0), (7, 0), (8, 1)] {
+            let program_info = ProgramInfo { id, priority: 1, instruction_buffer_size: 1, in_buffer_size: 0, out_buffer_size: 0, temp_buffer_size: 0, data_start_idx: 0 };
+            sts.schedule_process(Arc::new(ProcessControlBlock { bank, ..ProcessControlBlock::new(&program_info, 0, 1) }));
+        }
+
+        // CPUs 1 and 3 work from bank 1, passing over the older processes of bank 0.
+        let mut dispatch = |cpu| sts.try_dispatch(memory.get_bank_for_cpu(cpu)).map(|pcb| pcb.id);
+        assert_eq!(dispatch(1), Some(3));
+        assert_eq!(dispatch(0), Some(1));
+        assert_eq!(dispatch(3), Some(4));
+        // Process 8 is beyond the window, so CPU 1 takes the oldest rather than wait for its bank.
+        assert_eq!(dispatch(1), Some(2));
+        assert_eq!(dispatch(1), Some(8));
+        assert_eq!(std::iter::from_fn(|| dispatch(1)).collect::<Vec<_>>(), vec![5, 6, 7]);
+    }
+
+    /// Set in the child process `test_short_term_scheduler_drop_joins_parked_dispatchers` reruns itself in.
+    #[cfg(target_os = "linux")]
+    const ALONE: &str = "STS_DROP_TEST_ALONE";
+
+    #[test]
+    #[cfg(target_os = "linux")]
+    fn test_short_term_scheduler_drop_joins_parked_dispatchers() {
+        // Other tests start threads of their own, so the count is only steady in a test process
+        // running this test alone.
+        if std::env::var_os(ALONE).is_none() {
+            let test_name = format!("{}::test_short_term_scheduler_drop_joins_parked_dispatchers",
+                                    module_path!().split_once("::").unwrap().1);
+            let output = std::process::Command::new(std::env::current_exe().unwrap())
+                .args([test_name.as_str(), "--exact", "--test-threads=1"])
+                .env(ALONE, "1")
+                .output()
+                .unwrap();
+
+            let stdout = String::from_utf8_lossy(&output.stdout);
+            assert!(output.status.success() && stdout.contains("1 passed"), "{}", stdout);
+            return;
+        }
+
+        let thread_count = || -> usize {
+            let status = std::fs::read_to_string("/proc/self/status").unwrap();
+            status.lines().find_map(|line| line.strip_prefix("Threads:")).unwrap().trim().parse().unwrap()
+        };
+        let memory = Arc::new(Memory::new());
+        let before = thread_count();
+
+        for _ in 0..200 {
+            let (termination_sender, _termination_receiver) = mpsc::channel();
+            let sts = ShortTermScheduler::new(Box::new(FifoQueue::new()), 4, &[], IdleStrategy::Park, memory.clone(), Arc::new(Clock::new()), termination_sender);
+            assert_eq!(thread_count(), before + 4);
+
+            drop(sts);
+            assert_eq!(thread_count(), before);
+        }
+    }
+
+    #[test]
+    fn test_short_term_scheduler_idle_strategies_record_dispatch_latency() {
+        let memory = Arc::new(Memory::new());
+        let pcbs = create_processes(&memory, 16);
+
+        for idle_strategy in [IdleStrategy::Park, IdleStrategy::Spin(Duration::from_micros(200)), IdleStrategy::Adaptive(Duration::from_micros(200))] {
+            let (termination_sender, termination_receiver) = mpsc::channel();
+            let mut sts = ShortTermScheduler::new(Box::new(FifoQueue::new()), 2, &[], idle_strategy, memory.clone(), Arc::new(Clock::new()), termination_sender);
+
+            // One at a time, so a CPU is idle for each.
+            for pcb in &pcbs {
+                sts.schedule_process(pcb.clone());
+                termination_receiver.recv().unwrap();
+                thread::sleep(Duration::from_micros(50));
+            }
+
+            sts.drain();
+            sts.join();
+            // A CPU that has not yet found the queue empty picks a process up without idling.
+            assert!((1..=pcbs.len()).contains(&sts.get_dispatch_count()), "{:?}", idle_strategy);
+            assert!(sts.get_dispatch_latency(50.0) <= sts.get_dispatch_latency(99.0));
+            assert_eq!(sts.get_dispatch_latency(100.0), sts.get_dispatch_latency(200.0));
+        }
+    }
+
+    #[test]
+    fn test_idle_gaps_adapt_spin_time() {
+        let spin_limit = Duration::from_micros(100);
+        let strategy = IdleStrategy::Adaptive(spin_limit);
+        let mut idle_gaps = IdleGaps::new(strategy);
+        assert_eq!(idle_gaps.spin_time(strategy), spin_limit);
+
+        // Short gaps bring the spin down towards twice their length.
+        for _ in 0..64 {
+            idle_gaps.record(Duration::from_micros(10));
+        }
+        assert!(idle_gaps.spin_time(strategy) <= Duration::from_micros(25));
+
+        // Once gaps outlast the limit, spinning would only burn time, so the CPU parks at once.
+        for _ in 0..64 {
+            idle_gaps.record(Duration::from_millis(1));
+        }
+        assert_eq!(idle_gaps.spin_time(strategy), Duration::ZERO);
+
+        assert_eq!(IdleGaps::new(IdleStrategy::Park).spin_time(IdleStrategy::Park), Duration::ZERO);
+    }
+
+    #[test]
+    fn test_short_term_scheduler_schedule_processes_in_batch() {
+        let memory = Arc::new(Memory::new());
+        let pcbs = create_processes(&memory, 8);
+
+        let mut sts = ShortTermScheduler::without_dispatcher(Box::new(FifoQueue::new()));
+        sts.schedule_processes(Vec::new());
+        sts.schedule_processes(pcbs.iter().cloned());
+        assert_eq!(std::iter::from_fn(|| sts.try_dispatch(0)).map(|pcb| pcb.id).collect::<Vec<_>>(), (1..=8).collect::<Vec<_>>());
+
+        let (termination_sender, termination_receiver) = mpsc::channel();
+        let mut sts = ShortTermScheduler::new(Box::new(FifoQueue::new()), 4, &[], IdleStrategy::Park, memory.clone(), Arc::new(Clock::new()), termination_sender);
+        while sts.dispatch.parked_cpus.load(Ordering::Relaxed) < 4 {
+            thread::yield_now();
+        }
+
+        // Fewer processes than parked CPUs wake only as many CPUs as there are processes.
+        sts.schedule_processes(pcbs[..2].iter().cloned());
+        assert!(sts.dispatch.woken_cpus.load(Ordering::Relaxed) <= 2);
+        sts.schedule_processes(pcbs[2..].iter().cloned());
+
+        sts.drain();
+        assert_eq!(termination_receiver.try_iter().count(), 8);
+        sts.join();
+    }
+}
@@ -0,0 +1,195 @@
+use std::collections::VecDeque;
+
+const SLOT_BITS: u32 = 6;
+const SLOTS: usize = 1 << SLOT_BITS;
+/// Enough levels that every u64 time has one, so nothing overflows the wheel.
+const LEVELS: usize = 11;
+
+/// A hierarchical timing wheel: an event queue ordered by time for a clock that only moves
+/// forward. Level 0 has a slot for each of the next 64 cycles, and every level above has slots
+/// 64 times as wide. An event waits in the lowest level whose slots tell it apart from now, and
+/// drops a level each time the wheel reaches its slot, so scheduling and popping cost a few bit
+/// operations however many events are queued. Events due at the same time pop in the order they
+/// were scheduled.
+pub struct TimingWheel<T> {
+    now: u64,
+    slots: Box<[VecDeque<(u64, T)>]>,
+    /// A bit for every slot holding events, per level.
+    occupied: [u64; LEVELS],
+    len: usize,
+}
+
+impl<T> TimingWheel<T> {
+    pub fn new() -> TimingWheel<T> {
+        TimingWheel {
+            now: 0,
+            slots: (0..LEVELS * SLOTS).map(|_| VecDeque::new()).collect(),
+            occupied: [0; LEVELS],
+            len: 0,
+        }
+    }
+
+    /// Time of the most recently popped event.
+    pub fn now(&self) -> u64 {
+        self.now
+    }
+
+    pub fn len(&self) -> usize {
+        self.len
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len == 0
+    }
+
+    /// Queues an event. Panics if it is due before the most recently popped one.
+    pub fn schedule(&mut self, at: u64, event: T) {
+        assert!(at >= self.now, "Event scheduled in the past");
+
+        self.insert(at, event);
+        self.len += 1;
+    }
+
+    /// Removes the earliest event and moves the wheel to its time.
+    pub fn pop(&mut self) -> Option<(u64, T)> {
+        if self.len == 0 {
+            return None;
+        }
+
+        loop {
+            let ahead = self.occupied[0] & (u64::MAX << (self.now as usize % SLOTS));
+            if ahead != 0 {
+                let slot = ahead.trailing_zeros() as u64;
+                self.now = (self.now & !(SLOTS as u64 - 1)) | slot;
+
+                let events = &mut self.slots[slot as usize];
+                let event = events.pop_front().unwrap();
+                if events.is_empty() {
+                    self.occupied[0] &= !(1 << slot);
+                }
+
+                self.len -= 1;
+                return Some(event);
+            }
+
+            self.cascade();
+        }
+    }
+
+    /// Moves the wheel to the start of the next occupied slot above level 0, and spreads that
+    /// slot's events over the levels below.
+    fn cascade(&mut self) {
+        for level in 1..LEVELS {
+            let shift = SLOT_BITS * level as u32;
+            let current = (self.now >> shift) as usize % SLOTS;
+            let ahead = self.occupied[level] & (u64::MAX << current) & !(1 << current);
+            if ahead == 0 {
+                continue;
+            }
+
+            let slot = ahead.trailing_zeros() as usize;
+            let span_bits = shift + SLOT_BITS;
+            let block = if span_bits >= u64::BITS { 0 } else { self.now >> span_bits << span_bits };
+            self.now = block | (slot as u64) << shift;
+
+            let idx = level * SLOTS + slot;
+            let mut events = std::mem::take(&mut self.slots[idx]);
+            self.occupied[level] &= !(1 << slot);
+
+            for (at, event) in events.drain(..) {
+                self.insert(at, event);
+            }
+            // Hand the emptied buffer back so the slot keeps its capacity.
+            self.slots[idx] = events;
+            return;
+        }
+
+        unreachable!("Events queued but none found ahead");
+    }
+
+    fn insert(&mut self, at: u64, event: T) {
+        let differing_bits = u64::BITS - (at ^ self.now).leading_zeros();
+        let level = (differing_bits.saturating_sub(1) / SLOT_BITS) as usize;
+        let slot = (at >> (SLOT_BITS * level as u32)) as usize % SLOTS;
+
+        self.slots[level * SLOTS + slot].push_back((at, event));
+        self.occupied[level] |= 1 << slot;
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_timing_wheel_pops_in_time_order() {
+        let mut wheel = TimingWheel::new();
+        let times = [5, 64, 0, 4095, 4096, 63, 1 << 40, u64::MAX, 70, 5];
+
+        for (seq, &at) in times.iter().enumerate() {
+            wheel.schedule(at, seq);
+        }
+        assert_eq!(wheel.len(), times.len());
+
+        let mut expected: Vec<_> = times.iter().copied().zip(0..).collect();
+        expected.sort();
+
+        let popped: Vec<_> = std::iter::from_fn(|| wheel.pop()).collect();
+        assert_eq!(popped, expected);
+        assert!(wheel.is_empty());
+        assert_eq!(wheel.now(), u64::MAX);
+    }
+
+    #[test]
+    fn test_timing_wheel_ties_pop_in_schedule_order() {
+        let mut wheel = TimingWheel::new();
+        wheel.schedule(300, "cascaded");
+        wheel.schedule(10, "first");
+
+        // Events due at 300 queue behind the first, whichever level they were scheduled into.
+        assert_eq!(wheel.pop(), Some((10, "first")));
+        wheel.schedule(290, "earlier");
+        wheel.schedule(300, "direct");
+
+        assert_eq!(wheel.pop(), Some((290, "earlier")));
+        wheel.schedule(300, "last");
+
+        let popped: Vec<_> = std::iter::from_fn(|| wheel.pop()).map(|(_, event)| event).collect();
+        assert_eq!(popped, vec!["cascaded", "direct", "last"]);
+    }
+
+    #[test]
+    fn test_timing_wheel_matches_sorted_order_while_running() {
+        // A hold model: each popped event schedules another a pseudo random distance ahead.
+        let mut wheel = TimingWheel::new();
+        let mut reference = std::collections::BTreeSet::new();
+        let mut state = 0x2545_F491_4F6C_DD1Du64;
+
+        for seq in 0..100u64 {
+            wheel.schedule(seq * 7, seq);
+            reference.insert((seq * 7, seq));
+        }
+
+        for seq in 100..10_000u64 {
+            let popped = wheel.pop().unwrap();
+            assert_eq!(Some(popped), reference.pop_first());
+
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            let at = popped.0 + state % 5000;
+
+            wheel.schedule(at, seq);
+            reference.insert((at, seq));
+        }
+    }
+
+    #[test]
+    #[should_panic(expected = "Event scheduled in the past")]
+    fn test_timing_wheel_rejects_past_events() {
+        let mut wheel = TimingWheel::new();
+        wheel.schedule(10, ());
+        wheel.pop();
+        wheel.schedule(9, ());
+    }
+}
@@ -0,0 +1,326 @@
+use std::cell::OnceCell;
+use std::collections::HashMap;
+use std::io::{self, Write};
+use std::sync::{Arc, Mutex, atomic::{AtomicBool, AtomicU64, AtomicUsize, Ordering}};
+
+use super::cpu::QUANTUM_EXPIRED;
+use super::paging::PAGE_FAULT;
+
+/// Events each thread keeps before overwriting its oldest.
+pub const DEFAULT_CAPACITY: usize = 1 << 17;
+
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum EventKind {
+    /// The long term scheduler loaded the program into memory.
+    Admit,
+    /// The process joined the ready queue.
+    Ready,
+    /// A CPU started running the process.
+    Dispatch,
+    /// The process left its CPU with its quantum used up.
+    Preempt,
+    /// The process left its CPU on a page fault, to wait for the pager.
+    IoStart,
+    /// The pager loaded the page the process was waiting on.
+    IoEnd,
+    /// The process halted or faulted.
+    Terminate,
+}
+
+impl EventKind {
+    /// How a process leaves its CPU with `result`.
+    pub fn of_exit(result: Result<(), &'static str>) -> EventKind {
+        match result {
+            Err(QUANTUM_EXPIRED) => EventKind::Preempt,
+            Err(PAGE_FAULT) => EventKind::IoStart,
+            _ => EventKind::Terminate,
+        }
+    }
+
+    fn name(self) -> &'static str {
+        match self {
+            EventKind::Preempt => "preempt",
+            EventKind::IoStart => "io_start",
+            EventKind::Terminate => "terminate",
+            EventKind::IoEnd => "io_end",
+            EventKind::Admit => "admit",
+            EventKind::Ready => "ready",
+            EventKind::Dispatch => "dispatch",
+        }
+    }
+}
+
+/// Something that happened to a process at a cycle of virtual time, on a CPU if it ran on one.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub struct TraceEvent {
+    pub at: u64,
+    pub kind: EventKind,
+    pub process_id: u32,
+    pub cpu: Option<u32>,
+    /// Orders events at the same cycle the way they were recorded. A process's events and a
+    /// CPU's events are each recorded in the order they happen, whichever threads record them.
+    sequence: u64,
+}
+
+/// The latest events of one thread. Only its thread writes to it, so its lock is uncontended
+/// until the trace is taken.
+struct Ring {
+    events: Box<[TraceEvent]>,
+    /// Events ever recorded. The next one goes at this count modulo the capacity.
+    recorded: usize,
+}
+
+impl Ring {
+    fn push(&mut self, event: TraceEvent) {
+        let capacity = self.events.len();
+        self.events[self.recorded % capacity] = event;
+        self.recorded += 1;
+    }
+
+    /// The events still held, oldest first, and how many were overwritten.
+    fn drain(&mut self) -> (Vec<TraceEvent>, usize) {
+        let capacity = self.events.len();
+        let held = self.recorded.min(capacity);
+        let oldest = self.recorded - held;
+        let events = (oldest..self.recorded).map(|idx| self.events[idx % capacity]).collect();
+
+        self.recorded = 0;
+        (events, oldest)
+    }
+}
+
+static ENABLED: AtomicBool = AtomicBool::new(false);
+static CAPACITY: AtomicUsize = AtomicUsize::new(DEFAULT_CAPACITY);
+static SEQUENCE: AtomicU64 = AtomicU64::new(0);
+/// The ring of every thread that recorded since the trace was last taken, exited ones included.
+static RINGS: Mutex<Vec<Arc<Mutex<Ring>>>> = Mutex::new(Vec::new());
+
+thread_local! {
+    static RING: OnceCell<Arc<Mutex<Ring>>> = const { OnceCell::new() };
+}
+
+/// Starts recording, keeping up to `capacity` events per thread. Allocates the calling thread's
+/// ring.
+pub fn enable(capacity: usize) {
+    CAPACITY.store(capacity.max(1), Ordering::Relaxed);
+    ENABLED.store(true, Ordering::Release);
+    prepare_thread();
+}
+
+pub fn disable() {
+    ENABLED.store(false, Ordering::Release);
+}
+
+#[inline]
+pub fn is_enabled() -> bool {
+    ENABLED.load(Ordering::Relaxed)
+}
+
+/// Allocates the calling thread's ring while tracing, so recording on it never allocates.
+/// Threads that skip this allocate on their first event instead.
+pub fn prepare_thread() {
+    if is_enabled() {
+        let _ = RING.try_with(ring_of_thread);
+    }
+}
+
+fn ring_of_thread(ring: &OnceCell<Arc<Mutex<Ring>>>) -> Arc<Mutex<Ring>> {
+    ring.get_or_init(|| {
+        let placeholder = TraceEvent { at: 0, kind: EventKind::Admit, process_id: 0, cpu: None, sequence: 0 };
+        let ring = Arc::new(Mutex::new(Ring {
+            events: vec![placeholder; CAPACITY.load(Ordering::Relaxed)].into_boxed_slice(),
+            recorded: 0,
+        }));
+
+        RINGS.lock().unwrap().push(ring.clone());
+        ring
+    }).clone()
+}
+
+/// Records an event if tracing is enabled. Costs one relaxed load when it is not.
+#[inline]
+pub fn record(kind: EventKind, at: u64, process_id: u32, cpu: Option<usize>) {
+    if is_enabled() {
+        let sequence = SEQUENCE.fetch_add(1, Ordering::Relaxed);
+        record_enabled(TraceEvent { at, kind, process_id, cpu: cpu.map(|cpu| cpu as u32), sequence });
+    }
+}
+
+#[inline(never)]
+fn record_enabled(event: TraceEvent) {
+    let _ = RING.try_with(|ring| match ring.get() {
+        Some(ring) => ring.lock().unwrap().push(event),
+        None => ring_of_thread(ring).lock().unwrap().push(event),
+    });
+}
+
+/// Takes every event recorded so far, in the order they happened, and empties the rings. Rings
+/// of threads that have exited are released.
+pub fn take() -> Trace {
+    let mut rings = RINGS.lock().unwrap();
+    let mut events = Vec::new();
+    let mut dropped = 0;
+
+    for ring in rings.iter() {
+        let (ring_events, ring_dropped) = ring.lock().unwrap().drain();
+        events.extend(ring_events);
+        dropped += ring_dropped;
+    }
+    // Only the registry and a live thread hold a ring.
+    rings.retain(|ring| Arc::strong_count(ring) > 1);
+
+    events.sort_unstable_by_key(|event| (event.at, event.sequence));
+    Trace { events, dropped }
+}
+
+pub struct Trace {
+    events: Vec<TraceEvent>,
+    dropped: usize,
+}
+
+impl Trace {
+    pub fn get_events(&self) -> &[TraceEvent] {
+        &self.events
+    }
+
+    /// Events overwritten before the trace was taken. Their processes' timelines have gaps.
+    pub fn get_dropped(&self) -> usize {
+        self.dropped
+    }
+
+    /// Writes the Chrome trace event format, which chrome://tracing and Perfetto open. Every CPU
+    /// gets a track of the processes it ran, and every process a track of its states: ready,
+    /// running and waiting on I/O. Timestamps are cycles, shown as microseconds.
+    pub fn write_chrome_json<W: Write>(&self, writer: &mut W) -> io::Result<()> {
+        const CPUS: u32 = 1;
+        const PROCESSES: u32 = 2;
+
+        let mut records = vec![
+            format!("{{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": {}, \"args\": {{\"name\": \"CPUs\"}}}}", CPUS),
+            format!("{{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": {}, \"args\": {{\"name\": \"Processes\"}}}}", PROCESSES),
+        ];
+        let span = |pid: u32, tid: u32, name: String, from: u64, to: u64, end: EventKind| {
+            format!("{{\"name\": \"{}\", \"ph\": \"X\", \"pid\": {}, \"tid\": {}, \"ts\": {}, \"dur\": {}, \"args\": {{\"end\": \"{}\"}}}}",
+                    name, pid, tid, from, to - from, end.name())
+        };
+
+        // What each CPU is running and what state each process is in, since when. A lockstep CPU
+        // runs several processes at once.
+        let mut running: HashMap<(u32, u32), u64> = HashMap::new();
+        let mut states: HashMap<u32, (EventKind, u64, Option<u32>)> = HashMap::new();
+
+        for event in &self.events {
+            let TraceEvent { at, kind, process_id, cpu, .. } = *event;
+
+            if let Some((state, since, state_cpu)) = states.remove(&process_id) {
+                if at > since {
+                    let name = match state {
+                        EventKind::Dispatch => format!("running on CPU {}", state_cpu.unwrap_or_default()),
+                        EventKind::IoStart => "waiting on I/O".to_string(),
+                        _ => "ready".to_string(),
+                    };
+                    records.push(span(PROCESSES, process_id, name, since, at, kind));
+                }
+            }
+
+            match kind {
+                EventKind::Admit | EventKind::Terminate => {
+                    records.push(format!("{{\"name\": \"{}\", \"ph\": \"i\", \"s\": \"t\", \"pid\": {}, \"tid\": {}, \"ts\": {}}}",
+                                         kind.name(), PROCESSES, process_id, at));
+                }
+                EventKind::Ready | EventKind::Dispatch | EventKind::IoStart | EventKind::Preempt => {
+                    states.insert(process_id, (if kind == EventKind::Preempt { EventKind::Ready } else { kind }, at, cpu));
+                }
+                EventKind::IoEnd => {}
+            }
+
+            let Some(cpu) = cpu else { continue };
+            match kind {
+                EventKind::Dispatch => {
+                    running.insert((cpu, process_id), at);
+                }
+                _ => {
+                    if let Some(since) = running.remove(&(cpu, process_id)) {
+                        records.push(span(CPUS, cpu, format!("process {}", process_id), since, at, kind));
+                    }
+                }
+            }
+        }
+
+        let mut cpus: Vec<_> = self.events.iter().filter_map(|event| event.cpu).collect();
+        cpus.sort_unstable();
+        cpus.dedup();
+        for cpu in cpus {
+            records.push(format!("{{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": {}, \"tid\": {}, \"args\": {{\"name\": \"CPU {}\"}}}}", CPUS, cpu, cpu));
+        }
+
+        writeln!(writer, "{{\"displayTimeUnit\": \"ns\", \"otherData\": {{\"time_unit\": \"cycles\", \"dropped_events\": {}}}, \"traceEvents\": [", self.dropped)?;
+        for (idx, record) in records.iter().enumerate() {
+            writeln!(writer, "{}{}", record, if idx + 1 < records.len() { "," } else { "" })?;
+        }
+        writeln!(writer, "]}}")
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    use crate::kernel::allocation_counter::count_allocations;
+
+    // The tracer is global, so a single test enables it, and only looks at its own processes.
+    #[test]
+    fn test_tracer_records_and_exports() {
+        const FIRST_ID: u32 = 90_000;
+
+        assert!(!is_enabled());
+        record(EventKind::Admit, 0, FIRST_ID + 9, None);
+
+        enable(8);
+        std::thread::scope(|scope| {
+            scope.spawn(|| {
+                prepare_thread();
+
+                // Once the ring is prepared, recording never touches the heap.
+                assert_eq!(count_allocations(|| {
+                    record(EventKind::Dispatch, 12, FIRST_ID, Some(1));
+                    record(EventKind::Preempt, 20, FIRST_ID, Some(1));
+                    record(EventKind::Dispatch, 20, FIRST_ID, Some(1));
+                    record(EventKind::IoStart, 30, FIRST_ID, Some(1));
+                    record(EventKind::Dispatch, 45, FIRST_ID, Some(1));
+                    record(EventKind::Terminate, 50, FIRST_ID, Some(1));
+                }), 0);
+            });
+
+            record(EventKind::Admit, 10, FIRST_ID, None);
+            record(EventKind::Ready, 10, FIRST_ID, None);
+            record(EventKind::IoEnd, 40, FIRST_ID, None);
+            record(EventKind::Ready, 40, FIRST_ID, None);
+            // Overflows this thread's ring of 8, so the oldest two are lost.
+            (0..6).for_each(|at| record(EventKind::Admit, at, FIRST_ID + 1, None));
+        });
+        disable();
+
+        let trace = take();
+        let events: Vec<_> = trace.get_events().iter().filter(|event| event.process_id == FIRST_ID).map(|event| (event.at, event.kind)).collect();
+
+        assert_eq!(events, vec![
+            (12, EventKind::Dispatch), (20, EventKind::Preempt), (20, EventKind::Dispatch),
+            (30, EventKind::IoStart), (40, EventKind::IoEnd), (40, EventKind::Ready), (45, EventKind::Dispatch), (50, EventKind::Terminate),
+        ]);
+        assert!(trace.get_dropped() >= 2);
+        assert!(trace.get_events().iter().all(|event| event.process_id != FIRST_ID + 9));
+        assert_eq!(EventKind::of_exit(Err(QUANTUM_EXPIRED)), EventKind::Preempt);
+        assert_eq!(EventKind::of_exit(Ok(())), EventKind::Terminate);
+
+        let mut json = Vec::new();
+        trace.write_chrome_json(&mut json).unwrap();
+        let json = String::from_utf8(json).unwrap();
+
+        assert!(json.contains(&format!("{{\"name\": \"process {}\", \"ph\": \"X\", \"pid\": 1, \"tid\": 1, \"ts\": 12, \"dur\": 8, \"args\": {{\"end\": \"preempt\"}}}}", FIRST_ID)));
+        assert!(json.contains(&format!("{{\"name\": \"waiting on I/O\", \"ph\": \"X\", \"pid\": 2, \"tid\": {}, \"ts\": 30, \"dur\": 10, \"args\": {{\"end\": \"io_end\"}}}}", FIRST_ID)));
+        assert!(json.contains(&format!("{{\"name\": \"ready\", \"ph\": \"X\", \"pid\": 2, \"tid\": {}, \"ts\": 40, \"dur\": 5, \"args\": {{\"end\": \"dispatch\"}}}}", FIRST_ID)));
+        assert!(json.contains("\"args\": {\"name\": \"CPU 1\"}"));
+        assert_eq!(json.matches('{').count(), json.matches('}').count());
+    }
+}
@@ -1,9 +1,71 @@
-mod io;
-mod kernel;
+use std::time::Duration;
 
-use kernel::Driver;
+use operating_system_simulator::kernel::{Affinity, AdmissionPolicy, Driver, DriverConfig, Engine, ExecutionMode, IdleStrategy, PageReplacement};
+
+/// Spin time of `--idle spin` and `--idle adaptive` when none is given.
+const DEFAULT_SPIN_MICROS: u64 = 50;
 
 fn main() {
-    let mut _driver = Driver::new();
+    let mut config = DriverConfig::default();
+
+    let mut args = std::env::args().skip(1);
+    while let Some(arg) = args.next() {
+        match arg.as_str() {
+            "--lockstep" => config.execution_mode = ExecutionMode::Lockstep,
+            "--engine" => config.engine = match args.next().as_deref() {
+                Some("threaded") => Engine::Threaded,
+                Some("deterministic") => Engine::Deterministic,
+                Some("async") => Engine::Async,
+                Some("discrete-event") => Engine::DiscreteEvent,
+                _ => panic!("--engine needs one of threaded, deterministic, async, discrete-event"),
+            },
+            "--cpus" => config.cpu_count = args.next().and_then(|count| count.parse().ok()).expect("--cpus needs a CPU count"),
+            "--pin" => config.affinity = match args.next().as_deref() {
+                Some("auto") => Affinity::Topology,
+                Some(cores) => Affinity::Cores(cores.split(',').map(|core| core.parse().expect("--pin needs auto or a comma separated list of host cores")).collect()),
+                None => panic!("--pin needs auto or a comma separated list of host cores"),
+            },
+            "--idle" => config.idle_strategy = {
+                let usage = "--idle needs one of park, spin[:micros], adaptive[:micros]";
+                let strategy = args.next().expect(usage);
+                let (name, micros) = strategy.split_once(':').unwrap_or((&strategy, ""));
+                let spin_time = Duration::from_micros(if micros.is_empty() { DEFAULT_SPIN_MICROS } else { micros.parse().expect(usage) });
+
+                match name {
+                    "park" => IdleStrategy::Park,
+                    "spin" => IdleStrategy::Spin(spin_time),
+                    "adaptive" => IdleStrategy::Adaptive(spin_time),
+                    _ => panic!("{}", usage),
+                }
+            },
+            "--context-switch" => config.context_switch_cycles = args.next().and_then(|cycles| cycles.parse().ok()).expect("--context-switch needs a cycle count"),
+            "--page-in" => config.page_in_cycles = args.next().and_then(|cycles| cycles.parse().ok()).expect("--page-in needs a cycle count"),
+            "--admission" => config.admission_policy = match args.next().as_deref() {
+                Some("fifo") => AdmissionPolicy::Fifo,
+                Some("first-fit") => AdmissionPolicy::FirstFit,
+                Some("best-fit") => AdmissionPolicy::BestFit,
+                Some("smallest-first") => AdmissionPolicy::SmallestFirst,
+                _ => panic!("--admission needs one of fifo, first-fit, best-fit, smallest-first"),
+            },
+            "--compact" => config.compaction = true,
+            "--swap" => config.swapping = true,
+            "--demand-paging" => config.memory.demand_paging = true,
+            "--memory-size" => config.memory.size = args.next().and_then(|size| size.parse().ok()).expect("--memory-size needs a word count"),
+            "--memory-banks" => config.memory.bank_count = args.next().and_then(|count| count.parse().ok()).expect("--memory-banks needs a bank count"),
+            "--replacement" => config.page_replacement = match args.next().as_deref() {
+                Some("fifo") => PageReplacement::Fifo,
+                Some("lru") => PageReplacement::Lru,
+                Some("clock") => PageReplacement::Clock,
+                _ => panic!("--replacement needs one of fifo, lru, clock"),
+            },
+            "--instrumentation" => config.instrumentation_file_path = Some(args.next().expect("--instrumentation needs a path ending in .json or .prom")),
+            "--profile" => config.profile = true,
+            "--trace" => config.trace_file_path = Some(args.next().expect("--trace needs a path")),
+            "--program-file" => config.program_file_path = args.next().expect("--program-file needs a path"),
+            _ => panic!("Unknown argument: {}", arg),
+        }
+    }
+
+    let mut _driver = Driver::with_config(config);
     _driver.start();
-}
\ No newline at end of file
+}